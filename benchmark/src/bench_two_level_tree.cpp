@@ -0,0 +1,652 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <vector>
+#include "two_level_tree.h"
+#include "two_level_tree_pool.h"
+#include "move_log.h"
+#include "local_search.h"
+#include "compact_two_level_tree.h"
+#include "array_tour.h"
+#include "random_instance.h"
+
+// Benchmarks of the core tour operations for TwoLevelTree, with ArrayTour as a baseline.
+// Each benchmark runs at n = 1e3, 1e4, ..., 1e7 cities starting from a random tour.
+
+namespace
+{
+	const int n_queries = 1 << 16;  // number of pre-generated random cities for the queries
+
+	std::vector<int> random_tour(int n_cities, unsigned seed = 1)
+	{
+		std::vector<int> order(n_cities);
+		std::iota(order.begin(), order.end(), 0);
+		std::mt19937 rng{ seed };
+		std::shuffle(order.begin(), order.end(), rng);
+		return order;
+	}
+
+	std::vector<int> random_cities(int n_cities, unsigned seed = 2)
+	{
+		std::vector<int> cities(n_queries);
+		std::mt19937 rng{ seed };
+		std::uniform_int_distribution<int> city_dist{ 0, n_cities - 1 };
+		for (auto& c : cities)
+			c = city_dist(rng);
+		return cities;
+	}
+
+	template<typename Tour>
+	Tour build_tour(int n_cities)
+	{
+		Tour tour{ n_cities };
+		tour.set_raw_tour(random_tour(n_cities));
+		return tour;
+	}
+
+	void add_sizes(benchmark::internal::Benchmark* b)
+	{
+		b->RangeMultiplier(10)->Range(1000, 10000000)->Unit(benchmark::kMicrosecond);
+	}
+
+	// the sizes within the range of 16-bit indices
+	void add_small_sizes(benchmark::internal::Benchmark* b)
+	{
+		b->Arg(1000)->Arg(10000)->Arg(60000)->Unit(benchmark::kMicrosecond);
+	}
+
+	// 16-bit indices, with the number of segments fixed at compile time or not
+	typedef tsp::BasicCompactTwoLevelTree<std::uint16_t> CompactTree16;
+	typedef tsp::BasicCompactTwoLevelTree<std::uint16_t, 128> CompactTree16Fixed;
+}
+
+template<typename Tour>
+static void BM_get_next(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(tour.get_next(cities[i]));
+		i = (i + 1) % cities.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Tour>
+static void BM_is_between(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		int a = cities[i], b = cities[(i + 1) % cities.size()], c = cities[(i + 2) % cities.size()];
+		if (a != b && b != c && a != c)
+			benchmark::DoNotOptimize(tour.is_between(a, b, c));
+		i = (i + 3) % cities.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// the lock-free versions for the concurrent readers, without any writer
+static void BM_concurrent_get_next(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	tour.enable_concurrent_reads();
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(tour.concurrent_get_next(cities[i]));
+		i = (i + 1) % cities.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// the writer of BM_flip_random, which bumps the versions of the changed segments
+static void BM_flip_random_concurrent(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	tour.enable_concurrent_reads();
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		int a = cities[i], c = cities[i + 1];
+		i = (i + 2) % cities.size();
+		int b = tour.get_next(a), d = tour.get_next(c);
+		if (a == c || b == c || d == a)
+			continue;
+		tour.flip(a, b, c, d);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// the same queries as BM_get_next and BM_is_between, but 100 at a time like checking 10 candidate neighbors
+// of 10 cities, either by the batched query or by a loop of the plain ones as the baseline
+template<bool Batched>
+static void BM_get_next_batch(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	auto cities = random_cities(n);
+	const int batch = 100;
+	int next[batch];
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		if (Batched)
+			tour.get_next_batch(&cities[i], batch, next);
+		else
+		{
+			for (int k = 0; k < batch; k++)
+				next[k] = tour.get_next(cities[i + k]);
+		}
+		benchmark::DoNotOptimize(next);
+		i = (i + batch) % (cities.size() - batch);
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+}
+
+template<bool Batched>
+static void BM_is_between_batch(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	auto cities = random_cities(n);
+	std::vector<int> triples;
+	for (std::size_t k = 0; k + 2 < cities.size(); k += 3)
+	{
+		if (cities[k] != cities[k + 1] && cities[k + 1] != cities[k + 2] && cities[k] != cities[k + 2])
+			triples.insert(triples.end(), { cities[k], cities[k + 1], cities[k + 2] });
+	}
+	const int batch = 100;
+	bool result[batch];
+	std::size_t i = 0, n_triples = triples.size() / 3;
+	for (auto _ : state)
+	{
+		if (Batched)
+			tour.is_between_batch(&triples[3 * i], batch, result);
+		else
+		{
+			for (int k = 0; k < batch; k++)
+				result[k] = tour.is_between(triples[3 * (i + k)], triples[3 * (i + k) + 1], triples[3 * (i + k) + 2]);
+		}
+		benchmark::DoNotOptimize(result);
+		i = (i + batch) % (n_triples - batch);
+	}
+	state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// validity checks of 5-opt moves: whether t1, ..., t5 are in tour order, either by is_sequence or by the
+// k - 2 is_between calls it replaces. Half of the moves are valid, which need all the checks
+template<bool UseIsBetween>
+static void BM_is_sequence(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	auto cities = random_cities(n);
+	const int k = 5;
+	std::vector<int> moves;
+	for (std::size_t j = 0; j + k <= cities.size(); j += k)
+	{
+		if (std::set<int>(&cities[j], &cities[j] + k).size() == k)
+		{
+			if (j % (2 * k) == 0)
+				tour.sort_by_tour_order(&cities[j], k);
+			moves.insert(moves.end(), &cities[j], &cities[j] + k);
+		}
+	}
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		const int* t = &moves[i];
+		if (UseIsBetween)
+		{
+			bool valid = true;
+			for (int j = 1; j + 1 < k && valid; j++)
+				valid = tour.is_between(t[0], t[j], t[j + 1]);
+			benchmark::DoNotOptimize(valid);
+		}
+		else
+			benchmark::DoNotOptimize(tour.is_sequence(t, k));
+		i = (i + k) % moves.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// random 2-opt moves: the two removed edges are anywhere in the tour
+template<typename Tour>
+static void BM_flip_random(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		int a = cities[i], c = cities[i + 1];
+		i = (i + 2) % cities.size();
+		int b = tour.get_next(a), d = tour.get_next(c);
+		if (a == c || b == c || d == a)
+			continue;
+		tour.flip(a, b, c, d);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// LK-like local moves: the second edge is at most 50 steps apart from the first one along the tour
+template<typename Tour>
+static void BM_flip_local(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		int a = cities[i], steps = 2 + cities[i + 1] % 49;
+		i = (i + 2) % cities.size();
+		int c = a;
+		for (int k = 0; k < steps; k++)
+			c = tour.get_next(c);
+		tour.flip(a, tour.get_next(a), c, tour.get_next(c));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Tour>
+static void BM_double_bridge_move(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		int x[] = { cities[i], cities[i + 1], cities[i + 2], cities[i + 3] };
+		i = (i + 4) % cities.size();
+		if (std::set<int>(x, x + 4).size() < 4)
+			continue;
+		// sort the last three cities in the forward order starting from the first one
+		int a = x[0];
+		std::sort(x + 1, x + 4, [&tour, a](int u, int v) { return tour.is_between(a, u, v); });
+		tour.double_bridge_move(a, x[1], x[2], x[3]);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// segment-local kicks of at most 50 cities, as generated by the tree itself
+static void BM_random_double_bridges(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	std::mt19937 rng{ 3 };
+	for (auto _ : state)
+		tour.random_double_bridges(1, rng, 50);
+	state.SetItemsProcessed(state.iterations());
+}
+
+// the same kicks with the tour length kept up to date, instead of an O(n) recomputation after each
+static void BM_random_double_bridges_tour_length(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	std::vector<float> x(n), y(n);
+	std::mt19937 rng{ 3 };
+	std::uniform_real_distribution<float> coordinate{ 0, 1 };
+	for (int i = 0; i < n; i++)
+	{
+		x[i] = coordinate(rng);
+		y[i] = coordinate(rng);
+	}
+	tour.set_distance([&x, &y](int a, int b) { return std::hypot(x[a] - x[b], y[a] - y[b]); });
+	for (auto _ : state)
+	{
+		tour.random_double_bridges(1, rng, 50);
+		benchmark::DoNotOptimize(tour.tour_length());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// the cost of random forward paths of about n / 2 cities from the segment costs
+static void BM_path_cost(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	tour.set_distance([](int a, int b) { return static_cast<double>(std::abs(a - b)); });
+	auto cities = random_cities(n);
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(tour.path_cost(cities[i], cities[i + 1]));
+		i = (i + 2) % cities.size();
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Tour>
+static void BM_set_raw_tour(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	Tour tour{ n };
+	auto order = random_tour(n);
+	for (auto _ : state)
+	{
+		tour.set_raw_tour(order);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// the same on all the hardware threads, see tsp::ParallelPolicy, and the export of BM_iterate_cities
+static void BM_set_raw_tour_parallel(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	tsp::TwoLevelTree tour{ n };
+	tsp::ParallelPolicy policy;
+	policy.n_threads = 0;
+	tour.set_parallel_policy(policy);
+	auto order = random_tour(n);
+	for (auto _ : state)
+	{
+		tour.set_raw_tour(order);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_to_raw_tour_parallel(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	tsp::ParallelPolicy policy;
+	policy.n_threads = 0;
+	tour.set_parallel_policy(policy);
+	std::vector<int> raw_tour;
+	tour.update_segment_cache();
+	for (auto _ : state)
+	{
+		tour.to_raw_tour(raw_tour);
+		benchmark::DoNotOptimize(raw_tour.data());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// restart from a binary checkpoint in memory instead of rebuilding the tree from a tour, see BM_set_raw_tour
+static void BM_load(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	std::stringstream ss;
+	tour.save(ss);
+	for (auto _ : state)
+	{
+		ss.clear();
+		ss.seekg(0);
+		tour.load(ss);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// create and destroy an offspring as a copy of a parent tour, with fresh storage or recycled by a pool
+static void BM_offspring_copy(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto parent = build_tour<tsp::TwoLevelTree>(n);
+	for (auto _ : state)
+	{
+		tsp::TwoLevelTree child{ parent };
+		benchmark::DoNotOptimize(child.get_node(0));
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_offspring_pool(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto parent = build_tour<tsp::TwoLevelTree>(n);
+	tsp::TwoLevelTreePool pool{ n };
+	pool.reserve(1);
+	for (auto _ : state)
+	{
+		auto child = pool.acquire(parent);
+		benchmark::DoNotOptimize(child.get_node(0));
+		pool.release(std::move(child));
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// the edges shared by a parent and an offspring after 1000 random flips, city by city and in bulk
+static void BM_common_edges_has_edge(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto first = build_tour<tsp::TwoLevelTree>(n);
+	auto second = first;
+	auto cities = random_cities(n);
+	for (int i = 0; i < 1000; i++)
+		second.reverse(cities[2 * i], cities[2 * i + 1]);
+	for (auto _ : state)
+	{
+		int n_common = 0;
+		for (int city = 0; city < n; city++)
+			n_common += second.has_edge(city, first.get_next(city));
+		benchmark::DoNotOptimize(n_common);
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_count_common_edges(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto first = build_tour<tsp::TwoLevelTree>(n);
+	auto second = first;
+	auto cities = random_cities(n);
+	for (int i = 0; i < 1000; i++)
+		second.reverse(cities[2 * i], cities[2 * i + 1]);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(first.count_common_edges(second));
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// synchronize a replica after 100 local flips by replaying them, see BM_offspring_copy for a full copy
+static void BM_apply_log(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	auto replica = tour;
+	auto initial = replica.snapshot();
+	auto cities = random_cities(n);
+	tsp::MoveLog log;
+	tour.set_move_log(&log);
+	for (int i = 0; i < 100; i++)
+	{
+		int a = cities[i], c = a;
+		for (int step = 0; step < 10; step++)
+			c = tour.get_next(c);
+		tour.flip(a, tour.get_next(a), c, tour.get_next(c));
+	}
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		replica.restore(initial);
+		state.ResumeTiming();
+		replica.apply_log(log);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * 100);
+}
+
+// the segment cache of a TwoLevelTree is updated before each export, the others have none
+template<typename Tour>
+static void update_segment_cache(Tour&)
+{
+}
+
+static void update_segment_cache(tsp::TwoLevelTree& tour)
+{
+	tour.update_segment_cache();
+}
+
+// export after a few flips since the last export, like logging after each improving LK round
+template<typename Tour>
+static void BM_get_raw_tour(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<Tour>(n);
+	auto cities = random_cities(n);
+	std::vector<int> raw_tour;
+	update_segment_cache(tour);
+	tour.to_raw_tour(raw_tour);  // warm up
+	std::size_t i = 0;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		for (int k = 0; k < 10; k++, i = (i + 1) % cities.size())
+		{
+			int a = cities[i], c = a;
+			for (int step = 0; step < 10; step++)
+				c = tour.get_next(c);
+			tour.flip(a, tour.get_next(a), c, tour.get_next(c));
+		}
+		state.ResumeTiming();
+		update_segment_cache(tour);
+		tour.to_raw_tour(raw_tour);
+		benchmark::DoNotOptimize(raw_tour.data());
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// stream the tour once without materializing it, city by city and segment by segment
+static void BM_iterate_cities(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	for (auto _ : state)
+	{
+		long long sum = 0;
+		for (int city : tour.cities())
+			sum += city;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// the same after storing the nodes along the tour
+static void BM_iterate_cities_compacted(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	tour.compact();
+	for (auto _ : state)
+	{
+		long long sum = 0;
+		for (int city : tour.cities())
+			sum += city;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_iterate_segment_runs(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto tour = build_tour<tsp::TwoLevelTree>(n);
+	for (auto _ : state)
+	{
+		long long sum = 0;
+		for (auto run : tour.segment_runs())
+		{
+			// the order inside a segment is irrelevant for a sum
+			for (auto node = run.segment_begin_node; node != run.segment_end_node; node = node->next)
+				sum += node->city;
+			sum += run.segment_end_node->city;
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+// 2-opt and Or-opt with neighbor lists and don't-look bits from a random tour until no city is active
+template<tsp::Improvement improvement>
+static void BM_local_search(benchmark::State& state)
+{
+	int n = static_cast<int>(state.range(0));
+	auto instance = bench::random_instance(n);
+	auto distance = [&instance](int a, int b) { 
+		return std::hypot(instance.x[a] - instance.x[b], instance.y[a] - instance.y[b]); 
+	};
+	tsp::TwoLevelTree tour{ n };
+	auto order = random_tour(n);
+	tsp::LocalSearchOptions options;
+	options.improvement = improvement;
+	long long n_moves = 0;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		tour.set_raw_tour(order);
+		state.ResumeTiming();
+		auto search = tsp::make_local_search(tour, distance, instance.neighbors, options);
+		benchmark::DoNotOptimize(search.run());
+		n_moves += search.n_moves();
+	}
+	state.SetItemsProcessed(n_moves);
+	state.counters["moves"] = benchmark::Counter(static_cast<double>(n_moves) / state.iterations());
+}
+
+#define TOUR_BENCHMARK(name) \
+	BENCHMARK_TEMPLATE(name, tsp::TwoLevelTree)->Apply(add_sizes); \
+	BENCHMARK_TEMPLATE(name, tsp::ArrayTour)->Apply(add_sizes)
+
+#define COMPACT_TOUR_BENCHMARK(name) \
+	BENCHMARK_TEMPLATE(name, tsp::CompactTwoLevelTree)->Apply(add_small_sizes); \
+	BENCHMARK_TEMPLATE(name, CompactTree16)->Apply(add_small_sizes); \
+	BENCHMARK_TEMPLATE(name, CompactTree16Fixed)->Apply(add_small_sizes)
+
+TOUR_BENCHMARK(BM_get_next);
+TOUR_BENCHMARK(BM_is_between);
+COMPACT_TOUR_BENCHMARK(BM_get_next);
+COMPACT_TOUR_BENCHMARK(BM_is_between);
+COMPACT_TOUR_BENCHMARK(BM_flip_random);
+BENCHMARK(BM_concurrent_get_next)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_get_next_batch, false)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_get_next_batch, true)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_is_between_batch, false)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_is_between_batch, true)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_is_sequence, false)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_is_sequence, true)->Apply(add_sizes);
+TOUR_BENCHMARK(BM_flip_random);
+BENCHMARK(BM_flip_random_concurrent)->Apply(add_sizes);
+TOUR_BENCHMARK(BM_flip_local);
+TOUR_BENCHMARK(BM_double_bridge_move);
+BENCHMARK(BM_random_double_bridges)->Apply(add_sizes);
+BENCHMARK(BM_random_double_bridges_tour_length)->Apply(add_sizes);
+BENCHMARK(BM_path_cost)->Apply(add_sizes);
+TOUR_BENCHMARK(BM_set_raw_tour);
+BENCHMARK(BM_set_raw_tour_parallel)->Apply(add_sizes);
+TOUR_BENCHMARK(BM_get_raw_tour);
+BENCHMARK(BM_to_raw_tour_parallel)->Apply(add_sizes);
+BENCHMARK(BM_load)->Apply(add_sizes);
+BENCHMARK(BM_offspring_copy)->Apply(add_sizes);
+BENCHMARK(BM_offspring_pool)->Apply(add_sizes);
+BENCHMARK(BM_common_edges_has_edge)->Apply(add_sizes);
+BENCHMARK(BM_count_common_edges)->Apply(add_sizes);
+BENCHMARK(BM_apply_log)->Apply(add_sizes);
+BENCHMARK(BM_iterate_cities)->Apply(add_sizes);
+BENCHMARK(BM_iterate_cities_compacted)->Apply(add_sizes);
+BENCHMARK(BM_iterate_segment_runs)->Apply(add_sizes);
+BENCHMARK_TEMPLATE(BM_local_search, tsp::Improvement::first)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_local_search, tsp::Improvement::best)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
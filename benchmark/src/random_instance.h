@@ -0,0 +1,63 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+// shared by the benchmarks and the replay_trace tool
+namespace bench
+{
+	// uniform random points with approximately the 8 nearest neighbors of each one, looked up in the
+	// cells of a grid around it
+	struct Instance
+	{
+		std::vector<float> x, y;
+		std::vector<std::vector<int>> neighbors;
+	};
+
+	inline Instance random_instance(int n_cities)
+	{
+		Instance instance;
+		std::mt19937 rng{ 4 };
+		std::uniform_real_distribution<float> coordinate{ 0, 1 };
+		instance.x.resize(n_cities);
+		instance.y.resize(n_cities);
+		for (int i = 0; i < n_cities; i++)
+		{
+			instance.x[i] = coordinate(rng);
+			instance.y[i] = coordinate(rng);
+		}
+		int g = std::max(1, static_cast<int>(std::sqrt(n_cities / 2.0)));  // about 2 cities per cell
+		auto cell = [g](float v) { return std::min(g - 1, static_cast<int>(v * g)); };
+		std::vector<std::vector<int>> cells(g * g);
+		for (int i = 0; i < n_cities; i++)
+			cells[cell(instance.y[i]) * g + cell(instance.x[i])].push_back(i);
+		instance.neighbors.resize(n_cities);
+		std::vector<std::pair<float, int>> found;
+		for (int i = 0; i < n_cities; i++)
+		{
+			found.clear();
+			int cx = cell(instance.x[i]), cy = cell(instance.y[i]);
+			for (int r = 2; found.size() < 8; r++)
+			{
+				found.clear();
+				for (int yy = std::max(0, cy - r); yy <= std::min(g - 1, cy + r); yy++)
+				{
+					for (int xx = std::max(0, cx - r); xx <= std::min(g - 1, cx + r); xx++)
+					{
+						for (int j : cells[yy * g + xx])
+						{
+							if (j != i)
+								found.emplace_back(std::hypot(instance.x[i] - instance.x[j], instance.y[i] - instance.y[j]), j);
+						}
+					}
+				}
+			}
+			std::partial_sort(found.begin(), found.begin() + 8, found.end());
+			for (int k = 0; k < 8; k++)
+				instance.neighbors[i].push_back(found[k].second);
+		}
+		return instance;
+	}
+}
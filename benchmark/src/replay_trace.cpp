@@ -0,0 +1,213 @@
+// Record the moves a TwoLevelTree receives into a binary trace (tsp::MoveTrace), and replay a trace onto
+// fresh trees to measure the throughput, the latency percentiles of each kind of move and the final
+// segment sizes, e.g., to evaluate layout or rebalancing changes against a real workload.
+//
+//   replay_trace record <trace> [n_cities = 100000] [n_kicks = 10000]
+//   replay_trace replay <trace> [repetitions = 5]
+//
+// The recorded workload is an iterated local search: 2-opt and Or-opt from a space-filling-curve tour,
+// followed by segment-local double-bridge kicks, each searched in a transaction that is rolled back
+// unless the tour improves. Its flips are mostly short and clustered, unlike the random flips of the
+// synthetic benchmarks. Any other program can record a trace by tsp::MoveTrace::start as well.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+#include "two_level_tree.h"
+#include "move_log.h"
+#include "move_trace.h"
+#include "local_search.h"
+#include "random_instance.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double elapsed_seconds(Clock::time_point begin)
+	{
+		return std::chrono::duration<double>(Clock::now() - begin).count();
+	}
+
+	// the number of entries of a log, each of which is a move followed by its arguments
+	std::size_t n_entries(const tsp::MoveLog& log)
+	{
+		auto& data = log.data();
+		std::size_t n = 0;
+		for (std::size_t i = 0; i < data.size(); i += 1 + tsp::MoveLog::n_arguments(static_cast<tsp::MoveLog::Move>(data[i])))
+			n++;
+		return n;
+	}
+
+	int record(const char* path, int n_cities, int n_kicks)
+	{
+		auto instance = bench::random_instance(n_cities);
+		auto distance = [&instance](int a, int b) {
+			return std::hypot(instance.x[a] - instance.x[b], instance.y[a] - instance.y[b]);
+		};
+		std::vector<double> x(instance.x.begin(), instance.x.end()), y(instance.y.begin(), instance.y.end());
+		tsp::TwoLevelTree tree{ n_cities };
+		tree.set_raw_tour(tsp::TwoLevelTree::hilbert_order(x, y));
+		tree.set_distance(distance);
+
+		tsp::MoveTrace trace;
+		trace.start(tree);
+		auto search = tsp::make_local_search(tree, distance, instance.neighbors);
+		search.run();
+		std::mt19937 rng{ 29 };
+		std::vector<int> endpoints;
+		int n_improved = 0;
+		for (int i = 0; i < n_kicks; i++)
+		{
+			double length = tree.tour_length();
+			tree.begin_transaction();
+			endpoints.clear();
+			tree.random_double_bridges(1, rng, 50, &endpoints);
+			for (int city : endpoints)
+				search.activate(city);
+			search.run();
+			if (tree.tour_length() < length)
+			{
+				tree.commit();
+				n_improved++;
+			}
+			else
+				tree.rollback();
+		}
+		trace.stop(tree);
+
+		std::ofstream os{ path, std::ios::binary };
+		if (!trace.save(os))
+		{
+			std::fprintf(stderr, "cannot write %s\n", path);
+			return 1;
+		}
+		std::printf("recorded %d cities, %lld moves, %d of %d kicks improved, tour length %.6f\n", n_cities,
+			search.n_moves(), n_improved, n_kicks, tree.tour_length());
+		std::printf("%zu log entries (%zu bytes) written to %s\n", n_entries(trace.log()),
+			trace.log().size() * sizeof(std::int32_t), path);
+		return 0;
+	}
+
+	// the latencies of the moves of a kind, in nanoseconds
+	struct Latencies
+	{
+		const char* name;
+		std::vector<double> ns;
+
+		void print()
+		{
+			if (ns.empty())
+				return;
+			std::sort(ns.begin(), ns.end());
+			auto percentile = [this](double p) { return ns[static_cast<std::size_t>(p * (ns.size() - 1))]; };
+			std::printf("%-18s %10zu %10.0f %10.0f %10.0f %10.0f %10.0f\n", name, ns.size(), percentile(0.5),
+				percentile(0.9), percentile(0.99), percentile(0.999), ns.back());
+		}
+	};
+
+	int replay(const char* path, int repetitions)
+	{
+		tsp::MoveTrace trace;
+		std::ifstream is{ path, std::ios::binary };
+		if (!trace.load(is))
+		{
+			std::fprintf(stderr, "%s is not a valid trace\n", path);
+			return 1;
+		}
+		auto& log = trace.log();
+		auto& data = log.data();
+		auto fresh_tree = [&trace](tsp::TwoLevelTree& tree) {
+			tree = tsp::TwoLevelTree{ trace.n_cities(), trace.origin_city() };
+			return trace.load_initial_state(tree);
+		};
+
+		// the throughput of the complete replay, which is not slowed down by the clocks
+		tsp::TwoLevelTree tree{ trace.n_cities(), trace.origin_city() };
+		std::size_t n_log_entries = n_entries(log);
+		double best = 0;
+		for (int r = 0; r < repetitions; r++)
+		{
+			if (!fresh_tree(tree))
+			{
+				std::fprintf(stderr, "the initial state of %s is invalid\n", path);
+				return 1;
+			}
+			auto begin = Clock::now();
+			std::size_t end = tree.apply_log(log);
+			double seconds = elapsed_seconds(begin);
+			if (end != log.size())
+			{
+				std::fprintf(stderr, "the replay stopped at an invalid entry at %zu\n", end);
+				return 1;
+			}
+			best = r == 0 ? seconds : std::min(best, seconds);
+		}
+		std::printf("%d cities, %zu entries: best of %d replays %.3f ms, %.0f entries/s\n", trace.n_cities(),
+			n_log_entries, repetitions, best * 1e3, n_log_entries / best);
+
+		// the latency of each entry, timed one at a time on a fresh tree
+		Latencies latencies[] = { { "reverse", {} }, { "double_bridge", {} }, { "or_move", {} },
+			{ "rebalance", {} }, { "begin_transaction", {} }, { "commit", {} }, { "rollback", {} } };
+		Latencies all{ "all", {} };
+		fresh_tree(tree);
+		for (std::size_t i = 0; i < data.size();)
+		{
+			auto begin = Clock::now();
+			std::size_t next = tree.apply_log(log, i, i + 1);
+			double ns = elapsed_seconds(begin) * 1e9;
+			latencies[data[i]].ns.push_back(ns);
+			all.ns.push_back(ns);
+			i = next;
+		}
+		std::printf("\n%-18s %10s %10s %10s %10s %10s %10s\n", "latency (ns)", "count", "p50", "p90", "p99", "p99.9", "max");
+		for (auto& l : latencies)
+			l.print();
+		all.print();
+
+		auto sizes = tree.actual_segment_sizes();
+		auto minmax = std::minmax_element(sizes.begin(), sizes.end());
+		std::printf("\nfinal segments: %zu, sizes min %d, mean %.1f, max %d\n", sizes.size(), *minmax.first,
+			static_cast<double>(trace.n_cities()) / sizes.size(), *minmax.second);
+		std::printf("actual_segment_sizes:");
+		for (int size : sizes)
+			std::printf(" %d", size);
+		std::printf("\n");
+		return 0;
+	}
+
+	int usage()
+	{
+		std::fprintf(stderr, "usage: replay_trace record <trace> [n_cities = 100000] [n_kicks = 10000]\n"
+			"       replay_trace replay <trace> [repetitions = 5]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+		return usage();
+	if (std::strcmp(argv[1], "record") == 0)
+	{
+		int n_cities = argc > 3 ? std::atoi(argv[3]) : 100000;
+		int n_kicks = argc > 4 ? std::atoi(argv[4]) : 10000;
+		if (n_cities < 8 || n_kicks < 0)
+			return usage();
+		return record(argv[2], n_cities, n_kicks);
+	}
+	if (std::strcmp(argv[1], "replay") == 0)
+	{
+		int repetitions = argc > 3 ? std::atoi(argv[3]) : 5;
+		if (repetitions < 1)
+			return usage();
+		return replay(argv[2], repetitions);
+	}
+	return usage();
+}
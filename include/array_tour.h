@@ -0,0 +1,153 @@
+#pragma once
+#include <vector>
+#include <cassert>
+#include <utility>
+#include <type_traits>
+#include "two_level_tree.h"
+
+namespace tsp
+{
+	/**
+	 * A plain array representation of a tour with a position vector, which is the fastest for small and
+	 * medium instances (n < ~1000).
+	 *
+	 * `get_next`, `get_prev` and `is_between` are O(1) with very small constants. A reversal costs O(n)
+	 * in the worst case, but \ref flip always reverses the shorter side, hence at most n / 2 swaps.
+	 * Unlike \ref TwoLevelTree, any number of cities (at least one) can be represented.
+	 */
+	class ArrayTour
+	{
+		int _n_cities = 0;
+		int _origin_city = -1;
+		std::vector<int> _tour;		// slots `city - origin_city` in the forward order
+		std::vector<int> _position;	// position of each slot in the _tour
+		std::vector<int> _temp;
+
+	public:
+		/**
+		 * An empty tour, which is meaningless, but may be used as a return value.
+		 */
+		ArrayTour() {}
+
+		/**
+		 * Build an array tour for n cities numbered consecutively from \p origin_city.
+		 * The tour should be later specified by \ref set_raw_tour.
+		 */
+		explicit ArrayTour(int n_cities, int origin_city = 0);
+
+		/**
+		 * Set a forward tour in specific order to be represented.
+		 */
+		void set_raw_tour(const std::vector<int>& order);
+
+		int n_cities() const
+		{
+			return _n_cities;
+		}
+
+		int origin_city() const
+		{
+			return _origin_city;
+		}
+
+		/**
+		 * Get the next city of \p current city in the forward tour.
+		 */
+		int get_next(int current) const
+		{
+			int i = _position[slot(current)] + 1;
+			return _tour[i == _n_cities ? 0 : i] + _origin_city;
+		}
+
+		/**
+		 * Get the previous city of \p current city in the forward tour.
+		 */
+		int get_prev(int current) const
+		{
+			int i = _position[slot(current)];
+			return _tour[i == 0 ? _n_cities - 1 : i - 1] + _origin_city;
+		}
+
+		/**
+		 * Whether city \p b lies between \p a and \p c in a forward traversal.
+		 * @seealso TwoLevelTree::is_between
+		 */
+		bool is_between(int a, int b, int c) const
+		{
+			assert(a != b && a != c && b != c);
+			int i = _position[slot(a)], j = _position[slot(b)], k = _position[slot(c)];
+			if (i < k)
+				return i < j && j < k;
+			return j > i || j < k;
+		}
+
+		/**
+		 * Reverse the forward path between \p a and \p b exactly. Reversing a complete circle does nothing.
+		 */
+		void reverse(int a, int b);
+
+		/**
+		 * Remove two arcs (a, b) and (c, d), and add two others (a, c) and (b, d). The shorter one of
+		 * the two paths is reversed.
+		 * @seealso TwoLevelTree::flip
+		 */
+		void flip(int a, int b, int c, int d);
+
+		/**
+		 * Perform a double-bridge move, see TwoLevelTree::double_bridge_move. Here a, b, c, d only need
+		 * to be distinct and given in a forward tour order. O(n).
+		 */
+		void double_bridge_move(int a, int b, int c, int d);
+
+		/**
+		 * Get the tour encoded by this object. If a negative number is given for the
+		 * \p start_city (default -1), then the tour starts at the origin city.
+		 */
+		std::vector<int> get_raw_tour(int start_city = -1, Direction direction = Direction::forward) const;
+
+		/**
+		 * Output the raw tour to a given vector \param v.
+		 * @note The original contents in \param v, if any, will be cleaned.
+		 */
+		void to_raw_tour(std::vector<int>& v, int start_city = -1, Direction direction = Direction::forward) const;
+
+		/**
+		 * Whether the edge (city1, city2) exists. The direction doesn't matter here.
+		 */
+		bool has_edge(int city1, int city2) const
+		{
+			return get_next(city1) == city2 || get_prev(city1) == city2;
+		}
+
+		/**
+		 * Given an edge's two endpoints (cities), return them in forward order.
+		 */
+		std::pair<int, int> turn_forward(int city1, int city2) const
+		{
+			assert(has_edge(city1, city2));
+			if (get_next(city1) == city2)
+				return { city1, city2 };
+			return { city2, city1 };
+		}
+
+	private:
+		int slot(int city) const
+		{
+			assert(is_city_valid(city));
+			return city - _origin_city;
+		}
+
+		bool is_city_valid(int city) const
+		{
+			return city >= _origin_city && city < _origin_city + _n_cities;
+		}
+
+		// number of cities on the forward path a --> b given by positions
+		int path_length(int i, int j) const
+		{
+			return (j >= i ? j - i : j - i + _n_cities) + 1;
+		}
+	};
+
+	static_assert(std::is_nothrow_move_constructible<ArrayTour>::value, "ArrayTour");
+}
@@ -0,0 +1,778 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+#include <limits>
+#include <utility>
+#include <type_traits>
+#include "two_level_tree.h"
+
+namespace tsp
+{
+	/**
+	 * A compact, index-based variant of \ref TwoLevelTree.
+	 *
+	 * The same algorithms and invariants as \ref TwoLevelTree are used, but instead of pointer-linked
+	 * \ref Node and \ref ParentNode objects, the tree is stored as a structure of arrays:
+	 *	- segment nodes are indexed by their slot `city - origin_city`, so the city itself need not be stored;
+	 *	- `prev`/`next`/`parent` links are indices of type `Index` into these arrays;
+	 *	- each attribute (ID, links, parent, reverse bit, ...) lives in its own array.
+	 *
+	 * A node thus needs 4 indices, i.e., 8 bytes with `std::uint16_t` for up to 65535 cities, 16 bytes
+	 * with the default `std::int32_t` and 32 bytes with `std::int64_t`, and \ref get_next only touches the
+	 * parent index, the reverse bit of the parent and one link array. The IDs in a segment have the
+	 * signed type of the same width. Since merges at the ends of a segment shift its IDs, the segment is
+	 * renumbered around 0 before they would leave their range, so a segment can hold up to the maximum
+	 * of that type, e.g., 32767 cities with 16-bit indices.
+	 *
+	 * If \p NSegments is positive, the number of segments is fixed at compile time: the parent arrays are
+	 * then stored in place instead of on the heap, and the arithmetic modulo the number of segments uses
+	 * a constant divisor.
+	 *
+	 * Only the `int` city API is provided.
+	 */
+	template<typename Index = std::int32_t, int NSegments = 0>
+	class BasicCompactTwoLevelTree
+	{
+	public:
+		static_assert(std::is_integral<Index>::value, "Index");
+		static_assert(NSegments == 0 || NSegments > 1, "we didn't handle the case where only one segment exists");
+
+		using index_type = Index;
+		using id_type = typename std::make_signed<Index>::type;
+
+	private:
+		// the parent arrays, which have a fixed size if the number of segments is known at compile time
+		template<typename T>
+		using parent_array = typename std::conditional<(NSegments > 0), std::array<T, NSegments>, std::vector<T>>::type;
+
+		int _n_cities = 0;
+		int _origin_city = -1;
+		int _nominal_segment_length = 0;
+
+		// segment nodes, indexed by slot
+		std::vector<id_type> _id;			// a sequence number in the segment where it resides
+		std::vector<index_type> _prev;
+		std::vector<index_type> _next;
+		std::vector<index_type> _parent;
+
+		// parent nodes, indexed by the position in these arrays
+		parent_array<char> _reverse;
+		parent_array<index_type> _parent_id;	// a sequence number in the cyclic list of parents
+		parent_array<index_type> _size;
+		parent_array<index_type> _parent_prev;
+		parent_array<index_type> _parent_next;
+		parent_array<index_type> _segment_begin;
+		parent_array<index_type> _segment_end;
+
+		std::vector<index_type> _temp_nodes;
+	public:
+		/**
+		 * An empty tree, which is meaningless, but may be used as a return value.
+		 */
+		BasicCompactTwoLevelTree() {}
+
+		/**
+		 * Build a compact two-level tree for n cities numbered consecutively from \p origin_city.
+		 * The tour should be later specified by \ref set_raw_tour.
+		 */
+		explicit BasicCompactTwoLevelTree(int n_cities, int origin_city = 0);
+
+		/**
+		 * Set a forward tour in specific order to be represented by this tree.
+		 */
+		void set_raw_tour(const std::vector<int>& order);
+
+		int n_segments() const
+		{
+			return static_cast<int>(_parent_id.size());
+		}
+
+		int n_cities() const
+		{
+			return _n_cities;
+		}
+
+		int origin_city() const
+		{
+			return _origin_city;
+		}
+
+		/**
+		 * Get the next city of \p current city in the forward tour.
+		 */
+		int get_next(int current) const
+		{
+			return next_slot(slot(current)) + _origin_city;
+		}
+
+		/**
+		 * Get the previous city of \p current city in the forward tour.
+		 */
+		int get_prev(int current) const
+		{
+			return prev_slot(slot(current)) + _origin_city;
+		}
+
+		/**
+		 * Whether city \p b lies between \p a and \p c in a forward traversal.
+		 * @seealso TwoLevelTree::is_between
+		 */
+		bool is_between(int a, int b, int c) const
+		{
+			return is_between_slots(slot(a), slot(b), slot(c));
+		}
+
+		/**
+		 * Reverse the forward path between \p a and \p b.
+		 */
+		void reverse(int a, int b)
+		{
+			reverse_path(slot(a), slot(b));
+		}
+
+		/**
+		 * Remove two arcs (a, b) and (c, d), and add two others (a, c) and (b, d).
+		 * @seealso TwoLevelTree::flip
+		 */
+		void flip(int a, int b, int c, int d);
+
+		/**
+		 * Perform a double-bridge move. The four cities should be given in a forward tour order with at
+		 * least one other node between each pair of them, and lie in different segments.
+		 * @seealso TwoLevelTree::double_bridge_move
+		 */
+		void double_bridge_move(int a, int b, int c, int d);
+
+		/**
+		 * Get the tour encoded by this tree. If a negative number is given for the
+		 * \p start_city (default -1), then the tour starts at the origin city.
+		 */
+		std::vector<int> get_raw_tour(int start_city = -1, Direction direction = Direction::forward) const
+		{
+			std::vector<int> raw_tour;
+			to_raw_tour(raw_tour, start_city, direction);
+			return raw_tour;
+		}
+
+		/**
+		 * Output the raw tour to a given vector \param v.
+		 * @note The original contents in \param v, if any, will be cleaned.
+		 */
+		void to_raw_tour(std::vector<int>& v, int start_city = -1, Direction direction = Direction::forward) const;
+
+		/**
+		 * Get the lengths of each segment.
+		 * @seealso TwoLevelTree::actual_segment_sizes
+		 */
+		std::vector<int> actual_segment_sizes(int start_city = -1) const;
+
+		/**
+		 * Whether the edge (city1, city2) exists. The direction doesn't matter here.
+		 */
+		bool has_edge(int city1, int city2) const
+		{
+			auto s = slot(city1), t = slot(city2);
+			return _prev[s] == t || _next[s] == t;
+		}
+
+		/**
+		 * Given an edge's two endpoints (cities), return them in forward order.
+		 */
+		std::pair<int, int> turn_forward(int city1, int city2) const
+		{
+			assert(has_edge(city1, city2));
+			if (get_next(city1) == city2)
+				return { city1, city2 };
+			return { city2, city1 };
+		}
+
+	private:
+		template<typename T>
+		static void resize(std::vector<T>& v, int n)
+		{
+			v.resize(n);
+		}
+
+		template<typename T, std::size_t N>
+		static void resize(std::array<T, N>&, int n)
+		{
+			assert(n == static_cast<int>(N));
+			(void)n;
+		}
+
+		index_type slot(int city) const
+		{
+			assert(is_city_valid(city));
+			return static_cast<index_type>(city - _origin_city);
+		}
+
+		bool is_city_valid(int city) const
+		{
+			return city >= _origin_city && city < _origin_city + _n_cities;
+		}
+
+		index_type next_slot(index_type s) const
+		{
+			return _reverse[_parent[s]] ? _prev[s] : _next[s];
+		}
+
+		index_type prev_slot(index_type s) const
+		{
+			return _reverse[_parent[s]] ? _next[s] : _prev[s];
+		}
+
+		index_type forward_begin(index_type p) const
+		{
+			return _reverse[p] ? _segment_end[p] : _segment_begin[p];
+		}
+
+		index_type forward_end(index_type p) const
+		{
+			return _reverse[p] ? _segment_begin[p] : _segment_end[p];
+		}
+
+		index_type backward_begin(index_type p) const
+		{
+			return _reverse[p] ? _segment_begin[p] : _segment_end[p];
+		}
+
+		index_type backward_end(index_type p) const
+		{
+			return _reverse[p] ? _segment_end[p] : _segment_begin[p];
+		}
+
+		// all the following methods work on slots and parent indices, see TwoLevelTree
+
+		bool is_between_slots(index_type a, index_type b, index_type c) const;
+
+		void reverse_path(index_type a, index_type b);
+
+		bool is_path_in_single_segment(index_type a, index_type b) const;
+
+		void reverse_segment(index_type a, index_type b);
+
+		void reverse_complete_segment(index_type a, index_type b);
+
+		void reverse_partial_segment(index_type a, index_type b);
+
+		void split_and_merge(index_type s, bool include_self, Direction direction);
+
+		// renumber the segment p around 0 if merging n more nodes at one of its ends could leave the range of id_type
+		void make_room_for_ids(index_type p, int n);
+
+		void connect_arc_forward(index_type a, index_type b);
+
+		void relabel_id(index_type a, index_type b, id_type a_id);
+
+		bool is_approximately_shorter(index_type a, index_type b, index_type c, index_type d) const;
+
+		int count_n_segments(index_type a, index_type b) const;
+	};
+
+	/**
+	 * The compact tree with 32-bit indices and a number of segments chosen at run time.
+	 */
+	using CompactTwoLevelTree = BasicCompactTwoLevelTree<>;
+
+	static_assert(std::is_nothrow_move_constructible<CompactTwoLevelTree>::value, "CompactTwoLevelTree");
+
+	template<typename Index, int NSegments>
+	BasicCompactTwoLevelTree<Index, NSegments>::BasicCompactTwoLevelTree(int n_cities, int origin_city)
+		: _n_cities{ n_cities }, _origin_city{ origin_city },
+		_id(n_cities), _prev(n_cities), _next(n_cities), _parent(n_cities)
+	{
+		assert(n_cities > 0);
+		assert(origin_city >= 0);
+		assert(static_cast<long long>(n_cities) - 1 <= static_cast<long long>(std::numeric_limits<index_type>::max()));
+		int n = NSegments > 0 ? NSegments : static_cast<int>(std::sqrt(n_cities)) + 1;
+		assert(n > 1 && n <= n_cities); // we didn't handle the case where only one segment exists
+		resize(_reverse, n);
+		resize(_parent_id, n);
+		resize(_size, n);
+		resize(_parent_prev, n);
+		resize(_parent_next, n);
+		resize(_segment_begin, n);
+		resize(_segment_end, n);
+		_nominal_segment_length = n_cities / n;
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::set_raw_tour(const std::vector<int>& order)
+	{
+		assert(static_cast<int>(order.size()) == _n_cities);
+		int n = n_segments();
+		int segment_length = _n_cities / n;
+		for (int current_segment = 0; current_segment < n; current_segment++)
+		{
+			// first build the parent for this segment
+			auto p = static_cast<index_type>(current_segment);
+			_parent_id[p] = p;
+			_parent_prev[p] = static_cast<index_type>(current_segment > 0 ? current_segment - 1 : n - 1);
+			_parent_next[p] = static_cast<index_type>(current_segment + 1 < n ? current_segment + 1 : 0);
+			_reverse[p] = false;
+			// this segment range in the given order tour (the end excluded)
+			int i_begin = current_segment * segment_length;
+			int i_end = current_segment == n - 1 ? _n_cities : i_begin + segment_length;
+			_segment_begin[p] = slot(order[i_begin]);
+			_segment_end[p] = slot(order[i_end - 1]);
+			_size[p] = static_cast<index_type>(i_end - i_begin);
+			// build the segment node one by one
+			for (int i = i_begin; i < i_end; i++)
+			{
+				auto s = slot(order[i]);
+				_parent[s] = p;
+				// cycle tour
+				_prev[s] = slot(i == 0 ? order.back() : order[i - 1]);
+				_next[s] = slot(i + 1 == _n_cities ? order.front() : order[i + 1]);
+				_id[s] = static_cast<id_type>(i - i_begin);
+			}
+		}
+	}
+
+	template<typename Index, int NSegments>
+	bool BasicCompactTwoLevelTree<Index, NSegments>::is_between_slots(index_type a, index_type b, index_type c) const
+	{
+		assert(a != b && a != c && b != c);
+		auto pa = _parent[a], pb = _parent[b], pc = _parent[c];
+		auto ia = _id[a], ib = _id[b], ic = _id[c];
+		// all same parents: in a single segment
+		if (pa == pb && pb == pc)
+		{
+			if (_reverse[pa])
+			{
+				if (ic < ia)
+					return ib < ia && ib > ic;
+				return ib < ia || ib > ic;
+			}
+			if (ic > ia)
+				return ib > ia && ib < ic;
+			return ib > ia || ib < ic;
+		}
+		// all three parents are distinct: note that the parents are in a cyclical list
+		if (pa != pb && pa != pc && pb != pc)
+		{
+			auto qa = _parent_id[pa], qb = _parent_id[pb], qc = _parent_id[pc];
+			if (qc > qa)
+				return qb > qa && qb < qc;
+			return qb > qa || qb < qc;
+		}
+		// now: two nodes share the parent, one different
+		if (pa == pb)
+			return _reverse[pa] ? ib < ia : ia < ib;
+		if (pb == pc)
+			return _reverse[pb] ? ib > ic : ib < ic;
+		// pa == pc
+		return !(_reverse[pa] ? ic < ia : ia < ic);
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::reverse_path(index_type a, index_type b)
+	{
+		if (a == b || next_slot(b) == a)
+			return;
+		// (1) the path is contained in a single segment
+		if (is_path_in_single_segment(a, b))
+		{
+			reverse_segment(a, b);
+			return;
+		}
+		// (2) multiple segments are involved, we simply split and merge to make complete segments
+		auto pa = _parent[a];
+		if (a != forward_begin(pa))
+		{
+			int a_forward_half_length = std::abs(_id[forward_end(pa)] - _id[a]) + 1;
+			if (a_forward_half_length <= _size[pa] / 2)
+				split_and_merge(a, true, Direction::forward);
+			else
+				split_and_merge(a, false, Direction::backward);
+		}
+		if (is_path_in_single_segment(a, b))
+		{
+			reverse_segment(a, b);
+			return;
+		}
+		auto pb = _parent[b];
+		if (b != backward_begin(pb))
+		{
+			// to handle the special cases: [......b..] -> [a......] (i.e., reverse almost a full circle)
+			if (_parent_next[pb] == _parent[a])
+			{
+				split_and_merge(b, true, Direction::backward);
+			}
+			else
+			{
+				int b_backward_half_length = std::abs(_id[backward_end(pb)] - _id[b]) + 1;
+				if (b_backward_half_length <= _size[pb] / 2)
+					split_and_merge(b, true, Direction::backward);
+				else
+					split_and_merge(b, false, Direction::forward);
+			}
+		}
+		if (is_path_in_single_segment(a, b))
+		{
+			reverse_segment(a, b);
+			return;
+		}
+		// now the forward path a ----> b contains multiple complete segments
+		// suppose s1 [a...] [....] [....] [....b] s2
+		pa = _parent[a];
+		pb = _parent[b];
+		assert(a == forward_begin(pa) && b == forward_end(pb));
+		auto s1 = _parent_prev[pa];
+		auto s2 = _parent_next[pb];
+		int n_parents = n_segments();
+		auto link_forward = [this, n_parents](index_type p, index_type q) {
+			_parent_next[p] = q;
+			_parent_prev[q] = p;
+			_parent_id[q] = static_cast<index_type>((_parent_id[p] + 1) % n_parents);
+			connect_arc_forward(forward_end(p), forward_begin(q));
+		};
+		// each segment between a and b is reversed and reconnected between s1 and s2 in a single pass
+		// backward from b, which visits them in their new forward order
+		auto p = s1, q = pb;
+		while (true)
+		{
+			auto q_prev = _parent_prev[q];
+			_reverse[q] = !_reverse[q];
+			link_forward(p, q);
+			p = q;
+			if (q == pa)
+				break;
+			q = q_prev;
+		}
+		link_forward(p, s2);
+		assert((_parent_id[s2] + 1) % n_parents == _parent_id[_parent_next[s2]]);
+	}
+
+	template<typename Index, int NSegments>
+	bool BasicCompactTwoLevelTree<Index, NSegments>::is_path_in_single_segment(index_type a, index_type b) const
+	{
+		auto p = _parent[a];
+		if (p != _parent[b])
+			return false;
+		return _reverse[p] ? _id[a] > _id[b] : _id[a] < _id[b];
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::reverse_segment(index_type a, index_type b)
+	{
+		assert(_parent[a] == _parent[b]);
+		auto p = _parent[a];
+		// if exactly a complete segment
+		if ((a == _segment_begin[p] && b == _segment_end[p]) || (b == _segment_begin[p] && a == _segment_end[p]))
+		{
+			reverse_complete_segment(a, b);
+			return;
+		}
+		// only a part of the segment
+		int path_length = std::abs(_id[a] - _id[b]) + 1;  // IDs are consecutive
+		if (path_length <= _nominal_segment_length * 3 / 4)
+		{
+			reverse_partial_segment(a, b);
+		}
+		else  // split at a and b and merge with their neighbors
+		{
+			split_and_merge(a, false, Direction::backward);
+			split_and_merge(b, false, Direction::forward);
+			reverse_complete_segment(a, b);
+		}
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::reverse_complete_segment(index_type a, index_type b)
+	{
+		auto p = _parent[a];
+		assert(p == _parent[b] && a == forward_begin(p) && b == forward_end(p));
+		auto prev_a = forward_end(_parent_prev[p]);
+		auto next_b = forward_begin(_parent_next[p]);
+		_reverse[p] = !_reverse[p];
+		// repair the 4 connections to the neighbor segments
+		connect_arc_forward(prev_a, b);
+		connect_arc_forward(a, next_b);
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::reverse_partial_segment(index_type a, index_type b)
+	{
+		auto p = _parent[a];
+		assert(p == _parent[b]);
+		auto prev_a = prev_slot(a), next_b = next_slot(b);
+		int partial_segment_length = std::abs(_id[a] - _id[b]) + 1;
+		// first store a and the internal nodes between a and b
+		_temp_nodes.clear();
+		_temp_nodes.push_back(next_b);
+		for (auto q = a; q != b; q = next_slot(q))
+			_temp_nodes.push_back(q);
+		_temp_nodes.push_back(b);
+		// now we reconstruct the connections from prev_a -> b .. -> a -> next_b along the forward direction
+		auto q = prev_a;
+		while (!_temp_nodes.empty())
+		{
+			auto r = _temp_nodes.back();
+			_temp_nodes.pop_back();
+			connect_arc_forward(q, r);
+			q = r;
+		}
+		// if one of them is originally an endpoint (at most one can be)
+		if (a == _segment_begin[p])
+			_segment_begin[p] = b;
+		else if (a == _segment_end[p])
+			_segment_end[p] = b;
+		else if (b == _segment_begin[p])
+			_segment_begin[p] = a;
+		else if (b == _segment_end[p])
+			_segment_end[p] = a;
+		// relabel the IDs for the forward path b --> a. Note ID is numbered according to next.
+		if (_reverse[p])  // a --next-- --next-- b
+		{
+			auto a_id = a == _segment_begin[p] ? _id[_next[b]] - partial_segment_length : _id[_prev[a]] + 1;
+			relabel_id(a, b, static_cast<id_type>(a_id));
+		}
+		else  // b --next-- --next-- a
+		{
+			auto b_id = b == _segment_begin[p] ? _id[_next[a]] - partial_segment_length : _id[_prev[b]] + 1;
+			relabel_id(b, a, static_cast<id_type>(b_id));
+		}
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::split_and_merge(index_type s, bool include_self, Direction direction)
+	{
+		auto p = _parent[s];
+		auto neighbor = direction == Direction::forward ? _parent_next[p] : _parent_prev[p];
+		// get the nodes that need to be merged to the neighbor
+		_temp_nodes.clear();
+		if (include_self)
+			_temp_nodes.push_back(s);
+		index_type boundary;  // the new boundary of the parent segment after being split
+		if (direction == Direction::forward)
+		{
+			for (auto q = next_slot(s); _parent[q] == p; q = next_slot(q))
+				_temp_nodes.push_back(q);
+			boundary = include_self ? prev_slot(s) : s;
+		}
+		else
+		{
+			for (auto q = prev_slot(s); _parent[q] == p; q = prev_slot(q))
+				_temp_nodes.push_back(q);
+			boundary = include_self ? next_slot(s) : s;
+		}
+		if (_temp_nodes.empty())  // no split and merge is needed
+			return;
+
+		make_room_for_ids(neighbor, static_cast<int>(_temp_nodes.size()));
+		auto n_moved = static_cast<index_type>(_temp_nodes.size());
+		_size[neighbor] += n_moved;
+		_size[p] -= n_moved;
+		assert(_size[p] > 0); // we cannot leave an empty segment
+		if (direction == Direction::forward)
+		{
+			auto q = forward_begin(neighbor);
+			id_type delta_id = _reverse[neighbor] ? 1 : -1;
+			while (!_temp_nodes.empty())
+			{
+				auto r = _temp_nodes.back();
+				_temp_nodes.pop_back();
+				_parent[r] = neighbor;
+				connect_arc_forward(r, q);
+				_id[r] = static_cast<id_type>(_id[q] + delta_id);  // relabel the newly merged part in the neighbor segment
+				q = r;
+			}
+			if (_reverse[neighbor])
+				_segment_end[neighbor] = q;
+			else
+				_segment_begin[neighbor] = q;
+			// repair the boundary of the old segment
+			connect_arc_forward(boundary, q);
+			if (_reverse[p])
+				_segment_begin[p] = boundary;
+			else
+				_segment_end[p] = boundary;
+		}
+		else
+		{
+			auto q = forward_end(neighbor);
+			id_type delta_id = _reverse[neighbor] ? -1 : 1;
+			while (!_temp_nodes.empty())
+			{
+				auto r = _temp_nodes.back();
+				_temp_nodes.pop_back();
+				_parent[r] = neighbor;
+				connect_arc_forward(q, r);
+				_id[r] = static_cast<id_type>(_id[q] + delta_id);
+				q = r;
+			}
+			if (_reverse[neighbor])
+				_segment_begin[neighbor] = q;
+			else
+				_segment_end[neighbor] = q;
+			connect_arc_forward(q, boundary);
+			if (_reverse[p])
+				_segment_end[p] = boundary;
+			else
+				_segment_begin[p] = boundary;
+		}
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::make_room_for_ids(index_type p, int n)
+	{
+		// the IDs increase from the segment begin to its end along next
+		long long low = _id[_segment_begin[p]], high = _id[_segment_end[p]];
+		if (low - n >= std::numeric_limits<id_type>::min() && high + n <= std::numeric_limits<id_type>::max())
+			return;
+		// then at most max - n + n / 2 on either side
+		assert(_size[p] + n <= std::numeric_limits<id_type>::max());
+		relabel_id(_segment_begin[p], _segment_end[p], static_cast<id_type>(-(_size[p] / 2)));
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::connect_arc_forward(index_type a, index_type b)
+	{
+		if (_reverse[_parent[a]])
+			_prev[a] = b;
+		else
+			_next[a] = b;
+		if (_reverse[_parent[b]])
+			_next[b] = a;
+		else
+			_prev[b] = a;
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::relabel_id(index_type a, index_type b, id_type a_id)
+	{
+		assert(_parent[a] == _parent[b]);
+		_id[a] = a_id;
+		while (a != b)
+		{
+			_id[_next[a]] = static_cast<id_type>(_id[a] + 1);
+			a = _next[a];
+		}
+	}
+
+	template<typename Index, int NSegments>
+	bool BasicCompactTwoLevelTree<Index, NSegments>::is_approximately_shorter(index_type a, index_type b,
+		index_type c, index_type d) const
+	{
+		int n_segments_ab = count_n_segments(a, b);
+		int n_segments_cd = count_n_segments(c, d);
+		if (n_segments_ab != n_segments_cd)
+			return n_segments_ab < n_segments_cd;
+		int excluded_length_a = std::abs(_id[a] - _id[forward_begin(_parent[a])]);
+		int excluded_length_b = std::abs(_id[b] - _id[forward_end(_parent[b])]);
+		int excluded_length_c = std::abs(_id[c] - _id[forward_begin(_parent[c])]);
+		int excluded_length_d = std::abs(_id[d] - _id[forward_end(_parent[d])]);
+		return excluded_length_a + excluded_length_b > excluded_length_c + excluded_length_d;
+	}
+
+	template<typename Index, int NSegments>
+	int BasicCompactTwoLevelTree<Index, NSegments>::count_n_segments(index_type a, index_type b) const
+	{
+		int n = n_segments();
+		int apid = _parent_id[_parent[a]], bpid = _parent_id[_parent[b]];
+		if (apid == bpid)
+			return is_path_in_single_segment(a, b) ? 1 : n;
+		if (bpid > apid)
+			return bpid - apid + 1;
+		return bpid + n - apid + 1;
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::flip(int a, int b, int c, int d)
+	{
+		auto sa = slot(a), sb = slot(b), sc = slot(c), sd = slot(d);
+		bool is_forward = next_slot(sa) == sb;
+		assert((next_slot(sc) == sd) == is_forward);
+		assert(!((sa == sc) && (sb == sd)));
+		if (sb == sc || sd == sa)  // in this case, even after flip, still the same
+			return;
+		// we tend to reverse the shorter path for possibly reduced computation cost
+		if (is_approximately_shorter(sb, sc, sd, sa))
+		{
+			if (is_forward)
+				reverse_path(sb, sc);
+			else
+				reverse_path(sc, sb);
+		}
+		else
+		{
+			if (is_forward)
+				reverse_path(sd, sa);
+			else
+				reverse_path(sa, sd);
+		}
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::double_bridge_move(int a, int b, int c, int d)
+	{
+		auto sa = slot(a), sb = slot(b), sc = slot(c), sd = slot(d);
+		assert(is_between_slots(sa, sb, sc));
+		assert(is_between_slots(sb, sc, sd));
+		assert(is_between_slots(sc, sd, sa));
+		assert(is_between_slots(sd, sa, sb));
+		auto an = next_slot(sa), bn = next_slot(sb), cn = next_slot(sc), dn = next_slot(sd);
+		// (1) split and merge to make all the above segment boundaries
+		for (auto s : { sa, sb, sc, sd })
+		{
+			if (_parent[s] == _parent[next_slot(s)])
+				split_and_merge(s, false, Direction::forward);
+			assert(s == forward_end(_parent[s]));
+		}
+		// (2) reconnect. Note that p and q are both segment boundary nodes.
+		auto connect_forward = [this](index_type p, index_type q) {
+			connect_arc_forward(p, q);
+			_parent_next[_parent[p]] = _parent[q];
+			_parent_prev[_parent[q]] = _parent[p];
+		};
+		// must be connected in the right order
+		connect_forward(sa, cn);
+		connect_forward(sd, bn);
+		connect_forward(sc, an);
+		connect_forward(sb, dn);
+		// (3) the order of the segments is changed and re-id is needed
+		index_type p = 0, id = 0;
+		do
+		{
+			_parent_id[p] = id++;
+			p = _parent_next[p];
+		} while (p != 0);
+	}
+
+	template<typename Index, int NSegments>
+	void BasicCompactTwoLevelTree<Index, NSegments>::to_raw_tour(std::vector<int>& raw_tour, int start_city,
+		Direction direction) const
+	{
+		if (start_city < 0)
+			start_city = _origin_city;
+		auto s = slot(start_city);
+		raw_tour.resize(_n_cities);
+		for (int i = 0; i < _n_cities; ++i)
+		{
+			raw_tour[i] = s + _origin_city;
+			s = direction == Direction::forward ? next_slot(s) : prev_slot(s);
+		}
+	}
+
+	template<typename Index, int NSegments>
+	std::vector<int> BasicCompactTwoLevelTree<Index, NSegments>::actual_segment_sizes(int start_city) const
+	{
+		if (!is_city_valid(start_city))
+			return std::vector<int>(_size.begin(), _size.end());
+		std::vector<int> ans;
+		ans.reserve(n_segments());
+		auto start_parent = _parent[slot(start_city)];
+		auto p = start_parent;
+		do
+		{
+			ans.push_back(_size[p]);
+			p = _parent_next[p];
+		} while (p != start_parent);
+		return ans;
+	}
+}
@@ -0,0 +1,246 @@
+#pragma once
+#include <vector>
+#include <cassert>
+#include <type_traits>
+#include "two_level_tree.h"
+
+namespace tsp
+{
+	/**
+	 * A k-level tree structure for tour representation, generalizing \ref TwoLevelTree as in Ref. [3]
+	 * of two_level_tree.h (Osterman & Rego).
+	 *
+	 * Level 0 holds the cities. Each upper level groups the elements of the level below it into
+	 * segments, i.e., each element of level l (l >= 1) is a parent of a consecutive run of elements
+	 * of level l - 1. The top level is a cyclic list of its elements.
+	 *
+	 * Definition:
+	 *	- Every level is a doubly-linked cyclic list, just like the segment nodes of a two-level tree.
+	 *	- An element of level l >= 1 has a reverse bit. The orientation of an element is the XOR of the
+	 *		reverse bits of all its ancestors. A forward tour is obtained by calling .next on an element
+	 *		whose orientation is false, otherwise calling .prev.
+	 *
+	 * Invariants:
+	 *	- ID of an element below the top level: if a and a.next share the parent, then a.next.id = a.id + 1.
+	 *	- ID of a top element: if p is not the tail, then p.next.id = p.id + 1, i.e., the IDs are cyclic.
+	 *
+	 * Reversing a path first splits and merges the segments at both ends of the path at each level,
+	 * such that the path becomes a run of complete groups at a higher level, where it is reversed by
+	 * toggling the reverse bits. A flip thus costs roughly O(k * n^(1/k)).
+	 */
+	class KLevelTree
+	{
+	public:
+		static const int max_levels = 8;
+
+	private:
+		struct Level
+		{
+			std::vector<int> parent;	// index of the parent element in the upper level
+			std::vector<int> id;		// a sequence number in the parent (cyclic sequence at the top level)
+			std::vector<int> prev;
+			std::vector<int> next;
+			// only used for the group levels (level >= 1)
+			std::vector<char> reverse;
+			std::vector<int> size;		// number of children
+			std::vector<int> begin;		// the first child, if we traverse the children by .next
+			std::vector<int> end;		// the last child, if we traverse the children by .next
+			int nominal_size = 0;		// the nominal number of children of a group
+		};
+
+		int _n_cities = 0;
+		int _origin_city = -1;
+		std::vector<Level> _levels;
+		std::vector<int> _temp;
+
+	public:
+		/**
+		 * An empty tree, which is meaningless, but may be used as a return value.
+		 */
+		KLevelTree() {}
+
+		/**
+		 * Build a k-level tree with \p n_levels levels (including the city level) for n cities
+		 * numbered consecutively from \p origin_city. The tour should be later specified by
+		 * \ref set_raw_tour. With two levels, this is equivalent to a \ref TwoLevelTree.
+		 */
+		explicit KLevelTree(int n_cities, int n_levels = 3, int origin_city = 0);
+
+		/**
+		 * Set a forward tour in specific order to be represented by this tree.
+		 */
+		void set_raw_tour(const std::vector<int>& order);
+
+		int n_cities() const
+		{
+			return _n_cities;
+		}
+
+		int origin_city() const
+		{
+			return _origin_city;
+		}
+
+		int n_levels() const
+		{
+			return static_cast<int>(_levels.size());
+		}
+
+		/**
+		 * Number of elements in the given \p level, where level 0 is the city level.
+		 */
+		int n_elements(int level) const
+		{
+			return static_cast<int>(_levels[level].id.size());
+		}
+
+		/**
+		 * Get the next city of \p current city in the forward tour. O(k).
+		 */
+		int get_next(int current) const
+		{
+			return next_of(0, slot(current)) + _origin_city;
+		}
+
+		/**
+		 * Get the previous city of \p current city in the forward tour. O(k).
+		 */
+		int get_prev(int current) const
+		{
+			return prev_of(0, slot(current)) + _origin_city;
+		}
+
+		/**
+		 * Whether city \p b lies between \p a and \p c in a forward traversal. O(k).
+		 * @seealso TwoLevelTree::is_between
+		 */
+		bool is_between(int a, int b, int c) const;
+
+		/**
+		 * Reverse the forward path between \p a and \p b.
+		 */
+		void reverse(int a, int b);
+
+		/**
+		 * Remove two arcs (a, b) and (c, d), and add two others (a, c) and (b, d).
+		 * @seealso TwoLevelTree::flip
+		 */
+		void flip(int a, int b, int c, int d);
+
+		/**
+		 * Perform a double-bridge move, see TwoLevelTree::double_bridge_move. Here a, b, c, d only need
+		 * to be distinct and given in a forward tour order. It is implemented by four reversals.
+		 */
+		void double_bridge_move(int a, int b, int c, int d);
+
+		/**
+		 * Get the tour encoded by this tree. If a negative number is given for the
+		 * \p start_city (default -1), then the tour starts at the origin city.
+		 */
+		std::vector<int> get_raw_tour(int start_city = -1, Direction direction = Direction::forward) const;
+
+		/**
+		 * Output the raw tour to a given vector \param v.
+		 * @note The original contents in \param v, if any, will be cleaned.
+		 */
+		void to_raw_tour(std::vector<int>& v, int start_city = -1, Direction direction = Direction::forward) const;
+
+		/**
+		 * Get the sizes of the groups in a \p level (level >= 1) in the order of their storage.
+		 */
+		std::vector<int> group_sizes(int level) const
+		{
+			assert(level >= 1 && level < n_levels());
+			return _levels[level].size;
+		}
+
+		/**
+		 * Whether the edge (city1, city2) exists. The direction doesn't matter here.
+		 */
+		bool has_edge(int city1, int city2) const
+		{
+			auto s = slot(city1), t = slot(city2);
+			return _levels[0].prev[s] == t || _levels[0].next[s] == t;
+		}
+
+	private:
+		int top() const
+		{
+			return n_levels() - 1;
+		}
+
+		int slot(int city) const
+		{
+			assert(is_city_valid(city));
+			return city - _origin_city;
+		}
+
+		bool is_city_valid(int city) const
+		{
+			return city >= _origin_city && city < _origin_city + _n_cities;
+		}
+
+		// XOR of the reverse bits of all the ancestors of element e in level
+		bool orientation(int level, int e) const
+		{
+			bool r = false;
+			for (int l = level; l < top(); l++)
+			{
+				e = _levels[l].parent[e];
+				r ^= _levels[l + 1].reverse[e] != 0;
+			}
+			return r;
+		}
+
+		// the orientation of the children of group g in level
+		bool child_orientation(int level, int g) const
+		{
+			return orientation(level, g) ^ (_levels[level].reverse[g] != 0);
+		}
+
+		int next_of(int level, int e) const
+		{
+			return orientation(level, e) ? _levels[level].prev[e] : _levels[level].next[e];
+		}
+
+		int prev_of(int level, int e) const
+		{
+			return orientation(level, e) ? _levels[level].next[e] : _levels[level].prev[e];
+		}
+
+		// the first child of group g in level in a forward traversal
+		int forward_first(int level, int g) const
+		{
+			return child_orientation(level, g) ? _levels[level].end[g] : _levels[level].begin[g];
+		}
+
+		// the last child of group g in level in a forward traversal
+		int forward_last(int level, int g) const
+		{
+			return child_orientation(level, g) ? _levels[level].begin[g] : _levels[level].end[g];
+		}
+
+		// connect elements u and v in level to form an arc such that u is before v on the forward tour
+		void connect(int level, int u, int v);
+
+		// whether the forward path x --> y in level is contained in a single group
+		bool is_in_single_group(int level, int x, int y) const;
+
+		// reverse the forward path x --> y in level
+		void reverse_range(int level, int x, int y);
+
+		// reverse the forward path x --> y in level in place, which lies in a single group or in the top level
+		void reverse_in_place(int level, int x, int y);
+
+		// split the group of element s in level at s, and merge one half to the neighbor, see TwoLevelTree
+		void split_and_merge(int level, int s, bool include_self, Direction direction);
+
+		// the keys from the top level to the city level which are in ascending order along the forward tour
+		void position_key(int city, int* key) const;
+
+		// approximate number of cities from the beginning of the tour to the given city
+		long long approximate_position(int city) const;
+	};
+
+	static_assert(std::is_nothrow_move_constructible<KLevelTree>::value, "KLevelTree");
+}
@@ -0,0 +1,296 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cassert>
+#include "two_level_tree.h"
+
+namespace tsp
+{
+	/**
+	 * How a \ref LocalSearch picks the move for a city: the first improving one found, or the best
+	 * one among all the candidates of the city.
+	 */
+	enum class Improvement
+	{
+		first,
+		best
+	};
+
+	struct LocalSearchOptions
+	{
+		Improvement improvement = Improvement::first;
+		bool two_opt = true;
+		bool or_opt = true;
+		int max_or_opt_length = 3;	// the longest chain moved by Or-opt
+	};
+
+	/**
+	 * 2-opt and Or-opt with neighbor lists and don't-look bits on a \ref TwoLevelTree.
+	 *
+	 * `Distance` is a functor such that `distance(a, b)` is the length of the edge (a, b), either integral
+	 * or floating-point. The candidates of each city are given by `neighbors[city]`, sorted by an
+	 * increasing distance, so that the search of a city stops at the first candidate not closer than the
+	 * removed edge. The active cities are kept in a queue, which initially holds all the cities; after a
+	 * move, the endpoints of its changed edges are appended to it again.
+	 *
+	 * The candidates of a city are looked up in a batch by \ref TwoLevelTree::get_next_batch and
+	 * \ref TwoLevelTree::get_prev_batch, and each 2-opt move is applied by \ref TwoLevelTree::flip, which
+	 * reverses the approximately shorter side. An Or-opt move is a single \ref TwoLevelTree::or_move
+	 * without any reversal.
+	 */
+	template<typename Distance>
+	class LocalSearch
+	{
+	public:
+		typedef decltype(std::declval<Distance&>()(0, 0)) Length;
+
+		/**
+		 * A search on \p tree, which is changed in place. \p neighbors should outlive the search.
+		 */
+		LocalSearch(TwoLevelTree& tree, Distance distance, const std::vector<std::vector<int>>& neighbors,
+			const LocalSearchOptions& options = LocalSearchOptions{})
+			: _tree(tree), _distance(distance), _neighbors(neighbors), _options(options),
+			_active(tree.origin_city() + tree.n_cities(), 0)
+		{
+			assert(!tree.has_city_ids());
+			assert(static_cast<int>(neighbors.size()) >= tree.origin_city() + tree.n_cities());
+			assert(options.max_or_opt_length >= 1);
+			activate_all();
+		}
+
+		/**
+		 * Mark \p city as active, e.g., an endpoint of a perturbation, see \ref TwoLevelTree::random_double_bridges.
+		 */
+		void activate(int city)
+		{
+			if (!_active[city])
+			{
+				_active[city] = 1;
+				_queue.push_back(city);
+			}
+		}
+
+		void activate_all()
+		{
+			for (int city = _tree.origin_city(); city < _tree.origin_city() + _tree.n_cities(); city++)
+				activate(city);
+		}
+
+		/**
+		 * Apply improving moves until no active city is left.
+		 * @return the total gain, i.e., the decrease of the tour length.
+		 */
+		Length run()
+		{
+			Length total_gain = Length(0);
+			while (!_queue.empty())
+			{
+				int city = _queue.front();
+				_queue.pop_front();
+				_active[city] = 0;
+				// a city stays active as long as some move around it improves
+				Length gain = Length(0);
+				while (improve_city(city, gain))
+				{
+					total_gain += gain;
+					_n_moves++;
+				}
+			}
+			return total_gain;
+		}
+
+		/**
+		 * The number of moves applied so far.
+		 */
+		long long n_moves() const
+		{
+			return _n_moves;
+		}
+
+	private:
+		// a candidate move of improve_city
+		struct Move
+		{
+			bool or_move;
+			int a, b, c, d;	// flip(a, b, c, d) or or_move(a, b, c, d != 0)
+			Length gain;
+		};
+
+		TwoLevelTree& _tree;
+		Distance _distance;
+		const std::vector<std::vector<int>>& _neighbors;
+		LocalSearchOptions _options;
+		std::vector<char> _active;	// the don't-look bits, cleared for the active cities
+		std::deque<int> _queue;
+		long long _n_moves = 0;
+		std::vector<int> _candidate_next, _candidate_prev;
+
+		// keep the better move, and return whether the search of the city may stop
+		bool consider(Move& best, const Move& move)
+		{
+			if (move.gain > best.gain)
+				best = move;
+			return _options.improvement == Improvement::first && best.gain > Length(0);
+		}
+
+		// find and apply an improving move around a, if any
+		bool improve_city(int a, Length& gain)
+		{
+			auto& candidates = _neighbors[a];
+			int k = static_cast<int>(candidates.size());
+			_candidate_next.resize(k);
+			_candidate_prev.resize(k);
+			if (k > 0)
+			{
+				_tree.get_next_batch(candidates.data(), k, _candidate_next.data());
+				_tree.get_prev_batch(candidates.data(), k, _candidate_prev.data());
+			}
+			Move best{ false, 0, 0, 0, 0, Length(0) };
+			bool found = _options.two_opt && two_opt(a, best);
+			if (!found && _options.or_opt)
+				or_opt(a, best);
+			if (!(best.gain > Length(0)))
+				return false;
+			gain = best.gain;
+			apply(best);
+			return true;
+		}
+
+		// remove (a, succ) and (c, succ of c) for the candidates c of a in either direction
+		bool two_opt(int a, Move& best)
+		{
+			auto& candidates = _neighbors[a];
+			int next = _tree.get_next(a), prev = _tree.get_prev(a);
+			Length d_next = _distance(a, next), d_prev = _distance(a, prev);
+			for (std::size_t i = 0; i < candidates.size(); i++)
+			{
+				int c = candidates[i];
+				Length d_ac = _distance(a, c);
+				if (!(d_ac < d_next) && !(d_ac < d_prev))
+					break;
+				if (d_ac < d_next && c != next)
+				{
+					int d = _candidate_next[i];
+					Move move{ false, a, next, c, d, d_next + _distance(c, d) - d_ac - _distance(next, d) };
+					if (d != a && consider(best, move))
+						return true;
+				}
+				if (d_ac < d_prev && c != prev)
+				{
+					int d = _candidate_prev[i];
+					Move move{ false, a, prev, c, d, d_prev + _distance(c, d) - d_ac - _distance(prev, d) };
+					if (d != a && consider(best, move))
+						return true;
+				}
+			}
+			return false;
+		}
+
+		// move the forward chains of at most max_or_opt_length cities starting or ending at a next to the
+		// candidates of a. As in the 2-opt, a candidate c is only tried if the removal gain minus the 
+		// new edge (a, c) is still positive
+		bool or_opt(int a, Move& best)
+		{
+			int n = _tree.n_cities();
+			for (int length = 1; length <= _options.max_or_opt_length && length + 3 <= n; length++)
+			{
+				// a is the first and then the last city of the chain
+				for (int side = 0; side < 2; side++)
+				{
+					int s1 = a, s2 = a;
+					for (int i = 1; i < length; i++)
+					{
+						if (side == 0)
+							s2 = _tree.get_next(s2);
+						else
+							s1 = _tree.get_prev(s1);
+					}
+					if (length == 1 && side == 1)
+						break;
+					if (or_opt_chain(a, s1, s2, length, best))
+						return true;
+				}
+			}
+			return false;
+		}
+
+		bool or_opt_chain(int a, int s1, int s2, int length, Move& best)
+		{
+			int sp = _tree.get_prev(s1), sn = _tree.get_next(s2);
+			Length removal_gain = _distance(sp, s1) + _distance(s2, sn) - _distance(sp, sn);
+			// the chain is at most a few cities, whose membership is checked by walking it
+			auto in_chain = [this, s1, length](int x) {
+				int y = s1;
+				for (int i = 0; i < length; i++, y = _tree.get_next(y))
+				{
+					if (y == x)
+						return true;
+				}
+				return false;
+			};
+			auto& candidates = _neighbors[a];
+			for (std::size_t i = 0; i < candidates.size(); i++)
+			{
+				int c = candidates[i];
+				Length d_ac = _distance(a, c);
+				if (!(d_ac < removal_gain))
+					break;
+				if (in_chain(c))
+					continue;
+				// a next to c: either c -> a as in p -> (chain) or a -> c as in (chain) -> pn
+				int p_after = c, pn_after = _candidate_next[i];
+				int p_before = _candidate_prev[i], pn_before = c;
+				if (!in_chain(pn_after) && p_after != sp)
+				{
+					// p_after -> a, so the chain is reversed if a is its last city
+					bool reversed = a != s1;
+					int first = reversed ? s2 : s1, last = reversed ? s1 : s2;
+					Length add = _distance(p_after, first) + _distance(last, pn_after) - _distance(p_after, pn_after);
+					Move move{ true, s1, s2, p_after, reversed ? 1 : 0, removal_gain - add };
+					if (consider(best, move))
+						return true;
+				}
+				if (!in_chain(p_before) && p_before != sp)
+				{
+					// a -> pn_before, so the chain is reversed if a is its first city
+					bool reversed = a != s2;
+					int first = reversed ? s2 : s1, last = reversed ? s1 : s2;
+					Length add = _distance(p_before, first) + _distance(last, pn_before) - _distance(p_before, pn_before);
+					Move move{ true, s1, s2, p_before, reversed ? 1 : 0, removal_gain - add };
+					if (consider(best, move))
+						return true;
+				}
+			}
+			return false;
+		}
+
+		void apply(const Move& move)
+		{
+			if (move.or_move)
+			{
+				int s1 = move.a, s2 = move.b, p = move.c;
+				int pn = _tree.get_next(p);
+				for (int city : { _tree.get_prev(s1), s1, s2, _tree.get_next(s2), p, pn })
+					activate(city);
+				_tree.or_move(s1, s2, p, move.d != 0);
+			}
+			else
+			{
+				for (int city : { move.a, move.b, move.c, move.d })
+					activate(city);
+				_tree.flip(move.a, move.b, move.c, move.d);
+			}
+		}
+	};
+
+	/**
+	 * Build a \ref LocalSearch, deducing the type of the distance functor, e.g., a lambda.
+	 */
+	template<typename Distance>
+	LocalSearch<Distance> make_local_search(TwoLevelTree& tree, Distance distance,
+		const std::vector<std::vector<int>>& neighbors, const LocalSearchOptions& options = LocalSearchOptions{})
+	{
+		return LocalSearch<Distance>(tree, distance, neighbors, options);
+	}
+}
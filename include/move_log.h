@@ -0,0 +1,107 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+
+namespace tsp
+{
+	/**
+	 * A compact log of the moves applied to a \ref TwoLevelTree, see \ref TwoLevelTree::set_move_log.
+	 * Replaying it by \ref TwoLevelTree::apply_log onto a replica that was in the same state when the
+	 * logging started, e.g., a copy or a tree loaded from the same checkpoint, brings the replica to the
+	 * same state in O(moves) instead of copying the complete tree.
+	 *
+	 * Each entry is stored as 32-bit integers: the kind of the move followed by its city arguments.
+	 * Positions in the log are offsets in these integers, so a replica can be synchronized incrementally
+	 * from the \ref size seen at its last synchronization.
+	 */
+	class MoveLog
+	{
+	public:
+		enum class Move : std::int32_t
+		{
+			reverse,			// reverse(a, b)
+			double_bridge,		// double_bridge_move(a, b, c, d)
+			or_move,			// or_move(s1, s2, p, reversed)
+			rebalance,			// rebalance()
+			begin_transaction,
+			commit,
+			rollback
+		};
+
+		/**
+		 * The number of city arguments of a move.
+		 */
+		static int n_arguments(Move move)
+		{
+			switch (move)
+			{
+			case Move::reverse:
+				return 2;
+			case Move::double_bridge:
+			case Move::or_move:
+				return 4;
+			default:
+				return 0;
+			}
+		}
+
+		void record(Move move)
+		{
+			_data.push_back(static_cast<std::int32_t>(move));
+		}
+
+		void record(Move move, int a, int b)
+		{
+			_data.insert(_data.end(), { static_cast<std::int32_t>(move), a, b });
+		}
+
+		void record(Move move, int a, int b, int c, int d)
+		{
+			_data.insert(_data.end(), { static_cast<std::int32_t>(move), a, b, c, d });
+		}
+
+		/**
+		 * The size of the log in 32-bit integers, which is the position of the next entry.
+		 */
+		std::size_t size() const
+		{
+			return _data.size();
+		}
+
+		bool empty() const
+		{
+			return _data.empty();
+		}
+
+		/**
+		 * Remove all the entries, e.g., after all the replicas are synchronized. The storage is kept.
+		 */
+		void clear()
+		{
+			_data.clear();
+		}
+
+		const std::vector<std::int32_t>& data() const
+		{
+			return _data;
+		}
+
+		/**
+		 * Write the log to a binary stream in the host byte order.
+		 * @return whether the stream is still good.
+		 */
+		bool save(std::ostream& os) const;
+
+		/**
+		 * Read a log written by \ref save, replacing the current entries.
+		 * @return false if the stream does not contain a complete and well-formed log, in which case 
+		 * this log is left unchanged.
+		 */
+		bool load(std::istream& is);
+
+	private:
+		std::vector<std::int32_t> _data;
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <iosfwd>
+#include "two_level_tree.h"
+#include "move_log.h"
+
+namespace tsp
+{
+	/**
+	 * A recording of the moves that a \ref TwoLevelTree receives in a real run, together with its state
+	 * when the recording started, such that exactly the same traffic can be replayed onto fresh trees,
+	 * e.g., by the *replay_trace* tool in the *benchmark* directory.
+	 *
+	 * The moves are recorded by a \ref MoveLog, see \ref TwoLevelTree::set_move_log. A \ref TwoLevelTree::flip
+	 * is logged as the reversal it chose, which reverses exactly the same cities on any segment layout,
+	 * so the trace can also be replayed with other segment or rebalance policies.
+	 */
+	class MoveTrace
+	{
+	public:
+		/**
+		 * Start recording \p tree: checkpoint its state and log its moves into this trace from now on,
+		 * replacing any previous recording. This replaces the move log of the tree, if any, and the trace
+		 * should outlive the recording.
+		 */
+		void start(TwoLevelTree& tree);
+
+		/**
+		 * Stop recording \p tree, which keeps the moves recorded so far.
+		 */
+		void stop(TwoLevelTree& tree);
+
+		/**
+		 * Bring \p tree, which should be built for \ref n_cities cities from \ref origin_city, to the state
+		 * at the start of the recording, after which the moves are replayed by `tree.apply_log(log())`.
+		 * @return false if there is no such state for this tree, which is then left unchanged.
+		 */
+		bool load_initial_state(TwoLevelTree& tree) const;
+
+		int n_cities() const
+		{
+			return _n_cities;
+		}
+
+		int origin_city() const
+		{
+			return _origin_city;
+		}
+
+		const MoveLog& log() const
+		{
+			return _log;
+		}
+
+		/**
+		 * Write the trace to a binary stream in the host byte order: the checkpoint of \ref TwoLevelTree::save
+		 * followed by the log of \ref MoveLog::save.
+		 * @return whether the stream is still good.
+		 */
+		bool save(std::ostream& os) const;
+
+		/**
+		 * Read a trace written by \ref save, replacing the current one.
+		 * @return false if the stream does not contain a complete trace, in which case this trace is left
+		 * unchanged. The checkpoint itself is only validated by \ref load_initial_state.
+		 */
+		bool load(std::istream& is);
+
+	private:
+		int _n_cities = 0;
+		int _origin_city = 0;
+		std::string _initial_state;	// written by TwoLevelTree::save
+		MoveLog _log;
+	};
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include "two_level_tree.h"
+#include "array_tour.h"
+
+namespace tsp
+{
+	/**
+	 * The tour representations selectable by \ref select_tour_backend.
+	 */
+	enum class TourBackend
+	{
+		array,			// ArrayTour
+		two_level_tree	// TwoLevelTree
+	};
+
+	/**
+	 * Up to this number of cities, an \ref ArrayTour is faster than a \ref TwoLevelTree.
+	 */
+	const int array_tour_max_cities = 1000;
+
+	/**
+	 * Pick the fastest tour representation for \p n_cities cities.
+	 */
+	inline TourBackend select_tour_backend(int n_cities)
+	{
+		return n_cities <= array_tour_max_cities ? TourBackend::array : TourBackend::two_level_tree;
+	}
+
+	namespace detail
+	{
+		template<typename... Ts>
+		struct make_void
+		{
+			typedef void type;
+		};
+	}
+
+	/**
+	 * Whether type T provides the common `int` city interface of a tour, i.e., set_raw_tour, n_cities,
+	 * get_next, get_prev, is_between, reverse, flip, double_bridge_move and get_raw_tour. It is satisfied
+	 * by \ref ArrayTour, \ref TwoLevelTree, \ref CompactTwoLevelTree and \ref KLevelTree, so that a
+	 * solver written as a template over T works with any of them.
+	 */
+	template<typename T, typename = void>
+	struct is_tour : std::false_type
+	{
+	};
+
+	template<typename T>
+	struct is_tour<T, typename detail::make_void<
+		decltype(std::declval<T&>().set_raw_tour(std::declval<const std::vector<int>&>())),
+		decltype(std::declval<T&>().reverse(0, 0)),
+		decltype(std::declval<T&>().flip(0, 0, 0, 0)),
+		decltype(std::declval<T&>().double_bridge_move(0, 0, 0, 0)),
+		typename std::enable_if<std::is_convertible<decltype(std::declval<const T&>().n_cities()), int>::value>::type,
+		typename std::enable_if<std::is_convertible<decltype(std::declval<const T&>().get_next(0)), int>::value>::type,
+		typename std::enable_if<std::is_convertible<decltype(std::declval<const T&>().get_prev(0)), int>::value>::type,
+		typename std::enable_if<std::is_convertible<decltype(std::declval<const T&>().is_between(0, 0, 0)), bool>::value>::type,
+		typename std::enable_if<std::is_same<decltype(std::declval<const T&>().get_raw_tour()), std::vector<int>>::value>::type
+		>::type> : std::true_type
+	{
+	};
+
+	static_assert(is_tour<ArrayTour>::value, "ArrayTour");
+	static_assert(is_tour<TwoLevelTree>::value, "TwoLevelTree");
+
+	/**
+	 * Build the fastest tour representation for \p n_cities cities numbered consecutively from
+	 * \p origin_city, and call `visitor(tour)` with it. The visitor should accept any type satisfying
+	 * \ref is_tour, e.g., a functor with a template `operator()`. Its result is returned.
+	 * @note The tour still needs to be specified by `set_raw_tour` inside the visitor.
+	 */
+	template<typename Visitor>
+	auto with_tour_backend(int n_cities, int origin_city, Visitor&& visitor)
+		-> decltype(visitor(std::declval<ArrayTour&>()))
+	{
+		if (select_tour_backend(n_cities) == TourBackend::array)
+		{
+			ArrayTour tour{ n_cities, origin_city };
+			return visitor(tour);
+		}
+		TwoLevelTree tour{ n_cities, origin_city };
+		return visitor(tour);
+	}
+}
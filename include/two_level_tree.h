@@ -1,14 +1,23 @@
 #pragma once
 #include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <random>
+#include <iosfwd>
+#include <atomic>
+#include <memory>
+#include <functional>
 #include "node.h"
 
 /**
  * References for the two-level tree structure.
  * [1] Fredman, Michael L., David S. Johnson, Lyle A. McGeoch, and Gretchen Ostheimer.
  *	"Data structures for traveling salesmen." Journal of Algorithms 18, no. 3 (1995): 432-479.
- * [2] Helsgaun, Keld. "An effective implementation of the LinKernighan traveling salesman heuristic.
+ * [2] Helsgaun, Keld. "An effective implementation of the Lin�Kernighan traveling salesman heuristic.
  *	" European Journal of Operational Research 126, no. 1 (2000): 106-130.
- * [3] Osterman, Colin, and Csar Rego.
+ * [3] Osterman, Colin, and C�sar Rego.
  *	"A k-level data structure for large-scale traveling salesman problems."
  *	Annals of Operations Research 244, no. 2 (2016): 583-601.
  */
@@ -17,12 +26,79 @@
 
 namespace tsp
 {
+	class MoveLog;
+
 	enum class Direction
 	{
 		forward,
 		backward
 	};
 
+	/**
+	 * How the segment sizes are kept balanced while the tour is being changed.
+	 */
+	enum class Rebalance
+	{
+		implicit,	// only the implicit rebalance done by split-and-merge (default)
+		local,		// split an oversized segment into its neighbors, refill an undersized one from them
+		relayout	// rebuild all segments from the current tour, at most once every n_segments() moves
+	};
+
+	/**
+	 * An opt-in explicit rebalancing policy. A segment is unbalanced if its size is larger than
+	 * `max_ratio` * nominal segment length, or smaller than `min_ratio` * nominal segment length.
+	 * The check only considers the segments resized by the last move, so it costs O(1) per move
+	 * unless some rebalance work is really needed.
+	 */
+	struct RebalancePolicy
+	{
+		Rebalance mode = Rebalance::implicit;
+		double max_ratio = 3.0;
+		double min_ratio = 0.25;
+	};
+
+	/**
+	 * How the segments of a \ref TwoLevelTree are laid out. The number of segments is `n_segments` if it
+	 * is positive, otherwise about n / `nominal_length` if that is positive, otherwise sqrt(n) + 1 as in
+	 * Ref. [1]. There are at least two segments in any case.
+	 */
+	struct SegmentPolicy
+	{
+		int n_segments = 0;
+		int nominal_length = 0;
+		// a path inside a single segment is reversed in place if it contains at most this ratio of the
+		// nominal segment length, otherwise it is made a complete segment by split-and-merge first
+		double partial_reverse_ratio = 0.75;
+	};
+
+	/**
+	 * How the bulk operations of a \ref TwoLevelTree over all the segments, i.e., building the tree by 
+	 * \ref TwoLevelTree::set_raw_tour and exporting it by \ref TwoLevelTree::to_raw_tour, are split among
+	 * threads. They stay serial for less than `min_cities` cities or a single thread. If `n_threads` is 
+	 * not positive, std::thread::hardware_concurrency() threads are used.
+	 */
+	struct ParallelPolicy
+	{
+		int n_threads = 1;
+		int min_cities = 1000000;
+	};
+
+	/**
+	 * Counters of the internal operations of a \ref TwoLevelTree. They are only collected if the library
+	 * is compiled with the macro TSP_TWO_LEVEL_TREE_STATS defined. Otherwise, they stay zero at no cost.
+	 */
+	struct TreeStats
+	{
+		long long n_partial_segment_reversals = 0;	// in-place reversals inside a single segment
+		long long n_complete_segment_reversals = 0;	// reversals of exactly one complete segment
+		long long n_multi_segment_reversals = 0;	// reversals of a path spanning multiple segments
+		long long n_split_and_merges = 0;			// split-and-merge operations that moved nodes
+		long long n_nodes_moved = 0;				// nodes moved to a neighbor segment by split-and-merge
+		long long n_nodes_relabeled = 0;			// node IDs rewritten by relabel_id
+		long long n_parents_relinked = 0;			// parent nodes reconnected in the parent list
+		long long n_or_moves = 0;					// or-opt moves spliced without reversals
+	};
+
 #define CONST_THIS static_cast<const TwoLevelTree*>(this)
 	/**
 	 * A two-level tree structure as an efficient tour representation.
@@ -55,11 +131,108 @@ namespace tsp
 		std::vector<Node> _nodes;
 		int _n_cities = 0;
 		int _origin_city = -1;
+
+		// how get_node finds the node of a city: at its offset from the origin city, through _city_slots 
+		// or through _id_slots. Derived from them by update_city_lookup, which keeps a single test in the 
+		// common case.
+		enum class CityLookup : char
+		{
+			offset,
+			slots,
+			ids
+		};
+		CityLookup _city_lookup = CityLookup::offset;
 		int _nominal_segment_length = 0;
+		SegmentPolicy _segment_policy;
+		int _max_partial_reverse_length = 0;	// derived from the segment policy
 
 		std::vector<Node*> _temp_nodes;
-		std::vector<ParentNode*> _temp_parent_nodes;
+
+		RebalancePolicy _rebalance_policy;
+		ParallelPolicy _parallel_policy;
+		std::vector<ParentNode*> _resized_parents;	// segments resized by split-and-merge in the current move
+		bool _unbalanced = false;
+		int _n_moves_since_relayout = 0;
+		int _n_local_rebalances = 0;
+		int _n_relayouts = 0;
+		std::vector<int> _relayout_buffer;
+
+		// cities of each segment from its segment_begin_node to segment_end_node, indexed like 
+		// _parent_nodes. Reversing complete segments keeps them valid. Only filled by the non-const 
+		// update_segment_cache, relayouts and compact, so the const exports stay read-only.
+		std::vector<std::vector<int>> _segment_cities;
+		std::vector<char> _segment_cache_valid;
+
+		// the slot in _nodes of each city, indexed by its offset from the origin city, if the storage is 
+		// permuted by set_storage_order, otherwise empty, in which case the node of a city is stored at 
+		// that offset. Only the n cities of the tour are stored, whatever the origin city is.
+		std::vector<int> _city_slots;
+
+		// for a tree built for arbitrary city ids, the ids in the given order and a hash table of the 
+		// (id, slot) pairs with linear probing, whose size is a power of two at least twice the number of 
+		// cities and whose empty entries have an id of -1. Both are empty for consecutive cities.
+		std::vector<int> _city_ids;
+		std::vector<std::pair<int, int>> _id_slots;
+		int _id_shift = 0;	// the hash of an id is its Fibonacci product shifted right by this
+
+		// the cities whose tour neighbors have changed since the last clear_changed_cities, if tracked.
+		// The flags indexed by the slots of the nodes keep each of them queued only once.
+		bool _track_changes = false;
+		std::vector<int> _changed_cities;
+		std::vector<char> _changed_flags;
+
+		// the edge lengths given to set_distance if any, with the sum of the internal edges of each segment
+		// indexed like _parent_nodes and the length of the tour, all kept up to date by the moves
+		std::function<double(int, int)> _distance;
+		std::vector<double> _segment_costs;
+		double _tour_length = 0;
+		double _transaction_tour_length = 0;	// the length before the current transaction
+
+		// the number of nodes before each segment in the forward tour from the head parent (modulo n),
+		// indexed like _parent_nodes. Rebuilt in O(sqrt(n)) by update_positions, which or_move leaves
+		// to the caller and the bulk operations do themselves, and otherwise kept up to date by 
+		// split-and-merge and relinking the parents.
+		std::vector<int> _parent_offsets;
+		bool _parent_offsets_valid = false;
+
+		// the journal of the current transaction: the original values of the nodes touched so far.
+		// A node is journaled at most once per transaction, which is tracked by the epoch stamps.
+		bool _in_transaction = false;
+		unsigned _transaction_epoch = 0;
+		std::vector<unsigned> _node_epochs;
+		std::vector<unsigned> _parent_node_epochs;
+		std::vector<std::pair<Node*, Node>> _node_journal;
+		std::vector<std::pair<ParentNode*, ParentNode>> _parent_node_journal;
+		// the slot tables before the transaction, if a restore has replaced them
+		bool _slots_journaled = false;
+		std::vector<int> _journaled_city_slots;
+		std::vector<std::pair<int, int>> _journaled_id_slots;
+
+		TreeStats _stats;
+
+		// the log of the moves of this tree if any, which is not shared by the copies
+		MoveLog* _move_log = nullptr;
+
+		// the seqlock versions for the concurrent readers, indexed like _parent_nodes plus a last one for
+		// the complete tree. A version is odd while its segment is being written.
+		bool _concurrent_reads = false;
+		std::unique_ptr<std::atomic<unsigned>[]> _versions;
+		std::vector<const ParentNode*> _written_parents;	// with an odd version in the current move
 	public:
+		/**
+		 * A saved state of a tree, see \ref snapshot and \ref restore. The node arrays are copied as they
+		 * are, together with the addresses of the arrays they were taken from.
+		 */
+		struct Snapshot
+		{
+			std::vector<Node> nodes;
+			std::vector<ParentNode> parent_nodes;
+			std::vector<int> city_slots;
+			std::vector<std::pair<int, int>> id_slots;
+			std::uintptr_t node_base = 0;
+			std::uintptr_t parent_node_base = 0;
+		};
+
 		/**
 		 * An empty two level tree, which is meaningless, but may be used as a return value to 
 		 * indicate that a two level tree cannot be successfully built.
@@ -74,24 +247,193 @@ namespace tsp
 		 */
 		explicit TwoLevelTree(int n_cities, int origin_city = 0);
 
+		/**
+		 * Similar to the above, but the segments are laid out according to the given \p policy.
+		 */
+		TwoLevelTree(int n_cities, int origin_city, const SegmentPolicy& policy);
+
+		/**
+		 * Build a two-level tree for the distinct, non-negative but otherwise arbitrary city ids \p cities, 
+		 * e.g., a cluster or partition of a much larger instance. The memory is proportional to the number 
+		 * of these cities rather than to the largest id, and the ids are mapped to the nodes by a hash 
+		 * table. The \ref origin_city is cities[0].
+		 * @note The helpers that index arrays by the consecutive cities from the origin, e.g., \ref LocalSearch,
+		 * do not apply to such a tree.
+		 */
+		explicit TwoLevelTree(const std::vector<int>& cities, const SegmentPolicy& policy = SegmentPolicy{});
+
+		/**
+		 * Copy the node arrays of \p other directly and rebase their pointers, which needs no traversal.
+		 */
 		TwoLevelTree(const TwoLevelTree& other);
 
 		TwoLevelTree(TwoLevelTree&& other) noexcept = default;
 
+		/**
+		 * Similar to the copy constructor. Nothing is allocated if this tree has the same size as \p other.
+		 */
 		TwoLevelTree& operator= (const TwoLevelTree& other);
 		TwoLevelTree& operator= (TwoLevelTree&& other) noexcept = default;
+
+		/**
+		 * Save the current state of this tree to \p s, reusing its storage. O(n) by plain copying.
+		 */
+		void snapshot(Snapshot& s) const;
+
+		Snapshot snapshot() const;
+
+		/**
+		 * Restore a state saved by \ref snapshot. The snapshot may be taken from another tree built for the
+		 * same cities. The copy is a plain one if the snapshot is taken from this tree, and nothing is allocated
+		 * unless the storage orders of the snapshot and this tree differ. In a transaction, a rollback also
+		 * restores the storage order.
+		 */
+		void restore(const Snapshot& s);
+
+		/**
+		 * Write the complete state of this tree to a binary stream, e.g., as a checkpoint. The format 
+		 * is versioned and pointer-free: the links are stored as 32-bit indices in the host byte order.
+		 * @return whether the stream is still good.
+		 */
+		bool save(std::ostream& os) const;
+
+		/**
+		 * Read a state written by \ref save into this tree, which is an O(n) bulk read and relink
+		 * instead of rebuilding it from a tour. The tree should have the same number of cities and 
+		 * origin city, while the segment layout is taken from the state.
+		 * @return false if the stream does not contain a valid state of this version for this tree, in 
+		 * which case the tree is left unchanged. Besides the ranges of the indices, the structure is 
+		 * checked in O(n): the segments and their parents should form consistent cycles of the given 
+		 * sizes. It should not be called in a transaction.
+		 */
+		bool load(std::istream& is);
+
+		/**
+		 * Start a transaction: all the following changes to the tree are journaled until \ref commit or
+		 * \ref rollback is called. Transactions cannot be nested.
+		 */
+		void begin_transaction();
+
+		/**
+		 * Accept all the changes of the current transaction and discard its journal.
+		 */
+		void commit();
+
+		/**
+		 * Undo all the changes of the current transaction by restoring the journaled nodes and parent
+		 * nodes, which costs time proportional to the number of them instead of replaying the reversals.
+		 */
+		void rollback();
+
+		bool in_transaction() const
+		{
+			return _in_transaction;
+		}
+
+		/**
+		 * Number of nodes and parent nodes recorded in the journal of the current transaction.
+		 */
+		int n_journaled() const
+		{
+			return static_cast<int>(_node_journal.size() + _parent_node_journal.size());
+		}
+
+		/**
+		 * Enable or disable the single-writer, multiple-reader mode, in which other threads may query the
+		 * tour by \ref concurrent_get_next, \ref concurrent_get_prev and \ref concurrent_is_between while
+		 * a single thread applies the moves. Each segment has a version counter: the writer makes it odd 
+		 * before touching the segment (or its nodes) and even again after the move, so only the parents 
+		 * actually changed by split-and-merge or a reversal are bumped. A reader retries only if one of 
+		 * the segments of its cities has changed in the meantime. Rebuilding the complete tree, e.g., 
+		 * by \ref set_raw_tour, a relayout or \ref rollback, bumps a version of the whole tree instead.
+		 * @note It should not be called while there are readers. Neither should the operations that
+		 * reallocate the nodes, i.e., \ref set_storage_order, \ref compact, \ref load and assignments.
+		 * The readers rely on the usual seqlock argument: a plain read that races with the writer may see 
+		 * a torn state, which is always discarded by the version check.
+		 */
+		void enable_concurrent_reads(bool enabled = true);
+
+		bool concurrent_reads_enabled() const
+		{
+			return _concurrent_reads;
+		}
+
+		/**
+		 * The same as \ref get_next, \ref get_prev and \ref is_between, but safe to call from any number 
+		 * of threads while another one changes the tour, see \ref enable_concurrent_reads. Lock-free: 
+		 * the query is retried until it has seen a consistent state of its segments.
+		 */
+		int concurrent_get_next(int city) const;
+
+		int concurrent_get_prev(int city) const;
+
+		bool concurrent_is_between(int a, int b, int c) const;
+
+		/**
+		 * Record the public moves of this tree into \p log from now on, or stop recording if it is null,
+		 * e.g., to keep replicas in sync by \ref apply_log. The moves are \ref reverse (including 
+		 * \ref flip), \ref double_bridge_move (including \ref random_double_bridges), \ref or_move and
+		 * \ref rebalance, as well as the transactions. Since the tree is deterministic, replaying them 
+		 * reproduces the implicit split-and-merges and rebalancing as well.
+		 * @note Changing the complete state, e.g., by \ref set_raw_tour, \ref load, \ref restore or
+		 * an assignment is not recorded, after which the replicas should be copied again. The storage 
+		 * order is not recorded either, since it has no effect on the moves. A copy of this tree does 
+		 * not record into the same log.
+		 */
+		void set_move_log(MoveLog* log)
+		{
+			_move_log = log;
+		}
+
+		MoveLog* move_log() const
+		{
+			return _move_log;
+		}
+
+		/**
+		 * Replay the entries of \p log from the position \p begin onto this tree, which should be for
+		 * the same cities and in the same state as the logged tree at that position. Only the entries
+		 * starting before \p end are replayed, e.g., a single one to time it.
+		 * @return the position after the last replayed entry, i.e., `log.size()` or the first entry at or
+		 * after \p end, unless an entry refers to an invalid city, at which the replay stops.
+		 */
+		std::size_t apply_log(const MoveLog& log, std::size_t begin = 0, std::size_t end = static_cast<std::size_t>(-1));
 		/**
 		 * Set a forward tour in specific order to be represented by this two-level tree.
 		 */
 		void set_raw_tour(const std::vector<int>& order);
 
+		/**
+		 * Store the nodes in the order of \p cities, e.g., the initial tour or \ref hilbert_order, such 
+		 * that neighbors in the tour are likely to be close in memory. The tour is not changed, and the
+		 * cities keep being used as before. O(n) with a temporary copy of the nodes.
+		 * @note The pointers to the nodes are invalidated. It should not be called in a transaction.
+		 */
+		void set_storage_order(const std::vector<int>& cities);
+
+		/**
+		 * Re-lay out the node storage along the current tour, e.g., after many moves since the last time.
+		 */
+		void compact();
+
+		/**
+		 * The cities numbered from \p origin_city sorted along a Hilbert curve through their coordinates
+		 * (\p x, \p y), to be used by \ref set_storage_order.
+		 */
+		static std::vector<int> hilbert_order(const std::vector<double>& x, const std::vector<double>& y, 
+			int origin_city = 0);
+
 		/**
 		 * Get the node bound to the city.
 		 */
 		const Node* get_node(int city) const
 		{
-			assert(city >= _origin_city && city < _origin_city + _n_cities);
-			return &_nodes[city];
+			assert(is_city_valid(city));
+			if (_city_lookup == CityLookup::offset)
+				return &_nodes[city - _origin_city];
+			if (_city_lookup == CityLookup::slots)
+				return &_nodes[_city_slots[city - _origin_city]];
+			return &_nodes[id_slot(city)];
 		}
 
 		Node* get_node(int city)
@@ -142,7 +484,26 @@ namespace tsp
 		 */
 		Node* origin_city_node()
 		{
-			return &_nodes[_origin_city];
+			return get_node(_origin_city);
+		}
+
+		/**
+		 * Pick a segment policy for the tour \p order by building a tree for each of the candidate nominal
+		 * segment \p lengths and measuring the time to apply a sample of 2-opt \p moves, to be given as 
+		 * pairs (a, c) meaning flip(a, next(a), c, next(c)). The fastest one is returned. If no candidates
+		 * are given, then 1/4, 1/2, 1, 2 and 4 times sqrt(n) are tried.
+		 */
+		static SegmentPolicy tune_segment_policy(const std::vector<int>& order, 
+			const std::vector<std::pair<int, int>>& moves, std::vector<int> lengths = {});
+
+		const SegmentPolicy& segment_policy() const
+		{
+			return _segment_policy;
+		}
+
+		int nominal_segment_length() const
+		{
+			return _nominal_segment_length;
 		}
 
 		int n_segments() const
@@ -155,11 +516,30 @@ namespace tsp
 			return _n_cities;
 		}
 
+		/**
+		 * The first city, or cities[0] if the tree is built for arbitrary city ids.
+		 */
 		int origin_city() const
 		{
 			return _origin_city;
 		}
 
+		/**
+		 * Whether the tree is built for arbitrary city ids, see \ref TwoLevelTree(const std::vector<int>&, const SegmentPolicy&).
+		 */
+		bool has_city_ids() const
+		{
+			return !_city_ids.empty();
+		}
+
+		/**
+		 * Whether \p city is one of the cities of this tree.
+		 */
+		bool contains(int city) const
+		{
+			return is_city_valid(city);
+		}
+
 		/**
 		 * Get the next node for \p current in the forward tour.
 		 */
@@ -219,11 +599,67 @@ namespace tsp
 		 */
 		bool is_between(int a, int b, int c) const;
 
+		/**
+		 * Batched get_next(int): next[i] = get_next(cities[i]) for i in [0, n). For a very large tree, the
+		 * nodes are prefetched a few queries ahead, such that the memory latency of the queries overlaps.
+		 */
+		void get_next_batch(const int* cities, int n, int* next) const
+		{
+			if (_n_cities < batch_prefetch_min_cities)
+			{
+				for (int i = 0; i < n; i++)
+					next[i] = get_next(cities[i]);
+			}
+			else
+				get_neighbor_batch(cities, n, next, true);
+		}
+
+		/**
+		 * Batched get_prev(int), see \ref get_next_batch.
+		 */
+		void get_prev_batch(const int* cities, int n, int* prev) const
+		{
+			if (_n_cities < batch_prefetch_min_cities)
+			{
+				for (int i = 0; i < n; i++)
+					prev[i] = get_prev(cities[i]);
+			}
+			else
+				get_neighbor_batch(cities, n, prev, false);
+		}
+
+		/**
+		 * Batched is_between(int, int, int) for \p n triples stored as a0, b0, c0, a1, b1, c1, ..., 
+		 * i.e., result[i] = is_between(triples[3 * i], triples[3 * i + 1], triples[3 * i + 2]).
+		 * The nodes are not prefetched: the three independent node loads of a query already keep enough
+		 * misses in flight, and prefetching them as well was slower at every size.
+		 */
+		void is_between_batch(const int* triples, int n, bool* result) const
+		{
+			for (int i = 0; i < n; i++)
+				result[i] = is_between(triples[3 * i], triples[3 * i + 1], triples[3 * i + 2]);
+		}
+
+		/**
+		 * Whether the \p k cities are visited in this order by a forward traversal starting from cities[0],
+		 * e.g., t1, ..., tk of a k-opt move. This is equivalent to is_between(cities[0], cities[i], cities[i + 1])
+		 * for all i in [1, k - 1) but reads each node and its parent only once. The cities should be distinct.
+		 */
+		bool is_sequence(const int* cities, int k) const;
+
+		/**
+		 * Sort the \p k distinct cities by the order of a forward traversal starting from cities[0], which
+		 * stays first. Each city is located once, in O(k log(k)) in total.
+		 */
+		void sort_by_tour_order(int* cities, int k) const;
+
 		/**
 		 * Reverse the forward path between \p a and \p b.
 		 */
 		void reverse(Node* a, Node* b);
 
+		void reverse(int a, int b);
+
 		/**
 		 * Remove two arcs (a, b) and (c, d), and add two others (a, c) and (b, d).
 		 * The two arcs should both be in forward or backward orientation.
@@ -238,14 +674,38 @@ namespace tsp
 		 * are an, bn, cn and dn respectively. Then, (a, an), (b, bn), (c, cn) and (d, dn) are removed.
 		 * New arcs (a, cn), (b, dn), (c, an), and (d, bn) are inserted.
 		 * @note 
-		 * (1) The arguments a, b, c, d should be given in a forward tour order, and there should 
-		 * be at least one other node between each pairs of them.
-		 * (2) Any two of a, b, c, d should lie in diffrent segments.
+		 * The arguments a, b, c, d should be distinct and given in a forward tour order. If each of the
+		 * four arcs either lies between two segments or is the only one of them in its segment, the
+		 * segments are relinked after at most four split-and-merges. Otherwise, it is done by four
+		 * reversals. Only the IDs of the parents outside the largest of the four parts are renumbered.
 		 */
 		void double_bridge_move(Node* a, Node* b, Node* c, Node* d);
 
 		void double_bridge_move(int a, int b, int c, int d);
 
+		/**
+		 * Apply \p n_kicks random double-bridge moves, e.g., as the perturbation of an iterated local 
+		 * search. If \p window is positive, the four cities of each move lie in a forward path of at 
+		 * most \p window cities starting from a random city (a segment-local kick), otherwise they are 
+		 * chosen anywhere in the tour. If \p endpoints is given, the eight endpoints of the four arcs
+		 * removed by each move are appended to it, e.g., to reset the don't-look bits.
+		 * @note Nothing is done if there are less than 8 cities.
+		 */
+		void random_double_bridges(int n_kicks, std::mt19937& rng, int window = 0, std::vector<int>* endpoints = nullptr);
+
+		/**
+		 * Perform an or-opt move: the forward chain \p s1 --> \p s2 is removed and inserted between \p p 
+		 * and its next node, such that p -> s1 -> ... -> s2 in a forward tour, or p -> s2 -> ... -> s1 if
+		 * \p reversed is true.
+		 * @note The chain is spliced node by node, which costs O(chain length) plus relabeling the shorter
+		 * side of the affected segments. It is thus meant for short chains (typically 1-3 cities).
+		 * If the chain covers a complete segment, it falls back to three reversals.
+		 * \p p should not be in the chain.
+		 */
+		void or_move(Node* s1, Node* s2, Node* p, bool reversed = false);
+
+		void or_move(int s1, int s2, int p, bool reversed = false);
+
 		/**
 		 * Split a segment at \p s,  and merge one half to its neighbor segment specified by the 
 		 *	\p direction. if \p include_self is true, then the node \p s is merged to its neighbor; 
@@ -254,9 +714,60 @@ namespace tsp
 		void split_and_merge(Node* s, bool include_self, Direction direction);
 
 		
+		/**
+		 * Set the explicit rebalancing policy applied after each \ref reverse, \ref flip and
+		 * \ref double_bridge_move. By default only the implicit rebalance is used.
+		 */
+		void set_rebalance_policy(const RebalancePolicy& policy);
+
+		const RebalancePolicy& rebalance_policy() const
+		{
+			return _rebalance_policy;
+		}
+
+		/**
+		 * Set how \ref set_raw_tour and \ref to_raw_tour are parallelized. Each thread builds or exports 
+		 * a contiguous range of segments, which are independent once their boundaries are known. 
+		 * A single thread is used by default.
+		 */
+		void set_parallel_policy(const ParallelPolicy& policy)
+		{
+			_parallel_policy = policy;
+		}
+
+		const ParallelPolicy& parallel_policy() const
+		{
+			return _parallel_policy;
+		}
+
+		/**
+		 * Rebuild all the segments with the nominal length from the current tour. O(n).
+		 * The (forward) tour itself is not changed.
+		 */
+		void rebalance();
+
+		/**
+		 * How many local split/merge fix-ups have been performed by the rebalancing policy.
+		 */
+		int n_local_rebalances() const
+		{
+			return _n_local_rebalances;
+		}
+
+		/**
+		 * How many full relayouts have been performed, either by the policy or by \ref rebalance.
+		 */
+		int n_relayouts() const
+		{
+			return _n_relayouts;
+		}
+
 		/**
 		 * Get the tour encoded by this two-level tree. If a negative number is given for the 
 		 * \p start_city (default -1), then the tour starts at the origin city. 
+		 * @note The segments whose cities are cached, see \ref update_segment_cache, are copied in bulk,
+		 * and only the others are traversed node by node. O(n) in total. The export does not change the
+		 * tree, so it is safe to export the same tree from several threads at once.
 		 */
 		std::vector<int> get_raw_tour(int start_city = -1, Direction direction = Direction::forward) const;
 
@@ -266,6 +777,265 @@ namespace tsp
 		 */
 		void to_raw_tour(std::vector<int>& v, int start_city = -1, Direction direction = Direction::forward) const;
 
+		/**
+		 * Cache the cities of the segments changed since the last call, such that the following exports
+		 * copy every segment in bulk until the next moves. O(the sizes of those segments), e.g., after
+		 * each improving round of a local search that exports its tour. Relayouts and \ref compact
+		 * update the cache as well.
+		 */
+		void update_segment_cache();
+
+		/**
+		 * An iterator over the cities of the tour, see \ref begin. It visits each city exactly once.
+		 */
+		class const_iterator
+		{
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef int value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const int* pointer;
+			typedef int reference;
+
+			const_iterator() = default;
+
+			int operator*() const
+			{
+				return _node->city;
+			}
+
+			/**
+			 * The node of the current city.
+			 */
+			const Node* node() const
+			{
+				return _node;
+			}
+
+			const_iterator& operator++()
+			{
+				_node = _forward ? _tree->get_next(_node) : _tree->get_prev(_node);
+				_n_remaining--;
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				auto it = *this;
+				++*this;
+				return it;
+			}
+
+			// only the number of remaining cities is compared, such that any iterator that has visited all
+			// the cities equals end()
+			bool operator==(const const_iterator& other) const
+			{
+				return _n_remaining == other._n_remaining;
+			}
+
+			bool operator!=(const const_iterator& other) const
+			{
+				return !(*this == other);
+			}
+		private:
+			friend class TwoLevelTree;
+
+			const_iterator(const TwoLevelTree* tree, const Node* node, bool forward, int n_remaining)
+				: _tree{ tree }, _node{ node }, _forward{ forward }, _n_remaining{ n_remaining }
+			{
+			}
+
+			const TwoLevelTree* _tree = nullptr;
+			const Node* _node = nullptr;
+			bool _forward = true;
+			int _n_remaining = 0;
+		};
+
+		/**
+		 * A segment of the tour as visited in a forward traversal: from segment_end_node to 
+		 * segment_begin_node by node.prev if reverse is true, otherwise from segment_begin_node to 
+		 * segment_end_node by node.next.
+		 */
+		struct SegmentRun
+		{
+			const Node* segment_begin_node;
+			const Node* segment_end_node;
+			bool reverse;
+			int size;
+		};
+
+		/**
+		 * An iterator over the segments of the tour in the forward order, see \ref segment_runs.
+		 */
+		class segment_run_iterator
+		{
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef SegmentRun value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const SegmentRun* pointer;
+			typedef SegmentRun reference;
+
+			segment_run_iterator() = default;
+
+			SegmentRun operator*() const
+			{
+				return SegmentRun{ _parent->segment_begin_node, _parent->segment_end_node, _parent->reverse, 
+					_parent->size };
+			}
+
+			segment_run_iterator& operator++()
+			{
+				_parent = _parent->next;
+				_n_remaining--;
+				return *this;
+			}
+
+			segment_run_iterator operator++(int)
+			{
+				auto it = *this;
+				++*this;
+				return it;
+			}
+
+			bool operator==(const segment_run_iterator& other) const
+			{
+				return _n_remaining == other._n_remaining;
+			}
+
+			bool operator!=(const segment_run_iterator& other) const
+			{
+				return !(*this == other);
+			}
+		private:
+			friend class TwoLevelTree;
+
+			segment_run_iterator(const ParentNode* parent, int n_remaining)
+				: _parent{ parent }, _n_remaining{ n_remaining }
+			{
+			}
+
+			const ParentNode* _parent = nullptr;
+			int _n_remaining = 0;
+		};
+
+		/**
+		 * A pair of iterators usable in a range-based for loop.
+		 */
+		template<typename Iterator>
+		struct Range
+		{
+			Iterator first;
+			Iterator last;
+
+			Iterator begin() const
+			{
+				return first;
+			}
+
+			Iterator end() const
+			{
+				return last;
+			}
+		};
+
+		/**
+		 * Iterate over the tour from \p start_city (the origin city if negative) in the given direction
+		 * without copying it. The tree should not be changed during the traversal.
+		 */
+		const_iterator begin(int start_city = -1, Direction direction = Direction::forward) const
+		{
+			return const_iterator{ this, get_node(start_city < 0 ? _origin_city : start_city), 
+				direction == Direction::forward, _n_cities };
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator{ this, nullptr, true, 0 };
+		}
+
+		/**
+		 * The cities from \p start_city in the given direction as a range, e.g.,
+		 * `for (int city : tree.cities(start_city, Direction::backward))`.
+		 */
+		Range<const_iterator> cities(int start_city = -1, Direction direction = Direction::forward) const
+		{
+			return Range<const_iterator>{ begin(start_city, direction), end() };
+		}
+
+		/**
+		 * The segments in the forward order starting from the one containing \p start_city (the origin
+		 * city if negative). Each segment is visited as a whole, such that the cities before 
+		 * \p start_city in its segment come first. Nothing is copied.
+		 */
+		Range<segment_run_iterator> segment_runs(int start_city = -1) const
+		{
+			auto parent = get_parent_node(start_city < 0 ? _origin_city : start_city);
+			return Range<segment_run_iterator>{ segment_run_iterator{ parent, n_segments() }, segment_run_iterator{} };
+		}
+
+		/**
+		 * The index of \p city in the forward tour starting from the origin city, i.e., the origin has 
+		 * position 0. O(1) with the segment offsets, which are kept up to date by all the operations but
+		 * \ref or_move, after which \ref update_positions should be called before the next query. 
+		 * Being read-only, the queries are safe to call from several threads at once.
+		 */
+		int position(int city) const;
+
+		int position(const Node* a) const;
+
+		/**
+		 * The number of nodes in the forward path from \p a to \p b, including both. O(1) like \ref position.
+		 */
+		int path_length(int a, int b) const;
+
+		int path_length(const Node* a, const Node* b) const;
+
+		/**
+		 * Rebuild the segment offsets of \ref position in O(sqrt(n)) if an \ref or_move has invalidated 
+		 * them, otherwise O(1). The offsets are not rebuilt by the or_move itself, since a search may apply
+		 * many of them between two position queries.
+		 */
+		void update_positions();
+
+		bool positions_valid() const
+		{
+			return _parent_offsets_valid;
+		}
+
+		/**
+		 * Maintain the length of the tour for the symmetric edge lengths \p distance, or stop it if 
+		 * \p distance is empty. O(n) evaluations of \p distance. Each segment also keeps the sum of its
+		 * internal edges, which a reversal of the complete segment leaves unchanged. Afterwards, a move 
+		 * only evaluates the edges it changes, plus those of the nodes moved by split-and-merge. 
+		 * Integral lengths are exact up to a total of 2^53, while the rounding errors of fractional ones 
+		 * accumulate until a new tour or another call. A parallel \ref set_raw_tour evaluates \p distance
+		 * from several threads at once.
+		 */
+		void set_distance(std::function<double(int, int)> distance);
+
+		bool has_distance() const
+		{
+			return static_cast<bool>(_distance);
+		}
+
+		/**
+		 * The length of the tour for the lengths given to \ref set_distance, or 0 without them. O(1).
+		 */
+		double tour_length() const
+		{
+			return _tour_length;
+		}
+
+		/**
+		 * The sum of the edge lengths along the forward path from \p a to \p b, which is 0 if a == b. 
+		 * O(sqrt(n)), since the complete segments in between are summed by their costs, see 
+		 * \ref set_distance.
+		 */
+		double path_cost(int a, int b) const;
+
+		double path_cost(const Node* a, const Node* b) const;
+
 		/**
 		 * Get the lengths of each segment. Note that the result may change after tree operations.
 		 * If a valid \p start_city is given, then the first segment in the returned result is the segment
@@ -273,6 +1043,64 @@ namespace tsp
 		 */
 		std::vector<int> actual_segment_sizes(int start_city = -1) const;
 
+		/**
+		 * Enable or disable recording the cities whose tour neighbors change, e.g., to reset the don't-look
+		 * bits of a local search. Each of \ref reverse, \ref flip, \ref double_bridge_move and \ref or_move 
+		 * records only the endpoints of the arcs it removes or adds, since the internal split-and-merge
+		 * and rebalancing never change any neighbors. A new tour, \ref load, \ref restore and \ref rollback 
+		 * record the cities they may change. The queue is cleared in either case.
+		 */
+		void track_changes(bool enabled = true);
+
+		bool change_tracking_enabled() const
+		{
+			return _track_changes;
+		}
+
+		/**
+		 * The cities whose tour neighbors may have changed since the last \ref clear_changed_cities, each 
+		 * of them once and in the order of the first change.
+		 */
+		const std::vector<int>& changed_cities() const
+		{
+			return _changed_cities;
+		}
+
+		/**
+		 * Empty the queue of the changed cities. O(number of queued cities).
+		 */
+		void clear_changed_cities();
+
+		/**
+		 * Whether the operation counters are collected, i.e., TSP_TWO_LEVEL_TREE_STATS is defined.
+		 */
+		static bool stats_enabled();
+
+		/**
+		 * The operation counters since the construction or the last \ref reset_stats.
+		 */
+		const TreeStats& stats() const
+		{
+			return _stats;
+		}
+
+		void reset_stats()
+		{
+			_stats = TreeStats{};
+		}
+
+		/**
+		 * A histogram of the current segment sizes, where bin i counts the segments whose size lies in 
+		 * [i * bin_width, (i + 1) * bin_width). By default, the bin width is a quarter of the nominal
+		 * segment length.
+		 */
+		std::vector<int> segment_size_histogram(int bin_width = 0) const;
+
+		/**
+		 * Write the operation counters and the segment size histogram as a single-line JSON object.
+		 */
+		void write_stats(std::ostream& os) const;
+
 		/**
 		 * Whether the length of the first forward path a --> b is approximately shorter than the one of 
 		 * the second forward path c --> d.
@@ -297,16 +1125,203 @@ namespace tsp
 		 */
 		bool has_edge(const Node* a, const Node* b) const;
 
+		/**
+		 * Compare the edges of this tour with those of \p other built for the same cities, e.g., for a 
+		 * crossover or tour merging. The edges of this tour that are not in \p other are written to 
+		 * \p differing, and the common ones to \p common if it is given, each as (city1, city2) with 
+		 * city1 < city2 in no particular order.
+		 * Since the two links of a node are always its two tour neighbors, whatever the orientation of its
+		 * segment, the node arrays are scanned sequentially without any parent lookup. O(n).
+		 */
+		void diff_edges(const TwoLevelTree& other, std::vector<std::pair<int, int>>& differing,
+			std::vector<std::pair<int, int>>* common = nullptr) const;
+
+		/**
+		 * The number of edges shared by this tour and \p other, see \ref diff_edges. n - the result is
+		 * the number of edges in which they differ.
+		 */
+		int count_common_edges(const TwoLevelTree& other) const;
+
 		/**
 		 * Given an edge's two endpoints (cities), return them in forward order.
 		 */
 		std::pair<int, int> turn_forward(int city1, int city2) const;
 	private:
+		// the implementation of diff_edges and count_common_edges, which returns the number of common edges
+		int compare_edges(const TwoLevelTree& other, std::vector<std::pair<int, int>>* differing,
+			std::vector<std::pair<int, int>>* common) const;
+
+		// the number of threads for a bulk operation according to the parallel policy
+		int bulk_threads() const;
+
+		// build the segments [first, last) of set_raw_tour
+		void build_segments(const std::vector<int>& order, int first, int last);
+
+		// the implementation of rebalance, which is not logged when applied by the rebalancing policy
+		void relayout();
+
+		// the actual implementation of reverse(Node*, Node*) without the rebalancing policy
+		void reverse_path(Node* a, Node* b);
+
+		// record the original value of a node before it is changed in a transaction
+		void touch(Node* node)
+		{
+			if (_concurrent_reads)
+				begin_write(node->parent);
+			if (_in_transaction && _node_epochs[node - _nodes.data()] != _transaction_epoch)
+			{
+				_node_epochs[node - _nodes.data()] = _transaction_epoch;
+				_node_journal.emplace_back(node, *node);
+			}
+		}
+
+		void touch(ParentNode* p)
+		{
+			if (_concurrent_reads)
+				begin_write(p);
+			if (_in_transaction && _parent_node_epochs[p - _parent_nodes.data()] != _transaction_epoch)
+			{
+				_parent_node_epochs[p - _parent_nodes.data()] = _transaction_epoch;
+				_parent_node_journal.emplace_back(p, *p);
+			}
+		}
+
+		// make the version of a segment odd before it is changed in the concurrent mode
+		void begin_write(const ParentNode* p)
+		{
+			auto& version = _versions[p - _parent_nodes.data()];
+			unsigned v = version.load(std::memory_order_relaxed);
+			if (v & 1)
+				return;
+			version.store(v + 1, std::memory_order_relaxed);
+			// the following changes of the segment cannot be seen before the odd version
+			std::atomic_thread_fence(std::memory_order_release);
+			_written_parents.push_back(p);
+		}
+
+		// the same for the complete tree
+		void begin_write_all();
+
+		// make all the odd versions even again at the end of a move
+		void publish_writes();
+
+		// publishes the writes of a public operation on every return
+		struct WriteScope
+		{
+			TwoLevelTree* tree;
+			~WriteScope()
+			{
+				if (tree->_concurrent_reads)
+					tree->publish_writes();
+			}
+		};
+
+		// the versions seen by a concurrent query before reading the nodes
+		struct ReadState
+		{
+			unsigned tree_version = 0;
+			int n_parents = 0;
+			const ParentNode* parents[3];
+			unsigned versions[3];
+		};
+
+		// start a concurrent query of the k nodes, false if one of their segments is being written
+		bool begin_read(const Node* const* nodes, int k, ReadState& state) const;
+
+		// whether the nodes read since begin_read are consistent
+		bool end_read(const ReadState& state) const;
+
+		// allocate the zero versions for the current segments in the concurrent mode
+		void reset_versions();
+
+		// queue the city of a node whose tour neighbors change, if the changes are tracked
+		void record_change(const Node* node)
+		{
+			if (_track_changes && !_changed_flags[node - _nodes.data()])
+			{
+				_changed_flags[node - _nodes.data()] = 1;
+				_changed_cities.push_back(node->city);
+			}
+		}
+
+		// queue all the cities, e.g., after a new tour
+		void record_all_changes();
+
+		double distance(const Node* a, const Node* b) const
+		{
+			return _distance(a->city, b->city);
+		}
+
+		// add the length of the edge (a, b) times sign to the cost of their segment, if it is internal
+		void add_edge_cost(const Node* a, const Node* b, double sign = 1)
+		{
+			if (a->parent == b->parent)
+				_segment_costs[a->parent - _parent_nodes.data()] += sign * distance(a, b);
+		}
+
+		// the sum of the internal edges of segment p. O(size of p).
+		double compute_segment_cost(const ParentNode* p) const;
+
+		// the tour length from the segment costs and the edges between the segments. O(sqrt(n)).
+		void sum_tour_length();
+
+		// recompute all the segment costs and the tour length for a new tour, if the distance is set
+		void reset_costs();
+
+		// record all the nodes, if the complete tree is about to be rebuilt in a transaction
+		void touch_all();
+
+		// translate all the pointers copied from node arrays located at the given addresses into this tree
+		void rebase(std::uintptr_t node_base, std::uintptr_t parent_node_base);
+
+		// output count cities of segment p from the node first in the .next order (or reversed if not
+		// along), copied from the cache if it is valid, otherwise read from the nodes
+		std::vector<int>::iterator copy_segment(const ParentNode* p, const Node* first, int count, bool along,
+			std::vector<int>::iterator out) const;
+
+		void invalidate_segment_cache(const ParentNode* p)
+		{
+			_segment_cache_valid[p - _parent_nodes.data()] = false;
+		}
+
+		// check the segments resized by the last move against the rebalancing policy
+		void apply_rebalance_policy();
+
+		// move nodes of an oversized segment into its two neighbors
+		void shrink_segment(ParentNode* p);
+
+		// pull nodes from the larger neighbor into an undersized segment
+		void grow_segment(ParentNode* p);
+
 		// whether the forward path from a to b is contained in a single segment. O(1).
 		bool is_path_in_single_segment(const Node* a, const Node* b) const;
 
-		// count the number of nodes in the forward path from a to b (including both)
-		int forward_distance(const Node* a, const Node* b) const;
+		// how many queries ahead the batched queries prefetch their nodes
+		static const int batch_prefetch_distance = 8;
+
+		// below this number of cities, get_next_batch and get_prev_batch are a plain loop of the queries;
+		// the prefetching is only as fast as that loop or up to 10% faster from about 1e7 cities
+		static const int batch_prefetch_min_cities = 10000000;
+
+		// the prefetching implementation of get_next_batch and get_prev_batch for a very large tree
+		void get_neighbor_batch(const int* cities, int n, int* neighbors, bool forward) const;
+
+		// up to this number of cities, sort_by_tour_order sorts the keys on the stack
+		static const int small_sequence_length = 16;
+
+		// the index of a node in the forward tour starting from the head parent, up to a multiple of n
+		int tour_index(const Node* a) const;
+
+		// a key increasing along the forward tour from start (whose key is the smallest) for the nodes
+		// compared by is_sequence and sort_by_tour_order: the cyclic distance of the parents and then the
+		// forward rank in the segment. The nodes of the segment of start before start are moved to the end.
+		std::uint64_t tour_order_key(const Node* start, const Node* a) const;
+
+		// after q is linked as the next of p, derive the offset of q from that of p
+		void update_parent_offset(const ParentNode* p, const ParentNode* q);
+
+		// the segment p has moved by delta nodes along the forward tour
+		void shift_parent_offset(const ParentNode* p, int delta);
 
 		// reverse a single segment, either completely or partially
 		void reverse_segment(Node* a, Node*b);
@@ -323,9 +1338,31 @@ namespace tsp
 		// relabel the IDs from a to b by calling .next
 		// ID of a should be relabelled to \p a_id
 		void relabel_id(Node* a, Node* b, int a_id);
+
+		// split_and_merge within a move, whose writes are published by the caller
+		void merge_into_neighbor(Node* s, bool include_self, Direction direction);
 		
 		bool is_city_valid(int city) const;
 
+		// the i-th city in [0, n): origin_city() + i, or the i-th of the arbitrary city ids
+		int city_at(int i) const
+		{
+			return _city_ids.empty() ? _origin_city + i : _city_ids[i];
+		}
+
+		// the entry of the id city in _id_slots, or the empty entry where it would be inserted
+		std::size_t find_id_entry(int city) const;
+
+		// the slot of the node of the id city, kept out of line to keep get_node small
+		int id_slot(int city) const;
+
+		// derive _city_lookup after _city_slots or _id_slots are changed
+		void update_city_lookup()
+		{
+			_city_lookup = !_id_slots.empty() ? CityLookup::ids 
+				: (!_city_slots.empty() ? CityLookup::slots : CityLookup::offset);
+		}
+
 		// delete a forward arc (a -> b).
 		void delete_arc(Node* a, Node* b);
 	};
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include "two_level_tree.h"
+
+namespace tsp
+{
+	/**
+	 * A free list of two-level trees for the same cities, e.g., a population of tours in a memetic
+	 * algorithm, where offspring are created and destroyed constantly.
+	 *
+	 * A released tree keeps its node arrays, and acquiring it again moves them out of the pool, so an 
+	 * offspring built by \ref acquire from a tour or a parent tree is only a relink or a plain copy into
+	 * the recycled storage without any heap allocation. The scratch buffers of each tree (O(sqrt(n)) 
+	 * pointers) are recycled in the same way.
+	 *
+	 * A recycled tree keeps the settings of its last user, i.e., its segment, rebalance and parallel 
+	 * policies, storage order, change tracking and concurrent reads mode. Its hooks, which may refer to
+	 * objects of the last user, are reset by \ref release: it has no move log and no distance (hence no
+	 * tour length). The pool itself is not thread-safe.
+	 */
+	class TwoLevelTreePool
+	{
+		int _n_cities = 0;
+		int _origin_city = 0;
+		SegmentPolicy _segment_policy;
+		std::vector<TwoLevelTree> _free_trees;
+
+	public:
+		/**
+		 * A pool of the trees built by `TwoLevelTree(n_cities, origin_city, policy)`.
+		 */
+		explicit TwoLevelTreePool(int n_cities, int origin_city = 0, const SegmentPolicy& policy = SegmentPolicy{});
+
+		/**
+		 * Build \p n_trees idle trees in advance, so that neither \ref acquire nor \ref release 
+		 * allocates as long as at most this number of trees is idle.
+		 */
+		void reserve(int n_trees);
+
+		/**
+		 * A recycled tree if any is idle, otherwise a new one. The tour of a recycled tree is the one it
+		 * had when released, and that of a new tree should be set later.
+		 */
+		TwoLevelTree acquire();
+
+		/**
+		 * A tree with the tour \p order, see \ref TwoLevelTree::set_raw_tour.
+		 */
+		TwoLevelTree acquire(const std::vector<int>& order);
+
+		/**
+		 * A copy of \p parent, which should be built for the same cities, see \ref TwoLevelTree::operator=.
+		 */
+		TwoLevelTree acquire(const TwoLevelTree& parent);
+
+		/**
+		 * Return a tree to the pool for later use, after removing its move log and distance. The tree 
+		 * should be built for the same cities and not be in a transaction.
+		 */
+		void release(TwoLevelTree&& tree);
+
+		/**
+		 * The number of idle trees.
+		 */
+		int size() const
+		{
+			return static_cast<int>(_free_trees.size());
+		}
+
+		/**
+		 * Free all the idle trees.
+		 */
+		void clear()
+		{
+			std::vector<TwoLevelTree>().swap(_free_trees);
+		}
+
+		int n_cities() const
+		{
+			return _n_cities;
+		}
+
+		int origin_city() const
+		{
+			return _origin_city;
+		}
+	};
+}
@@ -0,0 +1,112 @@
+#include <cassert>
+#include <algorithm>
+#include "array_tour.h"
+
+namespace tsp
+{
+	ArrayTour::ArrayTour(int n_cities, int origin_city)
+		: _n_cities{ n_cities }, _origin_city{ origin_city }, _tour(n_cities), _position(n_cities)
+	{
+		assert(n_cities > 0);
+		assert(origin_city >= 0);
+	}
+
+	void ArrayTour::set_raw_tour(const std::vector<int>& order)
+	{
+		assert(static_cast<int>(order.size()) == _n_cities);
+		for (int i = 0; i < _n_cities; i++)
+		{
+			_tour[i] = slot(order[i]);
+			_position[_tour[i]] = i;
+		}
+	}
+
+	void ArrayTour::reverse(int a, int b)
+	{
+		int i = _position[slot(a)], j = _position[slot(b)];
+		int length = path_length(i, j);
+		if (length == _n_cities)  // the complete tour
+			return;
+		// swap from both ends towards the middle, wrapping around if necessary
+		for (int k = 0; k < length / 2; k++)
+		{
+			std::swap(_tour[i], _tour[j]);
+			_position[_tour[i]] = i;
+			_position[_tour[j]] = j;
+			if (++i == _n_cities)
+				i = 0;
+			if (--j < 0)
+				j = _n_cities - 1;
+		}
+	}
+
+	void ArrayTour::flip(int a, int b, int c, int d)
+	{
+		bool is_forward = get_next(a) == b;
+		assert((get_next(c) == d) == is_forward);
+		assert(!((a == c) && (b == d)));
+		if (b == c || d == a)  // in this case, even after flip, still the same
+			return;
+		if (!is_forward)  // a flip is symmetric: (b, a) and (d, c) in the forward order
+		{
+			std::swap(a, b);
+			std::swap(c, d);
+		}
+		// either reverse b --> c or d --> a, which sum up to n cities
+		if (path_length(_position[slot(b)], _position[slot(c)]) * 2 <= _n_cities)
+			reverse(b, c);
+		else
+			reverse(d, a);
+	}
+
+	void ArrayTour::double_bridge_move(int a, int b, int c, int d)
+	{
+		assert(is_between(a, b, c) && is_between(b, c, d) && is_between(c, d, a));
+		assert(a != b && b != c && c != d && d != a);
+		// [an..b] [bn..c] [cn..d] [dn..a] --> [an..b] [dn..a] [cn..d] [bn..c]
+		int an = _position[slot(a)] + 1, bn = _position[slot(b)] + 1;
+		int cn = _position[slot(c)] + 1, dn = _position[slot(d)] + 1;
+		_temp.clear();
+		auto append = [this](int from, int to) {
+			for (int i = from; ; i++)
+			{
+				if (i == _n_cities)
+					i = 0;
+				_temp.push_back(_tour[i]);
+				if (i == to)
+					break;
+			}
+		};
+		append(an % _n_cities, bn - 1);
+		append(dn % _n_cities, an - 1);
+		append(cn % _n_cities, dn - 1);
+		append(bn % _n_cities, cn - 1);
+		assert(static_cast<int>(_temp.size()) == _n_cities);
+		_tour.swap(_temp);
+		for (int i = 0; i < _n_cities; i++)
+			_position[_tour[i]] = i;
+	}
+
+	std::vector<int> ArrayTour::get_raw_tour(int start_city, Direction direction) const
+	{
+		std::vector<int> raw_tour;
+		to_raw_tour(raw_tour, start_city, direction);
+		return raw_tour;
+	}
+
+	void ArrayTour::to_raw_tour(std::vector<int>& raw_tour, int start_city, Direction direction) const
+	{
+		if (start_city < 0)
+			start_city = _origin_city;
+		int i = _position[slot(start_city)];
+		raw_tour.resize(_n_cities);
+		for (int k = 0; k < _n_cities; k++)
+		{
+			raw_tour[k] = _tour[i] + _origin_city;
+			if (direction == Direction::forward)
+				i = i + 1 == _n_cities ? 0 : i + 1;
+			else
+				i = i == 0 ? _n_cities - 1 : i - 1;
+		}
+	}
+}
@@ -0,0 +1,460 @@
+#include <cmath>
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include "k_level_tree.h"
+
+namespace tsp
+{
+	KLevelTree::KLevelTree(int n_cities, int n_levels, int origin_city)
+		: _n_cities{ n_cities }, _origin_city{ origin_city }, _levels(n_levels)
+	{
+		assert(n_levels >= 2 && n_levels <= max_levels);
+		assert(n_cities > 2);
+		assert(origin_city >= 0);
+		int branching = std::max(2, static_cast<int>(std::ceil(std::pow(n_cities, 1.0 / n_levels))));
+		int count = n_cities;
+		for (int l = 0; l < n_levels; l++)
+		{
+			auto& level = _levels[l];
+			if (l > 0)
+			{
+				// each level must contain at least two groups
+				int n_groups = std::max(2, count / branching);
+				level.nominal_size = count / n_groups;
+				count = n_groups;
+				level.reverse.resize(count);
+				level.size.resize(count);
+				level.begin.resize(count);
+				level.end.resize(count);
+			}
+			level.id.resize(count);
+			level.prev.resize(count);
+			level.next.resize(count);
+			if (l < n_levels - 1)
+				level.parent.resize(count);
+		}
+	}
+
+	void KLevelTree::set_raw_tour(const std::vector<int>& order)
+	{
+		assert(static_cast<int>(order.size()) == _n_cities);
+		// the elements of the level below in the forward order
+		_temp.resize(_n_cities);
+		for (int i = 0; i < _n_cities; i++)
+			_temp[i] = slot(order[i]);
+		for (int l = 0; l < n_levels(); l++)
+		{
+			auto& level = _levels[l];
+			int count = n_elements(l);
+			assert(static_cast<int>(_temp.size()) == count);
+			for (int i = 0; i < count; i++)
+			{
+				int e = _temp[i];
+				level.prev[e] = _temp[i == 0 ? count - 1 : i - 1];
+				level.next[e] = _temp[i + 1 == count ? 0 : i + 1];
+			}
+			if (l == top())  // cyclic IDs
+			{
+				for (int i = 0; i < count; i++)
+					level.id[_temp[i]] = i;
+				break;
+			}
+			// group the elements of this level consecutively
+			auto& up = _levels[l + 1];
+			int n_groups = n_elements(l + 1);
+			for (int g = 0; g < n_groups; g++)
+			{
+				int i_begin = g * up.nominal_size;
+				int i_end = g + 1 == n_groups ? count : i_begin + up.nominal_size;	// the last takes the rest
+				up.reverse[g] = false;
+				up.size[g] = i_end - i_begin;
+				up.begin[g] = _temp[i_begin];
+				up.end[g] = _temp[i_end - 1];
+				for (int i = i_begin; i < i_end; i++)
+				{
+					level.parent[_temp[i]] = g;
+					level.id[_temp[i]] = i - i_begin;
+				}
+			}
+			// the groups are created in the forward order
+			_temp.resize(n_groups);
+			for (int g = 0; g < n_groups; g++)
+				_temp[g] = g;
+		}
+	}
+
+	void KLevelTree::connect(int level, int u, int v)
+	{
+		auto& lv = _levels[level];
+		if (orientation(level, u))
+			lv.prev[u] = v;
+		else
+			lv.next[u] = v;
+		if (orientation(level, v))
+			lv.next[v] = u;
+		else
+			lv.prev[v] = u;
+	}
+
+	bool KLevelTree::is_in_single_group(int level, int x, int y) const
+	{
+		auto& lv = _levels[level];
+		int p = lv.parent[x];
+		if (p != lv.parent[y])
+			return false;
+		if (child_orientation(level + 1, p))
+			return lv.id[x] >= lv.id[y];
+		return lv.id[x] <= lv.id[y];
+	}
+
+	void KLevelTree::reverse(int a, int b)
+	{
+		int x = slot(a), y = slot(b);
+		if (x == y || next_of(0, y) == x)
+			return;
+		reverse_range(0, x, y);
+	}
+
+	void KLevelTree::reverse_range(int level, int x, int y)
+	{
+		if (level == top())
+		{
+			reverse_in_place(level, x, y);
+			return;
+		}
+		auto& lv = _levels[level];
+		auto& up = _levels[level + 1];
+		if (!is_in_single_group(level, x, y))
+		{
+			// split and merge the smaller half heuristically to make x the first of its group
+			int p = lv.parent[x];
+			if (x != forward_first(level + 1, p))
+			{
+				int half_length = std::abs(lv.id[forward_last(level + 1, p)] - lv.id[x]) + 1;
+				if (half_length <= up.size[p] / 2)
+					split_and_merge(level, x, true, Direction::forward);
+				else
+					split_and_merge(level, x, false, Direction::backward);
+			}
+			if (!is_in_single_group(level, x, y))
+			{
+				// and y the last of its group
+				int q = lv.parent[y];
+				if (y != forward_last(level + 1, q))
+				{
+					// the special case: [......y..] -> [x......] (i.e., reverse almost a full circle)
+					if (next_of(level + 1, q) == lv.parent[x])
+					{
+						split_and_merge(level, y, true, Direction::backward);
+					}
+					else
+					{
+						int half_length = std::abs(lv.id[forward_first(level + 1, q)] - lv.id[y]) + 1;
+						if (half_length <= up.size[q] / 2)
+							split_and_merge(level, y, true, Direction::backward);
+						else
+							split_and_merge(level, y, false, Direction::forward);
+					}
+				}
+				if (!is_in_single_group(level, x, y))
+				{
+					// now the path consists of complete groups, which are reversed in the upper level
+					assert(x == forward_first(level + 1, lv.parent[x]));
+					assert(y == forward_last(level + 1, lv.parent[y]));
+					assert(lv.parent[x] != lv.parent[y]);
+					reverse_range(level + 1, lv.parent[x], lv.parent[y]);
+					return;
+				}
+			}
+		}
+		// the path lies in a single group
+		int p = lv.parent[x];
+		if (x == forward_first(level + 1, p) && y == forward_last(level + 1, p))
+		{
+			reverse_range(level + 1, p, p);
+			return;
+		}
+		int path_length = std::abs(lv.id[x] - lv.id[y]) + 1;  // IDs are consecutive
+		if (path_length <= up.nominal_size * 3 / 4)
+		{
+			reverse_in_place(level, x, y);
+			return;
+		}
+		// split at x and y and merge with their neighbors to make a complete group
+		split_and_merge(level, x, false, Direction::backward);
+		split_and_merge(level, y, false, Direction::forward);
+		reverse_range(level + 1, p, p);
+	}
+
+	void KLevelTree::reverse_in_place(int level, int x, int y)
+	{
+		auto& lv = _levels[level];
+		_temp.clear();
+		for (int e = x; ; e = next_of(level, e))
+		{
+			_temp.push_back(e);
+			if (e == y)
+				break;
+		}
+		int pre = prev_of(level, x), post = next_of(level, y);
+		if (pre == y)  // the whole level: reversing the complete tour changes nothing
+			return;
+		// in each lower level, only the two arcs at both ends of the path are changed
+		int firsts[max_levels], lasts[max_levels], pres[max_levels], posts[max_levels];
+		int f = x, l = y;
+		for (int j = level - 1; j >= 0; j--)
+		{
+			f = forward_first(j + 1, f);
+			l = forward_last(j + 1, l);
+			firsts[j] = f;
+			lasts[j] = l;
+			pres[j] = prev_of(j, f);
+			posts[j] = next_of(j, l);
+		}
+		// the reversed path takes the same IDs: y gets the old ID of x
+		bool is_top = level == top();
+		int n_top = n_elements(level);
+		int step = !is_top && child_orientation(level + 1, lv.parent[x]) ? -1 : 1;
+		int id = lv.id[x];
+		// toggling the reverse bits reverses everything below them
+		if (level > 0)
+		{
+			for (auto e : _temp)
+				lv.reverse[e] = !lv.reverse[e];
+		}
+		// reconnect pre -> y ... -> x -> post along the forward direction
+		int q = pre;
+		for (auto it = _temp.rbegin(); it != _temp.rend(); ++it)
+		{
+			connect(level, q, *it);
+			lv.id[*it] = id;
+			id = is_top ? (id + 1) % n_top : id + step;
+			q = *it;
+		}
+		connect(level, q, post);
+		// if one of them is originally an endpoint of the group (at most one can be)
+		if (!is_top)
+		{
+			auto& up = _levels[level + 1];
+			int p = lv.parent[x];
+			if (x == up.begin[p])
+				up.begin[p] = y;
+			else if (x == up.end[p])
+				up.end[p] = y;
+			else if (y == up.begin[p])
+				up.begin[p] = x;
+			else if (y == up.end[p])
+				up.end[p] = x;
+		}
+		for (int j = level - 1; j >= 0; j--)
+		{
+			connect(j, pres[j], lasts[j]);
+			connect(j, firsts[j], posts[j]);
+		}
+	}
+
+	void KLevelTree::split_and_merge(int level, int s, bool include_self, Direction direction)
+	{
+		auto& lv = _levels[level];
+		auto& up = _levels[level + 1];
+		int p = lv.parent[s];
+		bool forward = direction == Direction::forward;
+		int neighbor = forward ? next_of(level + 1, p) : prev_of(level + 1, p);
+		// get the elements that need to be merged to the neighbor
+		_temp.clear();
+		if (include_self)
+			_temp.push_back(s);
+		int boundary;  // the new boundary of the group after being split
+		if (forward)
+		{
+			for (int q = next_of(level, s); lv.parent[q] == p; q = next_of(level, q))
+				_temp.push_back(q);
+			boundary = include_self ? prev_of(level, s) : s;
+		}
+		else
+		{
+			for (int q = prev_of(level, s); lv.parent[q] == p; q = prev_of(level, q))
+				_temp.push_back(q);
+			boundary = include_self ? next_of(level, s) : s;
+		}
+		if (_temp.empty())  // no split and merge is needed
+			return;
+
+		bool p_reverse = child_orientation(level + 1, p);
+		bool neighbor_reverse = child_orientation(level + 1, neighbor);
+		// a moved group keeps the orientation of its descendants by toggling its reverse bit
+		bool toggle = level > 0 && p_reverse != neighbor_reverse;
+		int n_moved = static_cast<int>(_temp.size());
+		up.size[neighbor] += n_moved;
+		up.size[p] -= n_moved;
+		assert(up.size[p] > 0);  // we cannot leave an empty group
+		if (forward)
+		{
+			int q = neighbor_reverse ? up.end[neighbor] : up.begin[neighbor];
+			int delta_id = neighbor_reverse ? 1 : -1;
+			while (!_temp.empty())
+			{
+				int e = _temp.back();
+				_temp.pop_back();
+				lv.parent[e] = neighbor;
+				if (toggle)
+					lv.reverse[e] = !lv.reverse[e];
+				connect(level, e, q);
+				lv.id[e] = lv.id[q] + delta_id;
+				q = e;
+			}
+			if (neighbor_reverse)
+				up.end[neighbor] = q;
+			else
+				up.begin[neighbor] = q;
+			// repair the boundary of the old group
+			connect(level, boundary, q);
+			if (p_reverse)
+				up.begin[p] = boundary;
+			else
+				up.end[p] = boundary;
+		}
+		else
+		{
+			int q = neighbor_reverse ? up.begin[neighbor] : up.end[neighbor];
+			int delta_id = neighbor_reverse ? -1 : 1;
+			while (!_temp.empty())
+			{
+				int e = _temp.back();
+				_temp.pop_back();
+				lv.parent[e] = neighbor;
+				if (toggle)
+					lv.reverse[e] = !lv.reverse[e];
+				connect(level, q, e);
+				lv.id[e] = lv.id[q] + delta_id;
+				q = e;
+			}
+			if (neighbor_reverse)
+				up.begin[neighbor] = q;
+			else
+				up.end[neighbor] = q;
+			connect(level, q, boundary);
+			if (p_reverse)
+				up.end[p] = boundary;
+			else
+				up.begin[p] = boundary;
+		}
+	}
+
+	void KLevelTree::position_key(int city, int * key) const
+	{
+		int chain[max_levels];
+		chain[0] = slot(city);
+		for (int l = 0; l < top(); l++)
+			chain[l + 1] = _levels[l].parent[chain[l]];
+		key[top()] = _levels[top()].id[chain[top()]];
+		bool r = false;
+		for (int l = top() - 1; l >= 0; l--)
+		{
+			r ^= _levels[l + 1].reverse[chain[l + 1]] != 0;
+			int id = _levels[l].id[chain[l]];
+			key[l] = r ? -id : id;
+		}
+	}
+
+	bool KLevelTree::is_between(int a, int b, int c) const
+	{
+		assert(a != b && a != c && b != c);
+		int ka[max_levels], kb[max_levels], kc[max_levels];
+		position_key(a, ka);
+		position_key(b, kb);
+		position_key(c, kc);
+		auto less = [this](const int* u, const int* v) {
+			for (int l = top(); l >= 0; l--)
+			{
+				if (u[l] != v[l])
+					return u[l] < v[l];
+			}
+			return false;
+		};
+		if (less(ka, kc))
+			return less(ka, kb) && less(kb, kc);
+		return less(ka, kb) || less(kb, kc);
+	}
+
+	long long KLevelTree::approximate_position(int city) const
+	{
+		int e = slot(city);
+		long long position = 0, span = 1;
+		for (int l = 0; l < top(); l++)
+		{
+			auto& up = _levels[l + 1];
+			int p = _levels[l].parent[e];
+			int rank = child_orientation(l + 1, p) ? _levels[l].id[up.end[p]] - _levels[l].id[e]
+				: _levels[l].id[e] - _levels[l].id[up.begin[p]];
+			position += rank * span;
+			span *= up.nominal_size;
+			e = p;
+		}
+		return position + _levels[top()].id[e] * span;
+	}
+
+	void KLevelTree::flip(int a, int b, int c, int d)
+	{
+		bool is_forward = get_next(a) == b;
+		assert((get_next(c) == d) == is_forward);
+		assert(!((a == c) && (b == d)));
+		if (b == c || d == a)  // in this case, even after flip, still the same
+			return;
+		// reverse the approximately shorter one of the paths b --> c and d --> a
+		long long total = n_elements(top());
+		for (int l = 1; l < n_levels(); l++)
+			total *= _levels[l].nominal_size;
+		auto length = [this, total](int u, int v) {
+			long long d = approximate_position(v) - approximate_position(u);
+			return d < 0 ? d + total : d;
+		};
+		bool shorter = is_forward ? length(b, c) <= length(d, a) : length(c, b) <= length(a, d);
+		if (shorter)
+		{
+			if (is_forward)
+				reverse(b, c);
+			else
+				reverse(c, b);
+		}
+		else
+		{
+			if (is_forward)
+				reverse(d, a);
+			else
+				reverse(a, d);
+		}
+	}
+
+	void KLevelTree::double_bridge_move(int a, int b, int c, int d)
+	{
+		assert(is_between(a, b, c) && is_between(b, c, d) && is_between(c, d, a));
+		int bn = get_next(b), cn = get_next(c), dn = get_next(d);
+		// [an..b] [bn..c] [cn..d] [dn..a] --> [an..b] [dn..a] [cn..d] [bn..c]
+		reverse(bn, a);
+		reverse(a, dn);
+		reverse(d, cn);
+		reverse(c, bn);
+	}
+
+	std::vector<int> KLevelTree::get_raw_tour(int start_city, Direction direction) const
+	{
+		std::vector<int> raw_tour;
+		to_raw_tour(raw_tour, start_city, direction);
+		return raw_tour;
+	}
+
+	void KLevelTree::to_raw_tour(std::vector<int>& raw_tour, int start_city, Direction direction) const
+	{
+		if (start_city < 0)
+			start_city = _origin_city;
+		int s = slot(start_city);
+		raw_tour.resize(_n_cities);
+		for (int i = 0; i < _n_cities; ++i)
+		{
+			raw_tour[i] = s + _origin_city;
+			s = direction == Direction::forward ? next_of(0, s) : prev_of(0, s);
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <ostream>
+#include <istream>
+#include "move_log.h"
+
+namespace tsp
+{
+	namespace
+	{
+		const char log_magic[4] = { 'T', 'L', 'M', 'L' };
+		const std::uint32_t log_version = 1;
+	}
+
+	bool MoveLog::save(std::ostream & os) const
+	{
+		std::int64_t header[2] = { log_version, static_cast<std::int64_t>(_data.size()) };
+		os.write(log_magic, sizeof(log_magic));
+		os.write(reinterpret_cast<const char*>(header), sizeof(header));
+		os.write(reinterpret_cast<const char*>(_data.data()), _data.size() * sizeof(std::int32_t));
+		return static_cast<bool>(os);
+	}
+
+	bool MoveLog::load(std::istream & is)
+	{
+		char magic[sizeof(log_magic)];
+		std::int64_t header[2];
+		if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), log_magic)
+			|| !is.read(reinterpret_cast<char*>(header), sizeof(header)))
+			return false;
+		if (header[0] != static_cast<std::int64_t>(log_version) || header[1] < 0)
+			return false;
+		std::vector<std::int32_t> data(static_cast<std::size_t>(header[1]));
+		if (!is.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(std::int32_t)))
+			return false;
+		// the entries must be complete, though the cities are only checked on replay
+		for (std::size_t i = 0; i < data.size(); i += 1 + n_arguments(static_cast<Move>(data[i])))
+		{
+			if (data[i] < 0 || data[i] > static_cast<std::int32_t>(Move::rollback)
+				|| i + 1 + n_arguments(static_cast<Move>(data[i])) > data.size())
+				return false;
+		}
+		_data.swap(data);
+		return true;
+	}
+}
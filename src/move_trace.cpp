@@ -0,0 +1,67 @@
+#include <cassert>
+#include <algorithm>
+#include <sstream>
+#include "move_trace.h"
+
+namespace tsp
+{
+	namespace
+	{
+		const char trace_magic[4] = { 'T', 'L', 'M', 'T' };
+		const std::uint32_t trace_version = 1;
+	}
+
+	void MoveTrace::start(TwoLevelTree & tree)
+	{
+		std::ostringstream state;
+		tree.save(state);
+		_n_cities = tree.n_cities();
+		_origin_city = tree.origin_city();
+		_initial_state = state.str();
+		_log.clear();
+		tree.set_move_log(&_log);
+	}
+
+	void MoveTrace::stop(TwoLevelTree & tree)
+	{
+		if (tree.move_log() == &_log)
+			tree.set_move_log(nullptr);
+	}
+
+	bool MoveTrace::load_initial_state(TwoLevelTree & tree) const
+	{
+		if (tree.n_cities() != _n_cities || tree.origin_city() != _origin_city)
+			return false;
+		std::istringstream state{ _initial_state };
+		return tree.load(state);
+	}
+
+	bool MoveTrace::save(std::ostream & os) const
+	{
+		std::int64_t header[4] = { trace_version, _n_cities, _origin_city, static_cast<std::int64_t>(_initial_state.size()) };
+		os.write(trace_magic, sizeof(trace_magic));
+		os.write(reinterpret_cast<const char*>(header), sizeof(header));
+		os.write(_initial_state.data(), _initial_state.size());
+		return _log.save(os);
+	}
+
+	bool MoveTrace::load(std::istream & is)
+	{
+		char magic[sizeof(trace_magic)];
+		std::int64_t header[4];
+		if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), trace_magic)
+			|| !is.read(reinterpret_cast<char*>(header), sizeof(header)))
+			return false;
+		if (header[0] != static_cast<std::int64_t>(trace_version) || header[1] <= 0 || header[2] < 0 || header[3] < 0)
+			return false;
+		std::string state(static_cast<std::size_t>(header[3]), '\0');
+		MoveLog log;
+		if (!is.read(&state[0], state.size()) || !log.load(is))
+			return false;
+		_n_cities = static_cast<int>(header[1]);
+		_origin_city = static_cast<int>(header[2]);
+		_initial_state.swap(state);
+		std::swap(_log, log);
+		return true;
+	}
+}
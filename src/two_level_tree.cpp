@@ -1,56 +1,635 @@
 #include <cmath>
 #include <cassert>
 #include <functional>
+#include <algorithm>
+#include <ostream>
+#include <istream>
+#include <chrono>
+#include <numeric>
+#include <thread>
 #include "two_level_tree.h"
+#include "move_log.h"
+
+// count the internal operations only if requested, see TreeStats
+#ifdef TSP_TWO_LEVEL_TREE_STATS
+#define TSP_COUNT(counter, n) (_stats.counter += (n))
+#else
+#define TSP_COUNT(counter, n) ((void)0)
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TSP_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define TSP_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define TSP_PREFETCH(p) ((void)0)
+#endif
+
+// a cold path kept out of the inlined queries
+#if defined(__GNUC__) || defined(__clang__)
+#define TSP_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define TSP_NOINLINE __declspec(noinline)
+#else
+#define TSP_NOINLINE
+#endif
 
 namespace tsp
 {
+	namespace
+	{
+		int count_segments(int n_cities, const SegmentPolicy& policy)
+		{
+			int n = static_cast<int>(std::sqrt(n_cities)) + 1;
+			if (policy.n_segments > 0)
+				n = policy.n_segments;
+			else if (policy.nominal_length > 0)
+				n = n_cities / policy.nominal_length;
+			return std::max(2, std::min(n, n_cities));
+		}
+
+		// call f(first, last) for n_threads contiguous ranges of [0, n), one of them in the calling thread
+		template<typename Function>
+		void parallel_for(int n, int n_threads, Function f)
+		{
+			if (n_threads <= 1)
+			{
+				f(0, n);
+				return;
+			}
+			std::vector<std::thread> threads;
+			threads.reserve(n_threads - 1);
+			for (int t = 1; t < n_threads; t++)
+				threads.emplace_back(f, static_cast<int>(static_cast<long long>(n) * t / n_threads), 
+					static_cast<int>(static_cast<long long>(n) * (t + 1) / n_threads));
+			f(0, n / n_threads);
+			for (auto& thread : threads)
+				thread.join();
+		}
+	}
+
+	const int TwoLevelTree::batch_prefetch_distance;
+	const int TwoLevelTree::batch_prefetch_min_cities;
+
 	TwoLevelTree::TwoLevelTree(int n_cities, int origin_city)
-		: _nodes(n_cities + origin_city), _parent_nodes(static_cast<int>(std::sqrt(n_cities)) + 1),
-			_n_cities{n_cities}, _origin_city{origin_city}
+		: TwoLevelTree(n_cities, origin_city, SegmentPolicy{})
+	{
+	}
+
+	TwoLevelTree::TwoLevelTree(int n_cities, int origin_city, const SegmentPolicy& policy)
+		: _nodes(n_cities), _parent_nodes(count_segments(n_cities, policy)),
+			_n_cities{n_cities}, _origin_city{origin_city}, _segment_policy{policy}
 	{
 		assert(n_cities > 0);
 		assert(origin_city >= 0);
 		assert(n_segments() > 1); // we didn't handle the case where only one segment exists
+		assert(policy.partial_reverse_ratio >= 0);
 		_nominal_segment_length = n_cities / n_segments();
+		_max_partial_reverse_length = static_cast<int>(policy.partial_reverse_ratio * _nominal_segment_length);
+	}
+
+	TwoLevelTree::TwoLevelTree(const std::vector<int>& cities, const SegmentPolicy & policy)
+		: TwoLevelTree(static_cast<int>(cities.size()), cities.empty() ? 0 : cities[0], policy)
+	{
+		_city_ids = cities;
+		std::size_t size = 4;
+		_id_shift = 30;
+		while (size < 2 * cities.size())
+		{
+			size *= 2;
+			_id_shift--;
+		}
+		_id_slots.assign(size, std::make_pair(-1, 0));
+		for (int i = 0; i < _n_cities; i++)
+		{
+			assert(cities[i] >= 0);
+			auto& entry = _id_slots[find_id_entry(cities[i])];
+			assert(entry.first < 0);  // the cities should be distinct
+			entry = { cities[i], i };
+		}
+		update_city_lookup();
 	}
 
 	TwoLevelTree::TwoLevelTree(const TwoLevelTree & other)
-		: _n_cities{other._n_cities}, _origin_city{other._origin_city}, 
-		_nodes(other._nodes.size()), 
-		_parent_nodes(other._parent_nodes.size()),
-		_nominal_segment_length{other._nominal_segment_length}
+		: _parent_nodes(other._parent_nodes), _nodes(other._nodes),
+		_n_cities{other._n_cities}, _origin_city{other._origin_city}, _city_lookup{other._city_lookup},
+		_nominal_segment_length{other._nominal_segment_length},
+		_segment_policy{other._segment_policy},
+		_max_partial_reverse_length{other._max_partial_reverse_length},
+		_rebalance_policy{other._rebalance_policy},
+		_parallel_policy{other._parallel_policy},
+		_segment_cities(other._segment_cities),
+		_segment_cache_valid(other._segment_cache_valid),
+		_city_slots(other._city_slots),
+		_city_ids(other._city_ids),
+		_id_slots(other._id_slots),
+		_id_shift{other._id_shift},
+		_track_changes{other._track_changes},
+		_changed_cities(other._changed_cities),
+		_changed_flags(other._changed_flags),
+		_distance(other._distance),
+		_segment_costs(other._segment_costs),
+		_tour_length{other._tour_length},
+		_parent_offsets(other._parent_offsets),
+		_parent_offsets_valid{other._parent_offsets_valid},
+		_concurrent_reads{other._concurrent_reads}
 	{
-		set_raw_tour(other.get_raw_tour());
+		rebase(reinterpret_cast<std::uintptr_t>(other._nodes.data()),
+			reinterpret_cast<std::uintptr_t>(other._parent_nodes.data()));
+		reset_versions();
 	}
 
 	TwoLevelTree & TwoLevelTree::operator=(const TwoLevelTree & other)
 	{
 		if (this == &other)
 			return *this;
+		assert(!_in_transaction);
 		_n_cities = other._n_cities;
 		_origin_city = other._origin_city;
-		_nodes.clear();
-		_nodes.resize(other._nodes.size());
-		_parent_nodes.clear();
-		_parent_nodes.resize(other._parent_nodes.size());
+		// the vectors reuse their storage if they already have enough capacity
+		_nodes = other._nodes;
+		_parent_nodes = other._parent_nodes;
 		_nominal_segment_length = other._nominal_segment_length;
-		set_raw_tour(other.get_raw_tour());
+		_segment_policy = other._segment_policy;
+		_max_partial_reverse_length = other._max_partial_reverse_length;
+		_rebalance_policy = other._rebalance_policy;
+		_parallel_policy = other._parallel_policy;
+		_segment_cities = other._segment_cities;
+		_segment_cache_valid = other._segment_cache_valid;
+		_parent_offsets = other._parent_offsets;
+		_parent_offsets_valid = other._parent_offsets_valid;
+		_city_slots = other._city_slots;
+		_city_ids = other._city_ids;
+		_id_slots = other._id_slots;
+		_id_shift = other._id_shift;
+		_city_lookup = other._city_lookup;
+		_track_changes = other._track_changes;
+		_changed_cities = other._changed_cities;
+		_changed_flags = other._changed_flags;
+		_distance = other._distance;
+		_segment_costs = other._segment_costs;
+		_tour_length = other._tour_length;
+		_concurrent_reads = other._concurrent_reads;
+		rebase(reinterpret_cast<std::uintptr_t>(other._nodes.data()),
+			reinterpret_cast<std::uintptr_t>(other._parent_nodes.data()));
+		reset_versions();
+		_resized_parents.clear();
 		_temp_nodes.clear();
-		_temp_parent_nodes.clear();
 		return *this;
 	}
 
+	void TwoLevelTree::snapshot(Snapshot & s) const
+	{
+		s.nodes = _nodes;
+		s.parent_nodes = _parent_nodes;
+		s.city_slots = _city_slots;
+		s.id_slots = _id_slots;
+		s.node_base = reinterpret_cast<std::uintptr_t>(_nodes.data());
+		s.parent_node_base = reinterpret_cast<std::uintptr_t>(_parent_nodes.data());
+	}
+
+	TwoLevelTree::Snapshot TwoLevelTree::snapshot() const
+	{
+		Snapshot s;
+		snapshot(s);
+		return s;
+	}
+
+	void TwoLevelTree::restore(const Snapshot & s)
+	{
+		WriteScope scope{ this };
+		assert(s.nodes.size() == _nodes.size() && s.parent_nodes.size() == _parent_nodes.size());
+		touch_all();
+		std::copy(s.nodes.begin(), s.nodes.end(), _nodes.begin());
+		std::copy(s.parent_nodes.begin(), s.parent_nodes.end(), _parent_nodes.begin());
+		if (s.city_slots != _city_slots || s.id_slots != _id_slots)
+		{
+			// the queued changes are flagged by slot, and all the cities are queued again below
+			clear_changed_cities();
+			if (_in_transaction && !_slots_journaled)
+			{
+				_journaled_city_slots.swap(_city_slots);
+				_journaled_id_slots.swap(_id_slots);
+				_slots_journaled = true;
+			}
+			_city_slots = s.city_slots;
+			_id_slots = s.id_slots;
+			update_city_lookup();
+		}
+		rebase(s.node_base, s.parent_node_base);
+		_segment_cache_valid.assign(_segment_cache_valid.size(), false);
+		_parent_offsets_valid = false;
+		update_positions();
+		_resized_parents.clear();
+		reset_costs();
+		record_all_changes();
+	}
+
+	namespace
+	{
+		const char state_magic[4] = { 'T', 'L', 'T', 'S' };
+		const std::uint32_t state_version = 1;
+	}
+
+	bool TwoLevelTree::save(std::ostream & os) const
+	{
+		// everything is stored as 32-bit integers, where the links are indices: a node by its city and 
+		// a parent by its position in _parent_nodes
+		std::vector<std::int32_t> buffer;
+		buffer.reserve(4 + 7 * _parent_nodes.size() + 4 * _n_cities);
+		buffer.push_back(static_cast<std::int32_t>(state_version));
+		buffer.push_back(_n_cities);
+		buffer.push_back(_origin_city);
+		buffer.push_back(n_segments());
+		auto parent_index = [this](const ParentNode* p) { return static_cast<std::int32_t>(p - _parent_nodes.data()); };
+		for (auto& p : _parent_nodes)
+		{
+			buffer.insert(buffer.end(), { p.id, p.size, p.reverse ? 1 : 0, parent_index(p.prev), parent_index(p.next),
+				p.segment_begin_node->city, p.segment_end_node->city });
+		}
+		for (int i = 0; i < _n_cities; i++)
+		{
+			auto node = get_node(city_at(i));
+			buffer.insert(buffer.end(), { node->id, node->prev->city, node->next->city, parent_index(node->parent) });
+		}
+		os.write(state_magic, sizeof(state_magic));
+		os.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(std::int32_t));
+		return static_cast<bool>(os);
+	}
+
+	bool TwoLevelTree::load(std::istream & is)
+	{
+		assert(!_in_transaction);
+		char magic[sizeof(state_magic)];
+		std::int32_t header[4];
+		if (!is.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), state_magic)
+			|| !is.read(reinterpret_cast<char*>(header), sizeof(header)))
+			return false;
+		// a different byte order cannot pass the version check either
+		int n = header[3];
+		if (header[0] != static_cast<std::int32_t>(state_version) || header[1] != _n_cities 
+			|| header[2] != _origin_city || n < 2 || n > _n_cities)
+			return false;
+		std::vector<std::int32_t> buffer(7 * static_cast<std::size_t>(n) + 4 * static_cast<std::size_t>(_n_cities));
+		if (!is.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(std::int32_t)))
+			return false;
+		// validate all the links before touching the tree
+		auto is_parent = [n](std::int32_t i) { return i >= 0 && i < n; };
+		auto is_city = [this](std::int32_t city) { return is_city_valid(city); };
+		auto parents = buffer.data(), nodes = buffer.data() + 7 * n;
+		for (int i = 0; i < n; i++)
+		{
+			auto p = parents + 7 * i;
+			if (p[1] <= 0 || !is_parent(p[3]) || !is_parent(p[4]) || !is_city(p[5]) || !is_city(p[6]))
+				return false;
+		}
+		for (int i = 0; i < _n_cities; i++)
+		{
+			auto node = nodes + 4 * i;
+			if (!is_city(node[1]) || !is_city(node[2]) || !is_parent(node[3]))
+				return false;
+		}
+		// and the structure, since a corrupted one would make the traversals loop: the parents form a cycle
+		// with consecutive ids, each segment is a path with consecutive ids from its begin to its end node,
+		// the sizes add up to n, and the forward tour goes on from each segment into the next one
+		std::vector<int> entry_of_slot(_n_cities);
+		for (int i = 0; i < _n_cities; i++)
+			entry_of_slot[get_node(city_at(i)) - _nodes.data()] = i;
+		auto entry = [&](std::int32_t city) { return nodes + 4 * entry_of_slot[get_node(city) - _nodes.data()]; };
+		std::int32_t index = 0;
+		long long total_size = 0;
+		for (int k = 0; k < n; k++)
+		{
+			auto p = parents + 7 * index, q = parents + 7 * p[4];
+			if (p[0] < 0 || p[0] >= n || q[0] != (p[0] + 1) % n || q[3] != index)
+				return false;
+			std::int32_t city = p[5];
+			auto first_id = entry(city)[0];
+			for (int j = 0; ; j++)
+			{
+				auto node = entry(city);
+				if (node[3] != index || node[0] != first_id + j || j >= p[1])
+					return false;
+				if (city == p[6])
+				{
+					if (j + 1 != p[1])
+						return false;
+					break;
+				}
+				if (entry(node[2])[1] != city)
+					return false;
+				city = node[2];
+			}
+			total_size += p[1];
+			// the forward successor of the last node of this segment, in terms of the raw links
+			std::int32_t last = p[2] ? p[5] : p[6], first = q[2] ? q[6] : q[5];
+			if ((p[2] ? entry(last)[1] : entry(last)[2]) != first || (q[2] ? entry(first)[2] : entry(first)[1]) != last)
+				return false;
+			index = p[4];
+		}
+		if (index != 0 || total_size != _n_cities)
+			return false;
+
+		// the segment layout is taken from the state
+		_parent_nodes.resize(n);
+		_nominal_segment_length = _n_cities / n;
+		_max_partial_reverse_length = static_cast<int>(_segment_policy.partial_reverse_ratio * _nominal_segment_length);
+		for (int i = 0; i < n; i++)
+		{
+			auto p = parents + 7 * i;
+			auto& parent = _parent_nodes[i];
+			parent.id = p[0];
+			parent.size = p[1];
+			parent.reverse = p[2] != 0;
+			parent.prev = &_parent_nodes[p[3]];
+			parent.next = &_parent_nodes[p[4]];
+			parent.segment_begin_node = get_node(p[5]);
+			parent.segment_end_node = get_node(p[6]);
+		}
+		for (int i = 0; i < _n_cities; i++)
+		{
+			auto node = nodes + 4 * i;
+			auto& target = *get_node(city_at(i));
+			target.id = node[0];
+			target.city = city_at(i);
+			target.prev = get_node(node[1]);
+			target.next = get_node(node[2]);
+			target.parent = &_parent_nodes[node[3]];
+		}
+		_segment_cities.resize(n);
+		_segment_cache_valid.assign(n, false);
+		_parent_offsets_valid = false;
+		update_positions();
+		_resized_parents.clear();
+		reset_versions();
+		reset_costs();
+		record_all_changes();
+		return true;
+	}
+
+	void TwoLevelTree::begin_transaction()
+	{
+		assert(!_in_transaction);
+		if (_node_epochs.size() != _nodes.size() || _parent_node_epochs.size() != _parent_nodes.size()
+			|| ++_transaction_epoch == 0)
+		{
+			_node_epochs.assign(_nodes.size(), 0);
+			_parent_node_epochs.assign(_parent_nodes.size(), 0);
+			_transaction_epoch = 1;
+		}
+		_node_journal.clear();
+		_parent_node_journal.clear();
+		_slots_journaled = false;
+		_in_transaction = true;
+		_transaction_tour_length = _tour_length;
+		if (_move_log)
+			_move_log->record(MoveLog::Move::begin_transaction);
+	}
+
+	void TwoLevelTree::commit()
+	{
+		assert(_in_transaction);
+		_in_transaction = false;
+		_node_journal.clear();
+		_parent_node_journal.clear();
+		_slots_journaled = false;
+		if (_move_log)
+			_move_log->record(MoveLog::Move::commit);
+	}
+
+	void TwoLevelTree::rollback()
+	{
+		assert(_in_transaction);
+		WriteScope scope{ this };
+		if (_concurrent_reads)
+			begin_write_all();
+		_in_transaction = false;
+		if (_move_log)
+			_move_log->record(MoveLog::Move::rollback);
+		// the slots of the cities are changed only by restore, which has touched all the nodes
+		if (_slots_journaled)
+		{
+			clear_changed_cities();
+			_city_slots.swap(_journaled_city_slots);
+			_id_slots.swap(_journaled_id_slots);
+			_slots_journaled = false;
+			update_city_lookup();
+		}
+		// each node is journaled only once with its value before the transaction, so the order is irrelevant
+		for (auto& entry : _node_journal)
+		{
+			*entry.first = entry.second;
+			record_change(entry.first);
+		}
+		// the segments whose contents have changed are exactly those with a journaled parent
+		for (auto& entry : _parent_node_journal)
+		{
+			*entry.first = entry.second;
+			invalidate_segment_cache(entry.first);
+			if (_distance)
+				_segment_costs[entry.first - _parent_nodes.data()] = compute_segment_cost(entry.first);
+		}
+		_tour_length = _transaction_tour_length;
+		_node_journal.clear();
+		_parent_node_journal.clear();
+		_parent_offsets_valid = false;
+		update_positions();
+		_resized_parents.clear();
+	}
+
+	void TwoLevelTree::touch_all()
+	{
+		if (_concurrent_reads)
+			begin_write_all();
+		if (!_in_transaction)
+			return;
+		for (auto& node : _nodes)
+			touch(&node);
+		for (auto& p : _parent_nodes)
+			touch(&p);
+	}
+
+	void TwoLevelTree::rebase(std::uintptr_t node_base, std::uintptr_t parent_node_base)
+	{
+		auto new_node_base = reinterpret_cast<std::uintptr_t>(_nodes.data());
+		auto new_parent_node_base = reinterpret_cast<std::uintptr_t>(_parent_nodes.data());
+		if (node_base == new_node_base && parent_node_base == new_parent_node_base)
+			return;
+		// the offset of a pointer in its array is kept. The nodes of a tree without a tour have null links.
+		auto node = [=](Node* p) {
+			return p ? reinterpret_cast<Node*>(reinterpret_cast<std::uintptr_t>(p) - node_base + new_node_base) : p;
+		};
+		auto parent = [=](ParentNode* p) {
+			return p ? reinterpret_cast<ParentNode*>(reinterpret_cast<std::uintptr_t>(p) - parent_node_base 
+				+ new_parent_node_base) : p;
+		};
+		for (auto& n : _nodes)
+		{
+			n.prev = node(n.prev);
+			n.next = node(n.next);
+			n.parent = parent(n.parent);
+		}
+		for (auto& p : _parent_nodes)
+		{
+			p.prev = parent(p.prev);
+			p.next = parent(p.next);
+			p.segment_begin_node = node(p.segment_begin_node);
+			p.segment_end_node = node(p.segment_end_node);
+		}
+	}
+
+
+	void TwoLevelTree::set_storage_order(const std::vector<int>& cities)
+	{
+		assert(!_in_transaction);
+		assert(static_cast<int>(cities.size()) == _n_cities);
+		// the new slot of each node by its current slot, where city i is moved to slot i
+		std::vector<int> slots(_nodes.size());
+		bool identity = true;
+		for (int i = 0; i < _n_cities; i++)
+		{
+			assert(is_city_valid(cities[i]));
+			slots[get_node(cities[i]) - _nodes.data()] = i;
+			identity = identity && cities[i] == city_at(i);
+		}
+		std::vector<Node> nodes(_nodes.size());
+		auto relocate = [this, &nodes, &slots](const Node* node) {
+			return node ? &nodes[slots[node - _nodes.data()]] : nullptr;
+		};
+		for (int i = 0; i < _n_cities; i++)
+		{
+			int city = cities[i];
+			auto node = get_node(city);
+			auto& target = nodes[i];
+			target = *node;
+			target.city = city;  // it may not be set yet if the tour has never been specified
+			target.prev = relocate(node->prev);
+			target.next = relocate(node->next);
+		}
+		for (auto& p : _parent_nodes)
+		{
+			p.segment_begin_node = relocate(p.segment_begin_node);
+			p.segment_end_node = relocate(p.segment_end_node);
+		}
+		_nodes.swap(nodes);
+		// the flags of the queued changes move with their nodes
+		if (_track_changes)
+		{
+			std::vector<char> flags(_changed_flags.size());
+			for (std::size_t i = 0; i < slots.size(); i++)
+				flags[slots[i]] = _changed_flags[i];
+			_changed_flags.swap(flags);
+		}
+		if (!_id_slots.empty())
+		{
+			for (int i = 0; i < _n_cities; i++)
+				_id_slots[find_id_entry(cities[i])].second = i;
+		}
+		else if (identity)
+			_city_slots.clear();
+		else
+		{
+			_city_slots.resize(_n_cities);
+			for (int i = 0; i < _n_cities; i++)
+				_city_slots[cities[i] - _origin_city] = i;
+		}
+		update_city_lookup();
+	}
+
+	void TwoLevelTree::compact()
+	{
+		to_raw_tour(_relayout_buffer);
+		set_storage_order(_relayout_buffer);
+		update_segment_cache();
+	}
+
+	namespace
+	{
+		// the distance of the cell (x, y) along the Hilbert curve filling a grid of side n = 2^k
+		std::uint64_t hilbert_index(std::uint32_t n, std::uint32_t x, std::uint32_t y)
+		{
+			std::uint64_t d = 0;
+			for (std::uint32_t s = n / 2; s > 0; s /= 2)
+			{
+				std::uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+				d += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+				// rotate the quadrant
+				if (ry == 0)
+				{
+					if (rx == 1)
+					{
+						x = s - 1 - x;
+						y = s - 1 - y;
+					}
+					std::swap(x, y);
+				}
+			}
+			return d;
+		}
+	}
+
+	std::vector<int> TwoLevelTree::hilbert_order(const std::vector<double>& x, const std::vector<double>& y, int origin_city)
+	{
+		assert(x.size() == y.size());
+		if (x.empty())
+			return {};
+		const std::uint32_t grid = 1u << 16;
+		auto x_range = std::minmax_element(x.begin(), x.end());
+		auto y_range = std::minmax_element(y.begin(), y.end());
+		std::vector<std::pair<std::uint64_t, int>> keys(x.size());
+		// the same scale for both axes keeps the shape of the instance
+		double extent = std::max(*x_range.second - *x_range.first, *y_range.second - *y_range.first);
+		double scale = extent > 0 ? (grid - 1) / extent : 0;
+		for (std::size_t i = 0; i < x.size(); i++)
+		{
+			auto cx = static_cast<std::uint32_t>((x[i] - *x_range.first) * scale);
+			auto cy = static_cast<std::uint32_t>((y[i] - *y_range.first) * scale);
+			keys[i] = { hilbert_index(grid, cx, cy), origin_city + static_cast<int>(i) };
+		}
+		std::sort(keys.begin(), keys.end());
+		std::vector<int> order(keys.size());
+		for (std::size_t i = 0; i < keys.size(); i++)
+			order[i] = keys[i].second;
+		return order;
+	}
 
 	void TwoLevelTree::set_raw_tour(const std::vector<int>& order)
 	{
+		WriteScope scope{ this };
 		assert(order.size() == _n_cities);
+		int n = n_segments();
+		_segment_cities.resize(n);
+		_segment_cache_valid.assign(n, false);
+		_parent_offsets_valid = false;
+		touch_all();
+		if (_distance)
+			_segment_costs.resize(n);
+		parallel_for(n, bulk_threads(), [this, &order](int first, int last) { build_segments(order, first, last); });
+		if (_distance)
+			sum_tour_length();
+		update_positions();
+		record_all_changes();
+	}
+
+	int TwoLevelTree::bulk_threads() const
+	{
+		if (_n_cities < _parallel_policy.min_cities)
+			return 1;
+		int n_threads = _parallel_policy.n_threads;
+		if (n_threads <= 0)
+			n_threads = static_cast<int>(std::thread::hardware_concurrency());
+		// at least a few segments per thread
+		return std::max(1, std::min(n_threads, n_segments() / 4));
+	}
+
+	void TwoLevelTree::build_segments(const std::vector<int>& order, int first, int last)
+	{
 		int n = n_segments();
 		int segment_length = _n_cities / n;
 		int first_city = order.front();
 		int last_city = order.back();
-
-		for (int current_segment = 0; current_segment < n; current_segment++)
+		for (int current_segment = first; current_segment < last; current_segment++)
 		{
 			// first build the parent for this segment
 			auto parent = &_parent_nodes[current_segment];
@@ -64,8 +643,8 @@ namespace tsp
 			// the last segment takes all the remaining cities
 			if (current_segment == n - 1)
 				i_end = _n_cities;
-			parent->segment_begin_node = &_nodes[order[i_begin]];
-			parent->segment_end_node = &_nodes[order[i_end - 1]];
+			parent->segment_begin_node = get_node(order[i_begin]);
+			parent->segment_end_node = get_node(order[i_end - 1]);
 			parent->size = i_end - i_begin;
 
 			// build the segment node one by one
@@ -81,9 +660,41 @@ namespace tsp
 				node->next = i + 1 == _n_cities ? get_node(first_city) : get_node(order[i + 1]);
 				node->id = i - i_begin;
 			}
+			if (_distance)
+			{
+				double cost = 0;
+				for (int i = i_begin + 1; i < i_end; i++)
+					cost += _distance(order[i - 1], order[i]);
+				_segment_costs[current_segment] = cost;
+			}
 		}
 	}
 
+	void TwoLevelTree::track_changes(bool enabled)
+	{
+		_track_changes = enabled;
+		clear_changed_cities();
+		if (enabled)
+			_changed_flags.resize(_nodes.size(), 0);
+		else
+			std::vector<char>().swap(_changed_flags);
+	}
+
+	void TwoLevelTree::clear_changed_cities()
+	{
+		for (int city : _changed_cities)
+			_changed_flags[get_node(city) - _nodes.data()] = 0;
+		_changed_cities.clear();
+	}
+
+	void TwoLevelTree::record_all_changes()
+	{
+		if (!_track_changes)
+			return;
+		for (int i = 0; i < _n_cities; i++)
+			record_change(get_node(city_at(i)));
+	}
+
 	bool TwoLevelTree::is_between(const Node * a, const Node * b, const Node * c) const
 	{
 		assert(a != b && a != c && b != c);
@@ -146,9 +757,107 @@ namespace tsp
 		return is_between(get_node(a), get_node(b), get_node(c));
 	}
 
-	// To facilitate implementation, we use implicit rebalance here, because in practice the 
-	// complicated full rebalance is empricially unnecessary.
+	void TwoLevelTree::get_neighbor_batch(const int * cities, int n, int * neighbors, bool forward) const
+	{
+		// the nodes are prefetched ahead of the current query, such that the cache misses of consecutive
+		// queries overlap instead of being serialized. The parents are not: the O(sqrt(n)) of them mostly
+		// stay in the cache, and reading the node for its parent pointer would wait for that very miss.
+		// Even then, the out-of-order execution overlaps the queries of a plain loop almost as well, so it
+		// only pays off for the largest trees.
+		const int distance = batch_prefetch_distance;
+		for (int i = 0; i < std::min(n, distance); i++)
+			TSP_PREFETCH(get_node(cities[i]));
+		for (int i = 0; i < n; i++)
+		{
+			if (i + distance < n)
+				TSP_PREFETCH(get_node(cities[i + distance]));
+			auto node = get_node(cities[i]);
+			neighbors[i] = (forward ? get_next(node) : get_prev(node))->city;
+		}
+	}
+
+	bool TwoLevelTree::is_sequence(const int * cities, int k) const
+	{
+		if (k <= 2)
+			return true;
+		auto start = get_node(cities[0]);
+		auto last = tour_order_key(start, start);
+		for (int i = 1; i < k; i++)
+		{
+			auto key = tour_order_key(start, get_node(cities[i]));
+			if (key <= last)
+				return false;
+			last = key;
+		}
+		return true;
+	}
+
+	void TwoLevelTree::sort_by_tour_order(int * cities, int k) const
+	{
+		if (k <= 2)
+			return;
+		// the keys of a k-opt move stay on the stack, which keeps this const query thread-safe
+		typedef std::pair<std::uint64_t, int> Key;
+		Key small_keys[small_sequence_length];
+		std::vector<Key> large_keys;
+		Key* keys = small_keys;
+		if (k > small_sequence_length)
+		{
+			large_keys.resize(k);
+			keys = large_keys.data();
+		}
+		auto start = get_node(cities[0]);
+		for (int i = 0; i < k; i++)
+			keys[i] = { tour_order_key(start, get_node(cities[i])), cities[i] };
+		if (k > small_sequence_length)
+			std::sort(keys + 1, keys + k);
+		else
+		{
+			// insertion sort, which is the fastest for a few keys
+			for (int i = 2; i < k; i++)
+			{
+				auto key = keys[i];
+				int j = i;
+				for (; j > 1 && key < keys[j - 1]; j--)
+					keys[j] = keys[j - 1];
+				keys[j] = key;
+			}
+		}
+		for (int i = 1; i < k; i++)
+		{
+			assert(keys[i].first != keys[i - 1].first);
+			cities[i] = keys[i].second;
+		}
+	}
+
 	void TwoLevelTree::reverse(Node * a, Node * b)
+	{
+		WriteScope scope{ this };
+		if (_track_changes && a != b && get_next(b) != a)
+		{
+			for (auto p : { get_prev(a), a, b, get_next(b) })
+				record_change(p);
+		}
+		if (_distance && a != b && get_next(b) != a)
+		{
+			auto prev_a = get_prev(a), next_b = get_next(b);
+			_tour_length += distance(prev_a, b) + distance(a, next_b) - distance(prev_a, a) - distance(b, next_b);
+		}
+		if (_move_log)
+			_move_log->record(MoveLog::Move::reverse, a->city, b->city);
+		reverse_path(a, b);
+		apply_rebalance_policy();
+	}
+
+	void TwoLevelTree::reverse(int a, int b)
+	{
+		reverse(get_node(a), get_node(b));
+	}
+
+	// To facilitate implementation, we use implicit rebalance here, because in practice the 
+	// complicated full rebalance is empricially unnecessary. An explicit one can still be enabled
+	// by the rebalancing policy, which is applied by the caller after the path is reversed.
+	void TwoLevelTree::reverse_path(Node * a, Node * b)
 	{
 		if (a == b || get_next(b) == a)
 			return;
@@ -166,9 +875,9 @@ namespace tsp
 				auto a_forward_end = a->parent->forward_end_node();
 				int	a_forward_half_length = std::abs(a_forward_end->id - a->id) + 1;
 				if (a_forward_half_length <= a->parent->size / 2)
-					split_and_merge(a, true, Direction::forward);
+					merge_into_neighbor(a, true, Direction::forward);
 				else
-					split_and_merge(a, false, Direction::backward);
+					merge_into_neighbor(a, false, Direction::backward);
 			};
 			auto split_and_merge_b = [a, b, this]() {
 				if (b == b->parent->backward_begin_node())
@@ -176,15 +885,15 @@ namespace tsp
 				// to handle the special cases: [......b..] -> [a......] (i.e., reverse almost a full circle)
 				if (b->parent->next == a->parent)
 				{
-					split_and_merge(b, true, Direction::backward);
+					merge_into_neighbor(b, true, Direction::backward);
 					return;
 				}
 				auto b_backward_end = b->parent->backward_end_node();
 				auto b_backward_half_length = std::abs(b_backward_end->id - b->id) + 1;
 				if (b_backward_half_length <= b->parent->size / 2)
-					split_and_merge(b, true, Direction::backward);
+					merge_into_neighbor(b, true, Direction::backward);
 				else
-					split_and_merge(b, false, Direction::forward);
+					merge_into_neighbor(b, false, Direction::forward);
 			};
 			
 			split_and_merge_a();
@@ -209,58 +918,160 @@ namespace tsp
 				|| (a->parent->reverse && a == a->parent->segment_end_node));
 			assert((!b->parent->reverse && b == b->parent->segment_end_node)
 				|| (b->parent->reverse && b == b->parent->segment_begin_node));
-			_temp_parent_nodes.clear();
-			// (a) each segment between a and b should be reversed
+			TSP_COUNT(n_multi_segment_reversals, 1);
 			auto s1 = a->parent->prev;
 			auto s2 = b->parent->next;
-			_temp_parent_nodes.push_back(s2);
-			auto p = a->parent;
-			while (p != s2)
-			{
-				p->reverse = !p->reverse;
-				_temp_parent_nodes.push_back(p);
-				p = p->next;
-			}
-			// (b) reverse the positions of the segments and reconnect them between s1 and s2
-			// we also need to update the ID and adjust the connections in the ends of each segment
-			p = s1;
+			touch(s1);
+			touch(s2);
 			int n_parents = static_cast<int>(_parent_nodes.size());
-			while (!_temp_parent_nodes.empty())
-			{
-				auto q = _temp_parent_nodes.back();
-				_temp_parent_nodes.pop_back();
-				// p -> q forward
+			// p -> q forward: we also need to update the ID and adjust the connections in the ends of each segment
+			auto link_forward = [this, n_parents](ParentNode* p, ParentNode* q) {
 				p->next = q;
 				q->prev = p;
 				q->id = (p->id + 1) % n_parents; // all parents nodes are placed in a cyclic list
+				update_parent_offset(p, q);
+				TSP_COUNT(n_parents_relinked, 1);
 				// the neighbor nodes of p and q segments should be connected properly
-				auto p_last = p->forward_end_node();
-				auto q_first = q->forward_begin_node();
-				connect_arc_forward(p_last, q_first);
+				connect_arc_forward(p->forward_end_node(), q->forward_begin_node());
+			};
+			// each segment between a and b is reversed and reconnected between s1 and s2 in a single pass 
+			// backward from b, which visits them in their new forward order
+			auto p = s1, q = b->parent;
+			while (true)
+			{
+				auto q_prev = q->prev;
+				touch(q);
+				q->reverse = !q->reverse;
+				link_forward(p, q);
 				p = q;
+				if (q == a->parent)
+					break;
+				q = q_prev;
 			}
-			// now p is s2
-			assert((p->id + 1) % n_parents == p->next->id);
+			link_forward(p, s2);
+			assert((s2->id + 1) % n_parents == s2->next->id);
 		}
 	}
 
-	// TODO : optimize by using a raw_tour cache
-	std::vector<int> TwoLevelTree::get_raw_tour(int start_city, Direction direction) const
+	void TwoLevelTree::set_rebalance_policy(const RebalancePolicy & policy)
 	{
-		if (start_city < 0)
-			start_city = origin_city();
-		assert(start_city >= origin_city() && start_city < _nodes.size());
-		auto node = get_node(start_city);
-		std::vector<int> raw_tour;
-		raw_tour.resize(_n_cities);
-		for (int i = 0; i < _n_cities; ++i)
+		assert(policy.max_ratio > 1 && policy.min_ratio < 1);
+		_rebalance_policy = policy;
+		_resized_parents.clear();
+		_unbalanced = false;
+		_n_moves_since_relayout = 0;
+	}
+
+	void TwoLevelTree::rebalance()
+	{
+		if (_move_log)
+			_move_log->record(MoveLog::Move::rebalance);
+		relayout();
+	}
+
+	void TwoLevelTree::relayout()
+	{
+		// the tour itself is not changed
+		bool track_changes = _track_changes;
+		_track_changes = false;
+		to_raw_tour(_relayout_buffer);
+		set_raw_tour(_relayout_buffer);
+		update_segment_cache();
+		_track_changes = track_changes;
+		_resized_parents.clear();
+		_unbalanced = false;
+		_n_moves_since_relayout = 0;
+		_n_relayouts++;
+	}
+
+	void TwoLevelTree::apply_rebalance_policy()
+	{
+		if (_rebalance_policy.mode == Rebalance::implicit)
+			return;
+		_n_moves_since_relayout++;
+		int max_size = std::max(1, static_cast<int>(_rebalance_policy.max_ratio * _nominal_segment_length));
+		int min_size = static_cast<int>(_rebalance_policy.min_ratio * _nominal_segment_length);
+		if (_rebalance_policy.mode == Rebalance::relayout)
 		{
-			raw_tour[i] = node->city;
-			if (direction == Direction::forward)
-				node = get_next(node);
-			else
-				node = get_prev(node);
+			for (auto p : _resized_parents)
+			{
+				if (p->size > max_size || p->size < min_size)
+					_unbalanced = true;
+			}
+			_resized_parents.clear();
+			// an O(n) relayout at most once every n_segments() moves keeps the amortized cost O(sqrt(n))
+			if (_unbalanced && _n_moves_since_relayout >= n_segments())
+				relayout();
+			return;
 		}
+		// local: the fix-ups may resize the neighbors, which are then appended and checked as well
+		int n_fixes = 0;
+		for (std::size_t i = 0; i < _resized_parents.size() && n_fixes < n_segments(); i++)
+		{
+			auto p = _resized_parents[i];
+			if (p->size > max_size)
+			{
+				shrink_segment(p);
+				n_fixes++;
+			}
+			else if (p->size < min_size)
+			{
+				grow_segment(p);
+				n_fixes++;
+			}
+		}
+		_n_local_rebalances += n_fixes;
+		_resized_parents.clear();
+	}
+
+	void TwoLevelTree::shrink_segment(ParentNode * p)
+	{
+		int excess = p->size - _nominal_segment_length;
+		if (excess <= 0)
+			return;
+		int to_prev = excess / 2, to_next = excess - to_prev;
+		// move the last to_next nodes in the forward direction to the next segment
+		auto s = p->forward_end_node();
+		for (int i = 1; i < to_next; i++)
+			s = get_prev(s);
+		merge_into_neighbor(s, true, Direction::forward);
+		// and the first to_prev nodes to the previous segment
+		if (to_prev > 0)
+		{
+			s = p->forward_begin_node();
+			for (int i = 1; i < to_prev; i++)
+				s = get_next(s);
+			merge_into_neighbor(s, true, Direction::backward);
+		}
+	}
+
+	void TwoLevelTree::grow_segment(ParentNode * p)
+	{
+		bool from_next = p->next->size >= p->prev->size;
+		auto neighbor = from_next ? p->next : p->prev;
+		int k = std::min(_nominal_segment_length - p->size, neighbor->size / 2);
+		if (k <= 0)
+			return;
+		if (from_next)  // the first k nodes of the next segment are merged backward into p
+		{
+			auto s = neighbor->forward_begin_node();
+			for (int i = 1; i < k; i++)
+				s = get_next(s);
+			merge_into_neighbor(s, true, Direction::backward);
+		}
+		else  // the last k nodes of the previous segment are merged forward into p
+		{
+			auto s = neighbor->forward_end_node();
+			for (int i = 1; i < k; i++)
+				s = get_prev(s);
+			merge_into_neighbor(s, true, Direction::forward);
+		}
+	}
+
+	std::vector<int> TwoLevelTree::get_raw_tour(int start_city, Direction direction) const
+	{
+		std::vector<int> raw_tour;
+		to_raw_tour(raw_tour, start_city, direction);
 		return raw_tour;
 	}
 
@@ -268,16 +1079,88 @@ namespace tsp
 	{
 		if (start_city < 0)
 			start_city = origin_city();
-		assert(start_city >= origin_city() && start_city < _nodes.size());
-		auto node = get_node(start_city);
+		assert(is_city_valid(start_city));
+		auto start = get_node(start_city);
+		auto parent = start->parent;
+		bool forward = direction == Direction::forward;
 		raw_tour.resize(_n_cities);
-		for (int i = 0; i < _n_cities; ++i)
+		// a segment is copied in its own order if the traversal goes along .next in it
+		auto out = raw_tour.begin();
+		int i = start->id - parent->segment_begin_node->id;
+		bool along = forward != parent->reverse;
+		int n_threads = bulk_threads();
+		if (n_threads > 1)
 		{
-			raw_tour[i] = node->city;
-			if (direction == Direction::forward)
-				node = get_next(node);
+			// the positions of the other segments in the raw tour are known from their sizes, so they are
+			// copied in parallel
+			std::vector<std::pair<const ParentNode*, int>> runs;
+			runs.reserve(_parent_nodes.size());
+			int offset = along ? parent->size - i : i + 1;
+			for (auto p = forward ? parent->next : parent->prev; p != parent; p = forward ? p->next : p->prev)
+			{
+				runs.emplace_back(p, offset);
+				offset += p->size;
+			}
+			parallel_for(static_cast<int>(runs.size()), n_threads, [this, &runs, &raw_tour, forward](int first, int last) {
+				for (int k = first; k < last; k++)
+				{
+					auto p = runs[k].first;
+					copy_segment(p, p->segment_begin_node, p->size, forward != p->reverse, raw_tour.begin() + runs[k].second);
+				}
+			});
+			if (along)
+			{
+				copy_segment(parent, start, parent->size - i, true, out);
+				copy_segment(parent, parent->segment_begin_node, i, true, raw_tour.begin() + offset);
+			}
 			else
-				node = get_prev(node);
+			{
+				copy_segment(parent, parent->segment_begin_node, i + 1, false, out);
+				copy_segment(parent, start->next, parent->size - i - 1, false, raw_tour.begin() + offset);
+			}
+			return;
+		}
+		if (along)
+			out = copy_segment(parent, start, parent->size - i, true, out);
+		else
+			out = copy_segment(parent, parent->segment_begin_node, i + 1, false, out);
+		for (auto p = forward ? parent->next : parent->prev; p != parent; p = forward ? p->next : p->prev)
+			out = copy_segment(p, p->segment_begin_node, p->size, forward != p->reverse, out);
+		// the remaining part of the start segment
+		if (along)
+			copy_segment(parent, parent->segment_begin_node, i, true, out);
+		else
+			copy_segment(parent, start->next, parent->size - i - 1, false, out);
+	}
+
+	std::vector<int>::iterator TwoLevelTree::copy_segment(const ParentNode * p, const Node * first, int count, 
+		bool along, std::vector<int>::iterator out) const
+	{
+		auto index = p - _parent_nodes.data();
+		if (count == 0)
+			return out;
+		if (_segment_cache_valid[index])
+		{
+			auto begin = _segment_cities[index].begin() + (first->id - p->segment_begin_node->id);
+			return along ? std::copy(begin, begin + count, out) : std::reverse_copy(begin, begin + count, out);
+		}
+		auto node = first;
+		for (int j = 0; j < count; j++, node = node->next)
+			out[along ? j : count - 1 - j] = node->city;
+		return out + count;
+	}
+
+	void TwoLevelTree::update_segment_cache()
+	{
+		for (std::size_t index = 0; index < _parent_nodes.size(); index++)
+		{
+			if (_segment_cache_valid[index])
+				continue;
+			auto p = &_parent_nodes[index];
+			auto& cities = _segment_cities[index];
+			cities.resize(p->size);
+			copy_segment(p, p->segment_begin_node, p->size, true, cities.begin());
+			_segment_cache_valid[index] = true;
 		}
 	}
 
@@ -296,16 +1179,102 @@ namespace tsp
 			} while (p != start_parent);
 			return ans;
 		}
-		else
+		else
+		{
+			std::vector<int> ans(_parent_nodes.size());
+			for (std::size_t i = 0; i < _parent_nodes.size(); i++)
+			{
+				ans[i] = _parent_nodes[i].size;
+			}
+			return ans;
+		}
+		
+	}
+
+	SegmentPolicy TwoLevelTree::tune_segment_policy(const std::vector<int>& order, 
+		const std::vector<std::pair<int, int>>& moves, std::vector<int> lengths)
+	{
+		int n_cities = static_cast<int>(order.size());
+		auto range = std::minmax_element(order.begin(), order.end());
+		int origin_city = *range.first;
+		// the ids of a partition of a larger instance are usually not consecutive
+		bool consecutive = *range.second - *range.first + 1 == n_cities;
+		if (lengths.empty())
+		{
+			int root = static_cast<int>(std::sqrt(n_cities));
+			for (int k : { root / 4, root / 2, root, root * 2, root * 4 })
+			{
+				if (k > 0)
+					lengths.push_back(k);
+			}
+		}
+		SegmentPolicy best;
+		auto best_time = std::chrono::steady_clock::duration::max();
+		for (int length : lengths)
 		{
-			std::vector<int> ans(_parent_nodes.size());
-			for (std::size_t i = 0; i < _parent_nodes.size(); i++)
+			SegmentPolicy policy;
+			policy.nominal_length = length;
+			TwoLevelTree tree = consecutive ? TwoLevelTree{ n_cities, origin_city, policy } : TwoLevelTree{ order, policy };
+			tree.set_raw_tour(order);
+			auto start = std::chrono::steady_clock::now();
+			for (const auto& move : moves)
 			{
-				ans[i] = _parent_nodes[i].size;
+				int a = move.first, c = move.second;
+				int b = tree.get_next(a), d = tree.get_next(c);
+				if (a != c && b != c && d != a)
+					tree.flip(a, b, c, d);
+			}
+			auto time = std::chrono::steady_clock::now() - start;
+			if (time < best_time)
+			{
+				best_time = time;
+				best = policy;
 			}
-			return ans;
 		}
-		
+		return best;
+	}
+
+	bool TwoLevelTree::stats_enabled()
+	{
+#ifdef TSP_TWO_LEVEL_TREE_STATS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	std::vector<int> TwoLevelTree::segment_size_histogram(int bin_width) const
+	{
+		if (bin_width <= 0)
+			bin_width = std::max(1, _nominal_segment_length / 4);
+		std::vector<int> histogram;
+		for (auto size : actual_segment_sizes())
+		{
+			std::size_t bin = size / bin_width;
+			if (bin >= histogram.size())
+				histogram.resize(bin + 1);
+			histogram[bin]++;
+		}
+		return histogram;
+	}
+
+	void TwoLevelTree::write_stats(std::ostream & os) const
+	{
+		os << "{\"n_partial_segment_reversals\": " << _stats.n_partial_segment_reversals
+			<< ", \"n_complete_segment_reversals\": " << _stats.n_complete_segment_reversals
+			<< ", \"n_multi_segment_reversals\": " << _stats.n_multi_segment_reversals
+			<< ", \"n_split_and_merges\": " << _stats.n_split_and_merges
+			<< ", \"n_nodes_moved\": " << _stats.n_nodes_moved
+			<< ", \"n_nodes_relabeled\": " << _stats.n_nodes_relabeled
+			<< ", \"n_parents_relinked\": " << _stats.n_parents_relinked
+			<< ", \"n_or_moves\": " << _stats.n_or_moves
+			<< ", \"nominal_segment_length\": " << _nominal_segment_length;
+		int bin_width = std::max(1, _nominal_segment_length / 4);
+		os << ", \"histogram_bin_width\": " << bin_width << ", \"segment_size_histogram\": [";
+		auto histogram = segment_size_histogram(bin_width);
+		for (std::size_t i = 0; i < histogram.size(); i++)
+			os << (i > 0 ? ", " : "") << histogram[i];
+		os << "]}";
 	}
 
 	bool TwoLevelTree::is_approximately_shorter(Node * a, Node * b, Node * c, Node * d) const
@@ -358,6 +1327,65 @@ namespace tsp
 		return get_next(a) == b || get_prev(a) == b;
 	}
 
+	void TwoLevelTree::diff_edges(const TwoLevelTree & other, std::vector<std::pair<int, int>>& differing, 
+		std::vector<std::pair<int, int>>* common) const
+	{
+		differing.clear();
+		if (common)
+			common->clear();
+		compare_edges(other, &differing, common);
+	}
+
+	int TwoLevelTree::count_common_edges(const TwoLevelTree & other) const
+	{
+		return compare_edges(other, nullptr, nullptr);
+	}
+
+	int TwoLevelTree::compare_edges(const TwoLevelTree & other, std::vector<std::pair<int, int>>* differing, 
+		std::vector<std::pair<int, int>>* common) const
+	{
+		assert(other._n_cities == _n_cities && other._origin_city == _origin_city);
+		// with the same storage order, the nodes of a city are at the same slot of both arrays, and the
+		// neighbors can be compared by their slots without dereferencing them
+		bool same_slots = _city_slots == other._city_slots && _id_slots == other._id_slots;
+		auto base = _nodes.data(), other_base = other._nodes.data();
+		int n_common = 0;
+		if (same_slots && !differing && !common && _n_cities > 2)
+		{
+			// branch-free count: each common edge matches a link at both of its endpoints
+			for (int slot = 0; slot < _n_cities; slot++)
+			{
+				auto a = base[slot].prev - base, b = base[slot].next - base;
+				auto c = other_base[slot].prev - other_base, d = other_base[slot].next - other_base;
+				n_common += (a == c) + (a == d) + (b == c) + (b == d);
+			}
+			return n_common / 2;
+		}
+		for (int slot = 0; slot < _n_cities; slot++)
+		{
+			auto u = base + slot;
+			auto v = same_slots ? other_base + slot : other.get_node(u->city);
+			// the two links are the same if n = 2
+			const Node* links[] = { u->prev, u->next };
+			for (int k = u->prev == u->next ? 1 : 0; k < 2; k++)
+			{
+				// each edge once from its endpoint in the lower slot
+				auto x = links[k];
+				if (x < u)
+					continue;
+				bool shared = same_slots 
+					? v->prev - other_base == x - base || v->next - other_base == x - base
+					: v->prev->city == x->city || v->next->city == x->city;
+				if (shared)
+					n_common++;
+				auto out = shared ? common : differing;
+				if (out)
+					out->emplace_back(std::min(u->city, x->city), std::max(u->city, x->city));
+			}
+		}
+		return n_common;
+	}
+
 	std::pair<int, int> TwoLevelTree::turn_forward(int city1, int city2) const
 	{
 		assert(get_next(city1) == city2 || get_prev(city1) == city2);
@@ -377,15 +1405,162 @@ namespace tsp
 		return false;
 	}
 
-	int TwoLevelTree::forward_distance(const Node * a, const Node * b) const
+	void TwoLevelTree::update_positions()
 	{
-		int count = 1;
-		while (a != b)
+		if (_parent_offsets_valid)
+			return;
+		_parent_offsets.resize(_parent_nodes.size());
+		int offset = 0;
+		auto p = head_parent_node();
+		do
+		{
+			_parent_offsets[p - _parent_nodes.data()] = offset;
+			offset += p->size;
+			p = p->next;
+		} while (p != head_parent_node());
+		_parent_offsets_valid = true;
+	}
+
+	int TwoLevelTree::tour_index(const Node * a) const
+	{
+		assert(_parent_offsets_valid);  // update_positions should be called after an or_move
+		auto p = a->parent;
+		int index_in_segment = p->reverse ? p->segment_end_node->id - a->id : a->id - p->segment_begin_node->id;
+		return _parent_offsets[p - _parent_nodes.data()] + index_in_segment;
+	}
+
+	std::uint64_t TwoLevelTree::tour_order_key(const Node * start, const Node * a) const
+	{
+		auto p = a->parent, ps = start->parent;
+		int n_parents = static_cast<int>(_parent_nodes.size());
+		// the parent ids increase cyclically along the forward tour
+		int segment = p->id - ps->id;
+		if (segment < 0)
+			segment += n_parents;
+		// the ids (negated in a reversed segment) already increase forward, so the nodes at the ends of the
+		// segment are not read
+		int rank = p->reverse ? -a->id : a->id;
+		if (p == ps && rank < (p->reverse ? -start->id : start->id))
+			segment = n_parents;
+		// flipping the sign bit orders the signed ranks as unsigned numbers
+		return (static_cast<std::uint64_t>(segment) << 32) | (static_cast<std::uint32_t>(rank) ^ 0x80000000u);
+	}
+
+	void TwoLevelTree::update_parent_offset(const ParentNode * p, const ParentNode * q)
+	{
+		if (_parent_offsets_valid)
+			_parent_offsets[q - _parent_nodes.data()] = (_parent_offsets[p - _parent_nodes.data()] + p->size) % _n_cities;
+	}
+
+	void TwoLevelTree::shift_parent_offset(const ParentNode * p, int delta)
+	{
+		if (_parent_offsets_valid)
+		{
+			auto& offset = _parent_offsets[p - _parent_nodes.data()];
+			offset = (offset + delta + _n_cities) % _n_cities;
+		}
+	}
+
+	int TwoLevelTree::position(const Node * a) const
+	{
+		return path_length(get_node(_origin_city), a) - 1;
+	}
+
+	int TwoLevelTree::position(int city) const
+	{
+		return position(get_node(city));
+	}
+
+	int TwoLevelTree::path_length(const Node * a, const Node * b) const
+	{
+		int length = (tour_index(b) - tour_index(a)) % _n_cities;
+		return (length < 0 ? length + _n_cities : length) + 1;
+	}
+
+	int TwoLevelTree::path_length(int a, int b) const
+	{
+		return path_length(get_node(a), get_node(b));
+	}
+
+	void TwoLevelTree::set_distance(std::function<double(int, int)> distance)
+	{
+		assert(!_in_transaction);
+		_distance = std::move(distance);
+		reset_costs();
+	}
+
+	void TwoLevelTree::reset_costs()
+	{
+		if (!_distance)
+		{
+			std::vector<double>().swap(_segment_costs);
+			_tour_length = 0;
+			return;
+		}
+		_segment_costs.assign(_parent_nodes.size(), 0);
+		_tour_length = 0;
+		// no tour has been specified yet
+		if (_parent_nodes.empty() || !_parent_nodes.front().segment_begin_node)
+			return;
+		for (std::size_t i = 0; i < _parent_nodes.size(); i++)
+			_segment_costs[i] = compute_segment_cost(&_parent_nodes[i]);
+		sum_tour_length();
+	}
+
+	double TwoLevelTree::compute_segment_cost(const ParentNode * p) const
+	{
+		double cost = 0;
+		for (auto node = p->segment_begin_node; node != p->segment_end_node; node = node->next)
+			cost += distance(node, node->next);
+		return cost;
+	}
+
+	void TwoLevelTree::sum_tour_length()
+	{
+		double length = 0;
+		for (auto& p : _parent_nodes)
+		{
+			auto last = p.forward_end_node();
+			length += _segment_costs[&p - _parent_nodes.data()] + distance(last, get_next(last));
+		}
+		_tour_length = length;
+	}
+
+	double TwoLevelTree::path_cost(const Node * a, const Node * b) const
+	{
+		assert(_distance);
+		double cost = 0;
+		auto x = a;
+		auto walk_to = [this, &cost, &x](const Node* y) {
+			while (x != y)
+			{
+				auto next = get_next(x);
+				cost += distance(x, next);
+				x = next;
+			}
+		};
+		if (a != b && !is_path_in_single_segment(a, b))
 		{
-			count++;
-			a = get_next(a);
+			// the rest of the segment of a, the complete segments in between and the head of the segment of b
+			auto p = a->parent;
+			walk_to(p->forward_end_node());
+			for (p = p->next; p != b->parent; p = p->next)
+			{
+				auto first = p->forward_begin_node();
+				cost += distance(x, first) + _segment_costs[p - _parent_nodes.data()];
+				x = p->forward_end_node();
+			}
+			auto first = p->forward_begin_node();
+			cost += distance(x, first);
+			x = first;
 		}
-		return count;
+		walk_to(b);
+		return cost;
+	}
+
+	double TwoLevelTree::path_cost(int a, int b) const
+	{
+		return path_cost(get_node(a), get_node(b));
 	}
 
 	void TwoLevelTree::reverse_segment(Node * a, Node * b)
@@ -401,15 +1576,15 @@ namespace tsp
 		else  // only a part of the segment
 		{
 			auto path_length = std::abs(a->id - b->id) + 1;  // IDs are consecutive
-			if (path_length <= _nominal_segment_length * 3 / 4)
+			if (path_length <= _max_partial_reverse_length)
 			{
 				reverse_partial_segment(a, b);
 			}
 			else  // split at a and b and merge with their neighbors
 			{
 				// leave a and b in the original segment to make a complete segment for reversion
-				split_and_merge(a, false, Direction::backward);
-				split_and_merge(b, false, Direction::forward);
+				merge_into_neighbor(a, false, Direction::backward);
+				merge_into_neighbor(b, false, Direction::forward);
 				reverse_complete_segment(a, b);
 			}
 		}
@@ -426,6 +1601,10 @@ namespace tsp
 		//auto prev_a = get_prev(a), next_b = get_next(b);
 		auto prev_a = a->parent->prev->forward_end_node();
 		auto next_b = b->parent->next->forward_begin_node();
+		for (auto node : { prev_a, a, next_b, b })
+			touch(node);
+		touch(parent);
+		TSP_COUNT(n_complete_segment_reversals, 1);
 		parent->reverse = !parent->reverse;
 		// repair the 4 connections to the neighbor segments
 		// pre_a now should go to b
@@ -457,6 +1636,23 @@ namespace tsp
 		// we need change the connections and the IDs, and possibly the segment endpoints
 		auto prev_a = get_prev(a), next_b = get_next(b);
 		auto partial_segment_length = std::abs(a->id - b->id) + 1;
+		touch(parent);
+		// only the two end edges change, if they are internal
+		if (_distance)
+		{
+			add_edge_cost(prev_a, a, -1);
+			add_edge_cost(b, next_b, -1);
+			add_edge_cost(prev_a, b);
+			add_edge_cost(a, next_b);
+		}
+		TSP_COUNT(n_partial_segment_reversals, 1);
+		// the cache can be patched in place, since the path occupies the same IDs after reversal
+		auto index = parent - _parent_nodes.data();
+		if (_segment_cache_valid[index])
+		{
+			auto first = _segment_cities[index].begin() + (std::min(a->id, b->id) - parent->segment_begin_node->id);
+			std::reverse(first, first + partial_segment_length);
+		}
 		// first store a and the internal nodes between a and b
 		_temp_nodes.clear();
 		_temp_nodes.reserve(partial_segment_length + 1);
@@ -514,6 +1710,8 @@ namespace tsp
 
 	void TwoLevelTree::connect_arc_forward(Node * p, Node * q)
 	{
+		touch(p);
+		touch(q);
 		if (p->parent->reverse)
 			p->prev = q;
 		else
@@ -528,16 +1726,36 @@ namespace tsp
 	void TwoLevelTree::relabel_id(Node * a, Node * b, int a_id)
 	{
 		assert(a->parent == b->parent);
+		touch(a);
 		a->id = a_id;
+		TSP_COUNT(n_nodes_relabeled, 1);
 		while (a != b)
 		{
+			touch(a->next);
 			a->next->id = a->id + 1;
+			TSP_COUNT(n_nodes_relabeled, 1);
 			a = a->next;
 		}
 	}
 
+	std::size_t TwoLevelTree::find_id_entry(int city) const
+	{
+		std::size_t mask = _id_slots.size() - 1;
+		std::size_t i = (static_cast<std::uint32_t>(city) * 2654435769u) >> _id_shift;
+		while (_id_slots[i].first != city && _id_slots[i].first >= 0)
+			i = (i + 1) & mask;
+		return i;
+	}
+
+	TSP_NOINLINE int TwoLevelTree::id_slot(int city) const
+	{
+		return _id_slots[find_id_entry(city)].second;
+	}
+
 	bool TwoLevelTree::is_city_valid(int city) const
 	{
+		if (!_id_slots.empty())
+			return city >= 0 && _id_slots[find_id_entry(city)].first == city;
 		return city >= _origin_city && city < _origin_city + _n_cities;
 	}
 
@@ -553,12 +1771,12 @@ namespace tsp
 			if (b_half_length < parent->size / 2)
 			{
 				// move the half containing b
-				split_and_merge(b, true, Direction::forward);
+				merge_into_neighbor(b, true, Direction::forward);
 			}
 			else
 			{
 				// move the half containing a
-				split_and_merge(a, true, Direction::backward);
+				merge_into_neighbor(a, true, Direction::backward);
 			}
 		}
 		// now it should be like [......a] -> [b.....] (forward)
@@ -567,6 +1785,8 @@ namespace tsp
 		assert(b == b->parent->forward_begin_node());
 
 		// remove the links between a and b
+		touch(a);
+		touch(b);
 		if (a->next == b)
 			a->next = nullptr;
 		else
@@ -613,29 +1833,49 @@ namespace tsp
 
 	void TwoLevelTree::double_bridge_move(Node * a, Node * b, Node * c, Node * d)
 	{
+		WriteScope scope{ this };
 		assert(is_between(a, b, c));
 		assert(is_between(b, c, d));
 		assert(is_between(c, d, a));
 		assert(is_between(d, a, b));
-		assert(a->parent != b->parent);
-		assert(a->parent != c->parent);
-		assert(a->parent != d->parent);
-		assert(b->parent != c->parent);
-		assert(b->parent != d->parent);
-		assert(c->parent != d->parent);
+		if (_move_log)
+			_move_log->record(MoveLog::Move::double_bridge, a->city, b->city, c->city, d->city);
 		auto an = get_next(a), bn = get_next(b), cn = get_next(c), dn = get_next(d);
+		if (_track_changes)
+		{
+			for (auto p : { a, an, b, bn, c, cn, d, dn })
+				record_change(p);
+		}
+		if (_distance)
+		{
+			_tour_length += distance(a, cn) + distance(d, bn) + distance(c, an) + distance(b, dn)
+				- distance(a, an) - distance(b, bn) - distance(c, cn) - distance(d, dn);
+		}
+		// the four arcs can be made segment boundaries by split-and-merge independently, unless a segment
+		// containing an arc inside it also contains another one of the arcs
+		bool splittable = true;
+		for (auto p : { a, b, c, d })
+		{
+			if (p == p->parent->forward_end_node())
+				continue;
+			for (auto q : { a, b, c, d })
+				splittable = splittable && (q == p || q->parent != p->parent);
+		}
+		if (!splittable)
+		{
+			// [an..b] [bn..c] [cn..d] -> [cn..d] [bn..c] [an..b] by four exact reversals
+			reverse_path(an, d);
+			reverse_path(d, cn);
+			reverse_path(c, bn);
+			reverse_path(b, an);
+			apply_rebalance_policy();
+			return;
+		}
 		// (1) split and merge to make all the above segment boundaries
-		auto sam = [this](Node* p) {  
-			// special case: p and pn are already boundary nodes, i.e., [.....p] -> [pn....]
-			if (p->parent == get_next(p)->parent)
-			{
-				split_and_merge(p, false, Direction::forward);
-			}
-		};
-
 		for (auto p : { a, b, c, d })
 		{
-			sam(p);
+			if (p != p->parent->forward_end_node())
+				merge_into_neighbor(p, false, Direction::forward);
 			
 #ifndef NDEBUG
 			assert((p == p->parent->segment_begin_node || p == p->parent->segment_end_node));
@@ -645,8 +1885,24 @@ namespace tsp
 #endif
 		}
 		
+		// the four parts in their new order, each as the first and the last parent. The IDs of the
+		// part with the most segments are kept, and only the others are renumbered afterwards.
+		const int n_parents = n_segments();
+		ParentNode* parts[][2] = { { dn->parent, a->parent }, { cn->parent, d->parent },
+			{ bn->parent, c->parent }, { an->parent, b->parent } };
+		auto count_parents = [n_parents](ParentNode* const* part) {
+			return (part[1]->id - part[0]->id + n_parents) % n_parents + 1;
+		};
+		auto kept = std::max_element(std::begin(parts), std::end(parts),
+			[&count_parents](ParentNode* const* x, ParentNode* const* y) { return count_parents(x) < count_parents(y); });
+		ParentNode* kept_first = (*kept)[0];
+		ParentNode* kept_last = (*kept)[1];
+
 		// (2) reconnect. Note that p and q are both segment boundary nodes.
 		auto connect_forward = [this](Node* p, Node* q) {
+			touch(p->parent);
+			touch(q->parent);
+			TSP_COUNT(n_parents_relinked, 1);
 			connect_arc_forward(p, q);
 			p->parent->next = q->parent;
 			q->parent->prev = p->parent;
@@ -657,17 +1913,15 @@ namespace tsp
 		connect_forward(c, an);
 		connect_forward(b, dn);
 		
-		
 		// (3) each segment itself is not changed due to reconnection
-		// However, the order of the segments is changed and re-id is needed
-		auto p = head_parent_node();
-		int id = 0;
-		do
+		// However, the order of the segments is changed and re-id is needed for the parts not kept
+		for (auto p = kept_last; p->next != kept_first; p = p->next)
 		{
-			p->id = id;
-			id++;
-			p = p->next;
-		} while (p != head_parent_node());
+			touch(p->next);
+			p->next->id = (p->id + 1) % n_parents;
+			update_parent_offset(p, p->next);
+		}
+		apply_rebalance_policy();
 	}
 
 	void TwoLevelTree::double_bridge_move(int a, int b, int c, int d)
@@ -675,7 +1929,378 @@ namespace tsp
 		double_bridge_move(get_node(a), get_node(b), get_node(c), get_node(d));
 	}
 
+	void TwoLevelTree::random_double_bridges(int n_kicks, std::mt19937 & rng, int window, std::vector<int>* endpoints)
+	{
+		if (_n_cities < 8)
+			return;
+		window = window > 0 ? std::min(std::max(window, 4), _n_cities) : 0;
+		std::uniform_int_distribution<int> city_dist{ 0, _n_cities - 1 };
+		std::uniform_int_distribution<int> offset_dist{ 1, std::max(window, 4) - 1 };
+		Node* x[4];
+		for (int k = 0; k < n_kicks; k++)
+		{
+			if (window > 0)
+			{
+				// three distinct offsets from a random city along the forward tour
+				int offsets[3];
+				do
+				{
+					for (auto& offset : offsets)
+						offset = offset_dist(rng);
+				} while (offsets[0] == offsets[1] || offsets[1] == offsets[2] || offsets[0] == offsets[2]);
+				std::sort(std::begin(offsets), std::end(offsets));
+				x[0] = get_node(city_at(city_dist(rng)));
+				auto p = x[0];
+				for (int i = 0, step = 0; i < 3; i++)
+				{
+					for (; step < offsets[i]; step++)
+						p = get_next(p);
+					x[i + 1] = p;
+				}
+			}
+			else
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					x[i] = get_node(city_at(city_dist(rng)));
+					if (std::find(x, x + i, x[i]) != x + i)
+						i--;
+				}
+				// sort the last three in the forward order starting from the first one
+				auto a = x[0];
+				std::sort(x + 1, x + 4, [this, a](Node* u, Node* v) { return u != v && is_between(a, u, v); });
+			}
+			if (endpoints)
+			{
+				for (auto p : x)
+				{
+					endpoints->push_back(p->city);
+					endpoints->push_back(get_next(p)->city);
+				}
+			}
+			double_bridge_move(x[0], x[1], x[2], x[3]);
+		}
+	}
+
+	void TwoLevelTree::or_move(Node * s1, Node * s2, Node * p, bool reversed)
+	{
+		WriteScope scope{ this };
+		auto sp = get_prev(s1), sn = get_next(s2);
+		assert(p != s1 && p != s2 && (s1 == s2 || !is_between(s1, p, s2)));  // p is not in the chain
+		if (p == sp)  // the chain stays in place
+		{
+			if (reversed)
+				reverse(s1, s2);
+			return;
+		}
+		if (_move_log)
+			_move_log->record(MoveLog::Move::or_move, s1->city, s2->city, p->city, reversed ? 1 : 0);
+		if (_track_changes)
+		{
+			for (auto q : { sp, s1, s2, sn, p, get_next(p) })
+				record_change(q);
+		}
+		if (_distance)
+		{
+			auto pn = get_next(p), first = reversed ? s2 : s1, last = reversed ? s1 : s2;
+			_tour_length += distance(sp, sn) + distance(p, first) + distance(last, pn)
+				- distance(sp, s1) - distance(s2, sn) - distance(p, pn);
+		}
+		_temp_nodes.clear();
+		for (auto x = s1; ; x = get_next(x))
+		{
+			_temp_nodes.push_back(x);
+			if (x == s2)
+				break;
+		}
+		int k = static_cast<int>(_temp_nodes.size());
+		// the chain is cut into runs by the segments. Each run must leave a non-empty segment behind,
+		// and a segment cannot hold both ends of the chain, which happens if it wraps around the tour.
+		bool splicable = true;
+		for (int i = 0, j = 0; i < k && splicable; i = j)
+		{
+			auto parent = _temp_nodes[i]->parent;
+			while (j < k && _temp_nodes[j]->parent == parent)
+				j++;
+			splicable = j - i < parent->size && (i == 0 || j < k || parent != s1->parent);
+		}
+		if (!splicable)
+		{
+			// fall back to three reversals: [s1..s2][sn..p] -> [sn..p][s1..s2]
+			reverse_path(s1, p);
+			reverse_path(p, sn);
+			if (!reversed)
+				reverse_path(s2, s1);
+			apply_rebalance_policy();
+			return;
+		}
+		TSP_COUNT(n_or_moves, 1);
+		// the internal edges of the chain leave their segments and join the segment of p
+		if (_distance)
+		{
+			add_edge_cost(sp, s1, -1);
+			add_edge_cost(s2, sn, -1);
+			add_edge_cost(p, get_next(p), -1);
+			for (int i = 1; i < k; i++)
+				add_edge_cost(_temp_nodes[i - 1], _temp_nodes[i], -1);
+		}
+		// (1) detach the runs from their segments
+		for (int i = 0; i < k; )
+		{
+			auto parent = _temp_nodes[i]->parent;
+			int j = i;
+			while (j + 1 < k && _temp_nodes[j + 1]->parent == parent)
+				j++;
+			auto first = _temp_nodes[i], last = _temp_nodes[j];
+			int m = j - i + 1;
+			touch(parent);
+			invalidate_segment_cache(parent);
+			auto& forward_begin = parent->reverse ? parent->segment_end_node : parent->segment_begin_node;
+			auto& forward_end = parent->reverse ? parent->segment_begin_node : parent->segment_end_node;
+			if (first == forward_begin)
+				forward_begin = get_next(last);
+			else if (last == forward_end)
+				forward_end = get_prev(first);
+			else
+			{
+				// close the ID gap by shifting the shorter side. Note ID is numbered according to node.next.
+				auto low = parent->reverse ? get_next(last) : get_prev(first);
+				auto high = parent->reverse ? get_prev(first) : get_next(last);
+				if (parent->segment_end_node->id - high->id <= low->id - parent->segment_begin_node->id)
+					relabel_id(high, parent->segment_end_node, high->id - m);
+				else
+					relabel_id(parent->segment_begin_node, low, parent->segment_begin_node->id + m);
+			}
+			parent->size -= m;
+			if (_rebalance_policy.mode != Rebalance::implicit)
+				_resized_parents.push_back(parent);
+			i = j + 1;
+		}
+		connect_arc_forward(sp, sn);
+
+		// (2) insert the chain between p and its current forward neighbor in the segment of p
+		auto pn = get_next(p);
+		auto parent = p->parent;
+		touch(parent);
+		invalidate_segment_cache(parent);
+		if (pn->parent == parent)
+		{
+			// make room for k IDs by shifting the shorter side
+			auto low = parent->reverse ? pn : p;
+			auto high = parent->reverse ? p : pn;
+			if (parent->segment_end_node->id - high->id <= low->id - parent->segment_begin_node->id)
+				relabel_id(high, parent->segment_end_node, high->id + k);
+			else
+				relabel_id(parent->segment_begin_node, low, parent->segment_begin_node->id - k);
+		}
+		else if (parent->reverse)
+			parent->segment_begin_node = reversed ? s1 : s2;
+		else
+			parent->segment_end_node = reversed ? s1 : s2;
+		int delta_id = parent->reverse ? -1 : 1;
+		auto q = p;
+		for (int i = 0; i < k; i++)
+		{
+			auto x = reversed ? _temp_nodes[k - 1 - i] : _temp_nodes[i];
+			touch(x);
+			x->parent = parent;
+			x->id = q->id + delta_id;
+			connect_arc_forward(q, x);
+			q = x;
+		}
+		connect_arc_forward(q, pn);
+		parent->size += k;
+		if (_distance)
+		{
+			add_edge_cost(sp, sn);
+			add_edge_cost(p, reversed ? s2 : s1);
+			add_edge_cost(q, pn);
+			for (int i = 1; i < k; i++)
+				add_edge_cost(_temp_nodes[i - 1], _temp_nodes[i]);
+		}
+		_parent_offsets_valid = false;
+		if (_rebalance_policy.mode != Rebalance::implicit)
+			_resized_parents.push_back(parent);
+		apply_rebalance_policy();
+	}
+
+	void TwoLevelTree::or_move(int s1, int s2, int p, bool reversed)
+	{
+		or_move(get_node(s1), get_node(s2), get_node(p), reversed);
+	}
+
+	void TwoLevelTree::enable_concurrent_reads(bool enabled)
+	{
+		_concurrent_reads = enabled;
+		reset_versions();
+	}
+
+	void TwoLevelTree::reset_versions()
+	{
+		_written_parents.clear();
+		if (!_concurrent_reads)
+		{
+			_versions.reset();
+			return;
+		}
+		std::size_t n = _parent_nodes.size() + 1;
+		_versions.reset(new std::atomic<unsigned>[n]);
+		for (std::size_t i = 0; i < n; i++)
+			_versions[i].store(0, std::memory_order_relaxed);
+	}
+
+	void TwoLevelTree::begin_write_all()
+	{
+		auto& version = _versions[_parent_nodes.size()];
+		unsigned v = version.load(std::memory_order_relaxed);
+		if (v & 1)
+			return;
+		version.store(v + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void TwoLevelTree::publish_writes()
+	{
+		for (auto p : _written_parents)
+		{
+			auto& version = _versions[p - _parent_nodes.data()];
+			version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+		_written_parents.clear();
+		auto& version = _versions[_parent_nodes.size()];
+		unsigned v = version.load(std::memory_order_relaxed);
+		if (v & 1)
+			version.store(v + 1, std::memory_order_release);
+	}
+
+	bool TwoLevelTree::begin_read(const Node * const * nodes, int k, ReadState & state) const
+	{
+		state.tree_version = _versions[_parent_nodes.size()].load(std::memory_order_acquire);
+		if (state.tree_version & 1)
+			return false;
+		state.n_parents = k;
+		for (int i = 0; i < k; i++)
+		{
+			state.parents[i] = nodes[i]->parent;
+			state.versions[i] = _versions[state.parents[i] - _parent_nodes.data()].load(std::memory_order_acquire);
+			if (state.versions[i] & 1)
+				return false;
+		}
+		// a node may have been moved to another segment just before the version of its old one was read
+		for (int i = 0; i < k; i++)
+		{
+			if (nodes[i]->parent != state.parents[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool TwoLevelTree::end_read(const ReadState & state) const
+	{
+		// the above reads of the nodes cannot be moved after the versions are checked again
+		std::atomic_thread_fence(std::memory_order_acquire);
+		for (int i = 0; i < state.n_parents; i++)
+		{
+			if (_versions[state.parents[i] - _parent_nodes.data()].load(std::memory_order_relaxed) != state.versions[i])
+				return false;
+		}
+		return _versions[_parent_nodes.size()].load(std::memory_order_relaxed) == state.tree_version;
+	}
+
+	int TwoLevelTree::concurrent_get_next(int city) const
+	{
+		assert(_concurrent_reads);
+		const Node* node = get_node(city);
+		ReadState state;
+		for (;;)
+		{
+			if (!begin_read(&node, 1, state))
+				continue;
+			int next = get_next(node)->city;
+			if (end_read(state))
+				return next;
+		}
+	}
+
+	int TwoLevelTree::concurrent_get_prev(int city) const
+	{
+		assert(_concurrent_reads);
+		const Node* node = get_node(city);
+		ReadState state;
+		for (;;)
+		{
+			if (!begin_read(&node, 1, state))
+				continue;
+			int prev = get_prev(node)->city;
+			if (end_read(state))
+				return prev;
+		}
+	}
+
+	bool TwoLevelTree::concurrent_is_between(int a, int b, int c) const
+	{
+		assert(_concurrent_reads);
+		const Node* nodes[] = { get_node(a), get_node(b), get_node(c) };
+		ReadState state;
+		for (;;)
+		{
+			if (!begin_read(nodes, 3, state))
+				continue;
+			bool between = is_between(nodes[0], nodes[1], nodes[2]);
+			if (end_read(state))
+				return between;
+		}
+	}
+
+	std::size_t TwoLevelTree::apply_log(const MoveLog & log, std::size_t begin, std::size_t end)
+	{
+		auto& data = log.data();
+		std::size_t i = begin;
+		while (i < std::min(end, data.size()))
+		{
+			auto move = static_cast<MoveLog::Move>(data[i]);
+			auto args = data.data() + i + 1;
+			int n_args = MoveLog::n_arguments(move);
+			// the fourth argument of an or-move is the reversed flag
+			int n_cities = move == MoveLog::Move::or_move ? 3 : n_args;
+			if (!std::all_of(args, args + n_cities, [this](std::int32_t city) { return is_city_valid(city); }))
+				break;
+			switch (move)
+			{
+			case MoveLog::Move::reverse:
+				reverse(args[0], args[1]);
+				break;
+			case MoveLog::Move::double_bridge:
+				double_bridge_move(args[0], args[1], args[2], args[3]);
+				break;
+			case MoveLog::Move::or_move:
+				or_move(args[0], args[1], args[2], args[3] != 0);
+				break;
+			case MoveLog::Move::rebalance:
+				rebalance();
+				break;
+			case MoveLog::Move::begin_transaction:
+				begin_transaction();
+				break;
+			case MoveLog::Move::commit:
+				commit();
+				break;
+			case MoveLog::Move::rollback:
+				rollback();
+				break;
+			}
+			i += 1 + n_args;
+		}
+		return i;
+	}
+
 	void TwoLevelTree::split_and_merge(Node * s, bool include_self, Direction direction)
+	{
+		WriteScope scope{ this };
+		merge_into_neighbor(s, include_self, direction);
+	}
+
+	void TwoLevelTree::merge_into_neighbor(Node * s, bool include_self, Direction direction)
 	{
 		auto parent = s->parent;
 		ParentNode* neighbor_parent = direction == Direction::forward ? parent->next : parent->prev;
@@ -709,9 +2334,36 @@ namespace tsp
 			return;
 
 		Node* q = nullptr; // the node of neighbor segment to be connected to _temp_vector
+		touch(parent);
+		touch(neighbor_parent);
+		TSP_COUNT(n_split_and_merges, 1);
+		TSP_COUNT(n_nodes_moved, _temp_nodes.size());
 		neighbor_parent->size += (int)_temp_nodes.size();
 		parent->size -= (int)_temp_nodes.size();
+		// only the segment behind the boundary moves in the tour
+		if (direction == Direction::forward)
+			shift_parent_offset(neighbor_parent, -(int)_temp_nodes.size());
+		else
+			shift_parent_offset(parent, (int)_temp_nodes.size());
 		assert(parent->size > 0); // we cannot leave an empty segment
+		invalidate_segment_cache(parent);
+		invalidate_segment_cache(neighbor_parent);
+		// the moved path takes its internal edges along, while the edge to the boundary becomes external
+		// and the one to the neighbor internal
+		if (_distance)
+		{
+			double moved = 0;
+			for (std::size_t i = 1; i < _temp_nodes.size(); i++)
+				moved += distance(_temp_nodes[i - 1], _temp_nodes[i]);
+			auto outer = direction == Direction::forward ? get_next(_temp_nodes.back()) : get_prev(_temp_nodes.back());
+			_segment_costs[parent - _parent_nodes.data()] -= moved + distance(boundary, _temp_nodes.front());
+			_segment_costs[neighbor_parent - _parent_nodes.data()] += moved + distance(_temp_nodes.back(), outer);
+		}
+		if (_rebalance_policy.mode != Rebalance::implicit)
+		{
+			_resized_parents.push_back(parent);
+			_resized_parents.push_back(neighbor_parent);
+		}
 		// we first merge these nodes to the neighbor
 		if (direction == Direction::forward)
 		{
@@ -721,6 +2373,7 @@ namespace tsp
 			{
 				auto p = _temp_nodes.back();
 				_temp_nodes.pop_back();
+				touch(p);
 				p->parent = neighbor_parent;
 				connect_arc_forward(p, q);
 				p->id = q->id + delta_id; // relabel the newly merged part in the neighbor segment
@@ -747,6 +2400,7 @@ namespace tsp
 			{
 				auto p = _temp_nodes.back();
 				_temp_nodes.pop_back();
+				touch(p);
 				p->parent = neighbor_parent;
 				connect_arc_forward(q, p);
 				p->id = q->id + delta_id; // relabel the newly merged part in the neighbor segment
@@ -0,0 +1,57 @@
+#include <cassert>
+#include <utility>
+#include "two_level_tree_pool.h"
+
+namespace tsp
+{
+	TwoLevelTreePool::TwoLevelTreePool(int n_cities, int origin_city, const SegmentPolicy& policy)
+		: _n_cities{ n_cities }, _origin_city{ origin_city }, _segment_policy(policy)
+	{
+		assert(n_cities > 0);
+		assert(origin_city >= 0);
+	}
+
+	void TwoLevelTreePool::reserve(int n_trees)
+	{
+		if (n_trees <= size())
+			return;
+		_free_trees.reserve(n_trees);
+		while (size() < n_trees)
+			_free_trees.emplace_back(_n_cities, _origin_city, _segment_policy);
+	}
+
+	TwoLevelTree TwoLevelTreePool::acquire()
+	{
+		if (_free_trees.empty())
+			return TwoLevelTree{ _n_cities, _origin_city, _segment_policy };
+		// moving a tree keeps its node arrays and hence all the links in place
+		TwoLevelTree tree{ std::move(_free_trees.back()) };
+		_free_trees.pop_back();
+		return tree;
+	}
+
+	TwoLevelTree TwoLevelTreePool::acquire(const std::vector<int>& order)
+	{
+		auto tree = acquire();
+		tree.set_raw_tour(order);
+		return tree;
+	}
+
+	TwoLevelTree TwoLevelTreePool::acquire(const TwoLevelTree& parent)
+	{
+		assert(parent.n_cities() == _n_cities && parent.origin_city() == _origin_city);
+		auto tree = acquire();
+		tree = parent;
+		return tree;
+	}
+
+	void TwoLevelTreePool::release(TwoLevelTree&& tree)
+	{
+		assert(tree.n_cities() == _n_cities && tree.origin_city() == _origin_city);
+		assert(!tree.in_transaction());
+		// the hooks of the last user may refer to objects that do not outlive it
+		tree.set_move_log(nullptr);
+		tree.set_distance(nullptr);
+		_free_trees.push_back(std::move(tree));
+	}
+}
@@ -0,0 +1,134 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "tour.h"
+#include "compact_two_level_tree.h"
+#include "k_level_tree.h"
+
+static_assert(tsp::is_tour<tsp::CompactTwoLevelTree>::value, "CompactTwoLevelTree");
+static_assert(tsp::is_tour<tsp::KLevelTree>::value, "KLevelTree");
+static_assert(!tsp::is_tour<std::vector<int>>::value, "std::vector");
+
+TEST_CASE("Array tour basic queries", "[array tour]")
+{
+	int n_cities = 10, origin = 1;
+	std::vector<int> order = { 3, 6, 8, 4, 1, 2, 5, 9, 10, 7 };
+	tsp::ArrayTour tour{ n_cities, origin };
+	tour.set_raw_tour(order);
+
+	REQUIRE(tour.get_raw_tour(3) == order);
+	REQUIRE(tour.get_raw_tour(7, tsp::Direction::backward) == std::vector<int>{ 7, 10, 9, 5, 2, 1, 4, 8, 6, 3 });
+	REQUIRE(tour.get_next(7) == 3);
+	REQUIRE(tour.get_prev(3) == 7);
+	REQUIRE(tour.is_between(3, 6, 8));
+	REQUIRE(tour.is_between(9, 7, 3));
+	REQUIRE(tour.is_between(2, 10, 1));
+	REQUIRE_FALSE(tour.is_between(6, 4, 8));
+	REQUIRE(tour.turn_forward(3, 7) == std::make_pair(7, 3));
+
+	tour.reverse(8, 1);
+	REQUIRE(tour.get_raw_tour(3) == std::vector<int>{ 3, 6, 1, 4, 8, 2, 5, 9, 10, 7 });
+	// wrap around the end of the array
+	tour.reverse(10, 6);
+	REQUIRE(tour.get_raw_tour(3) == std::vector<int>{ 3, 7, 10, 1, 4, 8, 2, 5, 9, 6 });
+	tour.flip(3, 7, 9, 6);
+	REQUIRE(tour.has_edge(3, 9));
+	REQUIRE(tour.has_edge(7, 6));
+	tour.set_raw_tour(order);
+	tour.double_bridge_move(3, 4, 5, 10);
+	REQUIRE(tour.get_raw_tour(6) == std::vector<int>{ 6, 8, 4, 7, 3, 9, 10, 1, 2, 5 });
+
+	SECTION("Tiny instances")
+	{
+		tsp::ArrayTour tiny{ 3 };
+		tiny.set_raw_tour({ 2, 0, 1 });
+		REQUIRE(tiny.get_next(1) == 2);
+		REQUIRE(tiny.is_between(2, 0, 1));
+		tiny.reverse(0, 1);
+		REQUIRE(tiny.get_raw_tour() == std::vector<int>{ 0, 2, 1 });
+	}
+}
+
+TEST_CASE("Array tour agrees with the two-level tree", "[array tour]")
+{
+	int n_cities = 300, origin = 4;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 5 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tsp::ArrayTour tour{ n_cities, origin };
+	tree.set_raw_tour(order);
+	tour.set_raw_tour(order);
+
+	for (int i = 0; i < 2000; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		if (i % 2 == 0)
+		{
+			// both reverse the path exactly
+			tree.reverse(a, c);
+			tour.reverse(a, c);
+		}
+		else if (a != c)
+		{
+			int b = tour.get_next(a), d = tour.get_next(c);
+			if (b == c || d == a)
+				continue;
+			tour.flip(a, b, c, d);
+			REQUIRE(tour.has_edge(a, c));
+			REQUIRE(tour.has_edge(b, d));
+			tree.set_raw_tour(tour.get_raw_tour());
+		}
+		if (i % 20 == 0)
+		{
+			REQUIRE(tour.get_raw_tour() == tree.get_raw_tour());
+			for (int k = 0; k < 20; k++)
+			{
+				int x = city_dist(rng), y = city_dist(rng), z = city_dist(rng);
+				if (x == y || y == z || x == z)
+					continue;
+				REQUIRE(tour.is_between(x, y, z) == tree.is_between(x, y, z));
+			}
+		}
+	}
+}
+
+namespace
+{
+	// a backend-agnostic visitor
+	struct ReverseAndExport
+	{
+		std::vector<int> order;
+
+		template<typename Tour>
+		std::vector<int> operator()(Tour& tour) const
+		{
+			static_assert(tsp::is_tour<Tour>::value, "a tour is expected");
+			tour.set_raw_tour(order);
+			tour.reverse(order[1], order[order.size() / 2]);
+			return tour.get_raw_tour(order[0]);
+		}
+	};
+}
+
+TEST_CASE("Select a tour backend by size", "[array tour]")
+{
+	REQUIRE(tsp::select_tour_backend(10) == tsp::TourBackend::array);
+	REQUIRE(tsp::select_tour_backend(tsp::array_tour_max_cities) == tsp::TourBackend::array);
+	REQUIRE(tsp::select_tour_backend(tsp::array_tour_max_cities + 1) == tsp::TourBackend::two_level_tree);
+
+	for (int n_cities : { 50, 3000 })
+	{
+		ReverseAndExport visitor;
+		visitor.order.resize(n_cities);
+		std::iota(visitor.order.begin(), visitor.order.end(), 0);
+		auto expected = visitor.order;
+		std::reverse(expected.begin() + 1, expected.begin() + n_cities / 2 + 1);
+		REQUIRE(tsp::with_tour_backend(n_cities, 0, visitor) == expected);
+	}
+}
@@ -0,0 +1,114 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include "two_level_tree.h"
+#include "compact_two_level_tree.h"
+
+// the index widths and a segment count fixed at compile time
+using CompactTree8 = tsp::BasicCompactTwoLevelTree<std::uint8_t>;
+using CompactTree16 = tsp::BasicCompactTwoLevelTree<std::uint16_t>;
+using CompactTree64 = tsp::BasicCompactTwoLevelTree<std::int64_t>;
+using CompactTreeFixed = tsp::BasicCompactTwoLevelTree<std::int32_t, 16>;
+
+static_assert(sizeof(CompactTree16::index_type) == 2 && std::is_signed<CompactTree16::id_type>::value, "16-bit");
+
+TEST_CASE("Compact tree basic queries", "[compact two level tree]")
+{
+	int n_cities = 10, origin = 1;
+	std::vector<int> order = { 3, 6, 8, 4, 1, 2, 5, 9, 10, 7 };
+	tsp::CompactTwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+
+	REQUIRE(tree.n_segments() == 4);
+	REQUIRE(tree.get_raw_tour(3) == order);
+	REQUIRE(tree.get_next(7) == 3);
+	REQUIRE(tree.get_prev(3) == 7);
+	REQUIRE(tree.get_next(4) == 1);
+	REQUIRE(tree.is_between(3, 6, 8));
+	REQUIRE(tree.is_between(9, 7, 3));
+	REQUIRE(tree.is_between(2, 10, 1));
+	REQUIRE_FALSE(tree.is_between(6, 4, 8));
+	REQUIRE_FALSE(tree.is_between(10, 1, 8));
+	REQUIRE(tree.has_edge(7, 3));
+	REQUIRE_FALSE(tree.has_edge(7, 6));
+	REQUIRE(tree.turn_forward(3, 7) == std::make_pair(7, 3));
+
+	tree.reverse(8, 1);
+	REQUIRE(tree.get_raw_tour(3) == std::vector<int>{ 3, 6, 1, 4, 8, 2, 5, 9, 10, 7 });
+	tree.flip(3, 6, 10, 7);
+	REQUIRE(tree.get_raw_tour(6) == std::vector<int>{ 6, 1, 4, 8, 2, 5, 9, 10, 3, 7 });
+}
+
+TEMPLATE_TEST_CASE("Compact tree agrees with the pointer-based tree", "[compact two level tree]",
+	tsp::CompactTwoLevelTree, CompactTree8, CompactTree16, CompactTree64, CompactTreeFixed)
+{
+	// 8-bit IDs drift out of their range quickly, which renumbers the segments many times
+	int n_cities = sizeof(typename TestType::index_type) == 1 ? 200 : 500, origin = 3;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 7 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	TestType compact{ n_cities, origin };
+	// the same segments, so that each flip reverses the same side
+	tsp::SegmentPolicy policy;
+	policy.n_segments = compact.n_segments();
+	tsp::TwoLevelTree tree{ n_cities, origin, policy };
+	tree.set_raw_tour(order);
+	compact.set_raw_tour(order);
+
+	for (int i = 0; i < 3000; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		if (i % 3 == 0)
+		{
+			tree.reverse(tree.get_node(a), tree.get_node(c));
+			compact.reverse(a, c);
+		}
+		else if (a != c)
+		{
+			int b = tree.get_next(a), d = tree.get_next(c);
+			if (b == c || d == a)
+				continue;
+			tree.flip(a, b, c, d);
+			compact.flip(a, b, c, d);
+		}
+		if (i % 50 == 0)
+		{
+			// a double-bridge move with the four cities in distinct segments
+			std::vector<int> cities;
+			std::vector<const tsp::ParentNode*> parents;
+			while (cities.size() < 4)
+			{
+				int x = city_dist(rng);
+				auto p = tree.get_parent_node(x);
+				if (std::find(parents.begin(), parents.end(), p) != parents.end())
+					continue;
+				cities.push_back(x);
+				parents.push_back(p);
+			}
+			int first = cities[0];
+			std::sort(cities.begin() + 1, cities.end(), [&tree, first](int x, int y) {
+				return tree.is_between(first, x, y);
+			});
+			tree.double_bridge_move(cities[0], cities[1], cities[2], cities[3]);
+			compact.double_bridge_move(cities[0], cities[1], cities[2], cities[3]);
+		}
+		REQUIRE(compact.get_raw_tour(origin) == tree.get_raw_tour(origin));
+	}
+	REQUIRE(compact.actual_segment_sizes(origin) == tree.actual_segment_sizes(origin));
+	REQUIRE(compact.get_raw_tour(origin, tsp::Direction::backward) == tree.get_raw_tour(origin, tsp::Direction::backward));
+	for (int i = 0; i < 1000; i++)
+	{
+		int a = city_dist(rng), b = city_dist(rng), c = city_dist(rng);
+		REQUIRE(compact.get_next(a) == tree.get_next(a));
+		REQUIRE(compact.get_prev(a) == tree.get_prev(a));
+		if (a != b && b != c && a != c)
+			REQUIRE(compact.is_between(a, b, c) == tree.is_between(a, b, c));
+	}
+}
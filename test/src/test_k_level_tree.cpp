@@ -0,0 +1,129 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "k_level_tree.h"
+
+// reverse the forward path a --> b in a vector tour, which is a no-op for a complete circle
+static void reverse_in_vector(std::vector<int>& tour, int a, int b)
+{
+	int n = static_cast<int>(tour.size());
+	int i = static_cast<int>(std::find(tour.begin(), tour.end(), a) - tour.begin());
+	int j = static_cast<int>(std::find(tour.begin(), tour.end(), b) - tour.begin());
+	int length = (j - i + n) % n + 1;
+	if (length == n)
+		return;
+	for (int k = 0; k < length / 2; k++)
+		std::swap(tour[(i + k) % n], tour[(j - k + n) % n]);
+}
+
+TEST_CASE("K-level tree basic queries", "[k level tree]")
+{
+	int n_cities = 10, origin = 1;
+	std::vector<int> order = { 3, 6, 8, 4, 1, 2, 5, 9, 10, 7 };
+	tsp::KLevelTree tree{ n_cities, 3, origin };
+	tree.set_raw_tour(order);
+
+	REQUIRE(tree.n_levels() == 3);
+	REQUIRE(tree.n_elements(0) == n_cities);
+	REQUIRE(tree.get_raw_tour(3) == order);
+	REQUIRE(tree.get_next(7) == 3);
+	REQUIRE(tree.get_prev(3) == 7);
+	REQUIRE(tree.is_between(3, 6, 8));
+	REQUIRE(tree.is_between(9, 7, 3));
+	REQUIRE(tree.is_between(2, 10, 1));
+	REQUIRE_FALSE(tree.is_between(6, 4, 8));
+	REQUIRE(tree.has_edge(7, 3));
+
+	tree.reverse(8, 1);
+	REQUIRE(tree.get_raw_tour(3) == std::vector<int>{ 3, 6, 1, 4, 8, 2, 5, 9, 10, 7 });
+	tree.flip(3, 6, 10, 7);
+	// either side may be reversed by a flip
+	auto direction = tree.get_next(6) == 1 ? tsp::Direction::forward : tsp::Direction::backward;
+	REQUIRE(tree.get_raw_tour(6, direction) == std::vector<int>{ 6, 1, 4, 8, 2, 5, 9, 10, 3, 7 });
+}
+
+TEST_CASE("K-level tree agrees with a vector tour", "[k level tree]")
+{
+	int n_levels = GENERATE(2, 3, 4);
+	int n_cities = GENERATE(20, 700);
+	int origin = 2;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 11 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	tsp::KLevelTree tree{ n_cities, n_levels, origin };
+	tree.set_raw_tour(order);
+	auto tour = order;
+
+	for (int i = 0; i < 2000; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		if (i % 3 == 0)
+		{
+			tree.reverse(a, c);
+			reverse_in_vector(tour, a, c);
+		}
+		else if (a != c)
+		{
+			int b = tree.get_next(a), d = tree.get_next(c);
+			if (b == c || d == a)
+				continue;
+			tree.flip(a, b, c, d);
+			// the result is either a, c, ..., b, d, ... or its mirror
+			REQUIRE(tree.has_edge(a, c));
+			REQUIRE(tree.has_edge(b, d));
+			tour = tree.get_raw_tour();
+		}
+		if (i % 100 == 0 && n_cities > 8)
+		{
+			std::vector<int> cities;
+			while (cities.size() < 4)
+			{
+				int x = city_dist(rng);
+				if (std::find(cities.begin(), cities.end(), x) == cities.end())
+					cities.push_back(x);
+			}
+			// in the forward tour order
+			tour = tree.get_raw_tour();
+			std::sort(cities.begin(), cities.end(), [&tour](int x, int y) {
+				return std::find(tour.begin(), tour.end(), x) < std::find(tour.begin(), tour.end(), y);
+			});
+			int a = cities[0], b = cities[1], c = cities[2], d = cities[3];
+			int an = tree.get_next(a), bn = tree.get_next(b), cn = tree.get_next(c), dn = tree.get_next(d);
+			tree.double_bridge_move(a, b, c, d);
+			REQUIRE(tree.get_next(a) == cn);
+			REQUIRE(tree.get_next(b) == dn);
+			REQUIRE(tree.get_next(c) == an);
+			REQUIRE(tree.get_next(d) == bn);
+			tour = tree.get_raw_tour();
+		}
+		if (i % 10 == 0)
+		{
+			// compare against the reference tour
+			auto start = tour.front();
+			REQUIRE(tree.get_raw_tour(start) == tour);
+			REQUIRE(tree.get_raw_tour(start, tsp::Direction::backward).back() == tour[1]);
+			for (int k = 0; k < 20; k++)
+			{
+				int x = city_dist(rng), y = city_dist(rng), z = city_dist(rng);
+				if (x == y || y == z || x == z)
+					continue;
+				auto px = std::find(tour.begin(), tour.end(), x) - tour.begin();
+				auto py = std::find(tour.begin(), tour.end(), y) - tour.begin();
+				auto pz = std::find(tour.begin(), tour.end(), z) - tour.begin();
+				bool expected = px < pz ? (px < py && py < pz) : (px < py || py < pz);
+				REQUIRE(tree.is_between(x, y, z) == expected);
+			}
+		}
+	}
+	// the group sizes still add up
+	for (int l = 1; l < tree.n_levels(); l++)
+	{
+		auto sizes = tree.group_sizes(l);
+		REQUIRE(std::accumulate(sizes.begin(), sizes.end(), 0) == tree.n_elements(l - 1));
+	}
+}
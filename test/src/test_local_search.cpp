@@ -0,0 +1,162 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include "local_search.h"
+
+namespace
+{
+	struct Instance
+	{
+		std::vector<double> x, y;
+		std::vector<std::vector<int>> neighbors;
+
+		// rounded Euclidean distances as in TSPLIB, such that the gains are exact
+		int distance(int a, int b) const
+		{
+			return static_cast<int>(std::lround(std::hypot(x[a] - x[b], y[a] - y[b])));
+		}
+
+		long long tour_length(const std::vector<int>& tour) const
+		{
+			long long length = 0;
+			for (std::size_t i = 0; i < tour.size(); i++)
+				length += distance(tour[i], tour[(i + 1) % tour.size()]);
+			return length;
+		}
+	};
+
+	// random cities with the k nearest neighbors of each one (the slots below the origin are unused)
+	Instance random_instance(int n_cities, int origin, int k, unsigned seed)
+	{
+		Instance instance;
+		std::mt19937 rng{ seed };
+		std::uniform_real_distribution<double> coordinate{ 0, 10000 };
+		instance.x.resize(origin + n_cities);
+		instance.y.resize(origin + n_cities);
+		instance.neighbors.resize(origin + n_cities);
+		for (int city = origin; city < origin + n_cities; city++)
+		{
+			instance.x[city] = coordinate(rng);
+			instance.y[city] = coordinate(rng);
+		}
+		for (int city = origin; city < origin + n_cities; city++)
+		{
+			std::vector<int> others;
+			for (int other = origin; other < origin + n_cities; other++)
+			{
+				if (other != city)
+					others.push_back(other);
+			}
+			std::partial_sort(others.begin(), others.begin() + k, others.end(), [&](int a, int b) {
+				return instance.distance(city, a) < instance.distance(city, b);
+			});
+			instance.neighbors[city].assign(others.begin(), others.begin() + k);
+		}
+		return instance;
+	}
+
+	// whether any 2-opt move (a, next a), (c, next c) -> (a, c), (next a, next c) improves the tour, where c
+	// is a candidate of a closer than next a
+	bool has_improving_two_opt(const tsp::TwoLevelTree& tree, const Instance& instance)
+	{
+		for (int a = tree.origin_city(); a < tree.origin_city() + tree.n_cities(); a++)
+		{
+			for (int c : instance.neighbors[a])
+			{
+				int b = tree.get_next(a), d = tree.get_next(c);
+				if (instance.distance(a, c) >= instance.distance(a, b))
+					break;
+				if (c != b && d != a && instance.distance(a, b) + instance.distance(c, d)
+					> instance.distance(a, c) + instance.distance(b, d))
+					return true;
+			}
+		}
+		return false;
+	}
+}
+
+TEST_CASE("Local search", "[local search]")
+{
+	int n_cities = 1000, origin = 1;
+	auto instance = random_instance(n_cities, origin, 8, 24);
+	auto distance = [&instance](int a, int b) { return instance.distance(a, b); };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 24 };
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	long long initial_length = instance.tour_length(order);
+
+	auto check = [&](const tsp::LocalSearchOptions& options) {
+		auto search = tsp::make_local_search(tree, distance, instance.neighbors, options);
+		long long gain = search.run();
+		auto tour = tree.get_raw_tour();
+		std::vector<int> sorted = tour;
+		std::sort(sorted.begin(), sorted.end());
+		REQUIRE(sorted == [&]() { std::vector<int> v(n_cities); std::iota(v.begin(), v.end(), origin); return v; }());
+		REQUIRE(instance.tour_length(tour) == initial_length - gain);
+		REQUIRE(search.n_moves() > 0);
+		// far better than a random tour
+		REQUIRE(instance.tour_length(tour) < initial_length / 5);
+		// the don't-look bits may skip a few moves, which are found by restarting from all the cities
+		int n_runs = 1;
+		for (; n_runs < 20 && gain > 0; n_runs++)
+		{
+			search.activate_all();
+			long long length = instance.tour_length(tree.get_raw_tour());
+			gain = search.run();
+			REQUIRE(instance.tour_length(tree.get_raw_tour()) == length - gain);
+		}
+		REQUIRE(gain == 0);
+		return instance.tour_length(tree.get_raw_tour());
+	};
+
+	SECTION("First improvement")
+	{
+		tsp::LocalSearchOptions options;
+		check(options);
+		REQUIRE(!has_improving_two_opt(tree, instance));
+	}
+
+	SECTION("Best improvement")
+	{
+		tsp::LocalSearchOptions options;
+		options.improvement = tsp::Improvement::best;
+		check(options);
+		REQUIRE(!has_improving_two_opt(tree, instance));
+	}
+
+	SECTION("2-opt or Or-opt only")
+	{
+		tsp::LocalSearchOptions options;
+		options.or_opt = false;
+		check(options);
+		REQUIRE(!has_improving_two_opt(tree, instance));
+		// Or-opt can still improve a 2-optimal tour
+		options.or_opt = true;
+		options.two_opt = false;
+		auto length = instance.tour_length(tree.get_raw_tour());
+		auto search = tsp::make_local_search(tree, distance, instance.neighbors, options);
+		REQUIRE(search.run() > 0);
+		REQUIRE(instance.tour_length(tree.get_raw_tour()) < length);
+	}
+
+	SECTION("Restart from a perturbation")
+	{
+		tsp::LocalSearchOptions options;
+		auto search = tsp::make_local_search(tree, distance, instance.neighbors, options);
+		search.run();
+		std::vector<int> endpoints;
+		tree.random_double_bridges(5, rng, 50, &endpoints);
+		auto kicked = instance.tour_length(tree.get_raw_tour());
+		for (int city : endpoints)
+			search.activate(city);
+		long long gain = search.run();
+		REQUIRE(instance.tour_length(tree.get_raw_tour()) == kicked - gain);
+		REQUIRE(gain > 0);
+	}
+}
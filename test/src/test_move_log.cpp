@@ -0,0 +1,220 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <sstream>
+#include "two_level_tree.h"
+#include "move_log.h"
+#include "move_trace.h"
+
+namespace
+{
+	// the complete layout of the segments as well as the tour
+	void require_same_state(const tsp::TwoLevelTree& a, const tsp::TwoLevelTree& b)
+	{
+		REQUIRE(a.get_raw_tour() == b.get_raw_tour());
+		REQUIRE(a.n_segments() == b.n_segments());
+		REQUIRE(a.actual_segment_sizes(a.origin_city()) == b.actual_segment_sizes(b.origin_city()));
+		for (int city = a.origin_city(); city < a.origin_city() + a.n_cities(); city++)
+		{
+			REQUIRE(a.get_node(city)->id == b.get_node(city)->id);
+			REQUIRE(a.get_node(city)->parent->reverse == b.get_node(city)->parent->reverse);
+		}
+	}
+}
+
+TEST_CASE("Move log", "[move log]")
+{
+	int n_cities = 300, origin = 1;
+	std::mt19937 rng{ 21 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	tsp::TwoLevelTree replica{ tree };
+	tsp::MoveLog log;
+	tree.set_move_log(&log);
+	REQUIRE(tree.move_log() == &log);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	auto random_moves = [&](int n_moves) {
+		for (int i = 0; i < n_moves; i++)
+		{
+			auto raw_tour = tree.get_raw_tour();
+			switch (i % 4)
+			{
+			case 0:
+				tree.reverse(city_dist(rng), city_dist(rng));
+				break;
+			case 1:
+				tree.flip(raw_tour[10], raw_tour[11], raw_tour[200], raw_tour[201]);
+				break;
+			case 2:
+				tree.or_move(raw_tour[50], raw_tour[52], raw_tour[120], i % 8 == 2);
+				break;
+			default:
+				tree.random_double_bridges(1, rng, i % 8 == 3 ? 40 : 0);
+				break;
+			}
+		}
+	};
+
+	SECTION("Replay the moves onto a replica")
+	{
+		REQUIRE(log.empty());
+		random_moves(40);
+		REQUIRE(!log.empty());
+		REQUIRE(replica.apply_log(log) == log.size());
+		require_same_state(tree, replica);
+
+		// incrementally and with the transactions and an explicit rebalance
+		std::size_t synced = log.size();
+		tree.begin_transaction();
+		random_moves(10);
+		tree.rollback();
+		tree.begin_transaction();
+		random_moves(10);
+		tree.commit();
+		tree.rebalance();
+		random_moves(20);
+		synced = replica.apply_log(log, synced);
+		REQUIRE(synced == log.size());
+		require_same_state(tree, replica);
+
+		// a copy does not record into the same log
+		tsp::TwoLevelTree copy{ tree };
+		REQUIRE(copy.move_log() == nullptr);
+		std::size_t size = log.size();
+		copy.reverse(city_dist(rng), city_dist(rng));
+		REQUIRE(log.size() == size);
+		tree.set_move_log(nullptr);
+		tree.reverse(city_dist(rng), city_dist(rng));
+		REQUIRE(log.size() == size);
+	}
+
+	SECTION("Replay with an explicit rebalancing policy")
+	{
+		tsp::RebalancePolicy policy;
+		policy.mode = tsp::Rebalance::relayout;
+		policy.max_ratio = 1.5;
+		tree.set_rebalance_policy(policy);
+		replica.set_rebalance_policy(policy);
+		random_moves(100);
+		replica.apply_log(log);
+		require_same_state(tree, replica);
+		REQUIRE(tree.n_relayouts() > 0);
+		REQUIRE(tree.n_relayouts() == replica.n_relayouts());
+	}
+
+	SECTION("Save and load the log")
+	{
+		random_moves(30);
+		std::stringstream ss;
+		REQUIRE(log.save(ss));
+		tsp::MoveLog loaded;
+		REQUIRE(loaded.load(ss));
+		REQUIRE(loaded.data() == log.data());
+		replica.apply_log(loaded);
+		require_same_state(tree, replica);
+
+		// a truncated log is rejected
+		auto bytes = ss.str();
+		std::stringstream truncated{ bytes.substr(0, bytes.size() - 4) };
+		REQUIRE(!loaded.load(truncated));
+		REQUIRE(loaded.data() == log.data());
+		std::stringstream garbage{ "not a log" };
+		REQUIRE(!loaded.load(garbage));
+
+		// the replay stops at an invalid city
+		tsp::MoveLog invalid;
+		invalid.record(tsp::MoveLog::Move::reverse, origin, origin + 5);
+		invalid.record(tsp::MoveLog::Move::reverse, origin, origin + n_cities);
+		REQUIRE(replica.apply_log(invalid) == 3);
+	}
+}
+
+TEST_CASE("Move trace", "[move log]")
+{
+	int n_cities = 300, origin = 2;
+	std::mt19937 rng{ 29 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	tree.random_double_bridges(5, rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	tsp::MoveTrace trace;
+	trace.start(tree);
+	REQUIRE(tree.move_log() == &trace.log());
+	REQUIRE(trace.n_cities() == n_cities);
+	REQUIRE(trace.origin_city() == origin);
+	for (int i = 0; i < 60; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		if (i % 3 == 0)
+			tree.random_double_bridges(1, rng, 30);
+		else if (a != c && tree.get_next(a) != c && tree.get_next(c) != a)
+			tree.flip(a, tree.get_next(a), c, tree.get_next(c));
+	}
+	trace.stop(tree);
+	REQUIRE(tree.move_log() == nullptr);
+	std::size_t size = trace.log().size();
+	tree.reverse(city_dist(rng), city_dist(rng));
+	REQUIRE(trace.log().size() == size);
+
+	std::stringstream ss;
+	REQUIRE(trace.save(ss));
+	tsp::MoveTrace loaded;
+	REQUIRE(loaded.load(ss));
+	REQUIRE(loaded.log().data() == trace.log().data());
+
+	SECTION("Replay one move at a time onto a fresh tree")
+	{
+		tsp::TwoLevelTree replay{ n_cities, origin };
+		REQUIRE(loaded.load_initial_state(replay));
+		// the tree before the last reverse
+		tsp::TwoLevelTree expected{ n_cities, origin };
+		REQUIRE(trace.load_initial_state(expected));
+		REQUIRE(expected.apply_log(trace.log()) == size);
+		std::size_t i = 0;
+		while (i < size)
+		{
+			std::size_t next = replay.apply_log(loaded.log(), i, i + 1);
+			REQUIRE(next == i + 1 + tsp::MoveLog::n_arguments(static_cast<tsp::MoveLog::Move>(loaded.log().data()[i])));
+			i = next;
+		}
+		require_same_state(replay, expected);
+	}
+
+	SECTION("Replay with another rebalancing policy")
+	{
+		tsp::TwoLevelTree replay{ n_cities, origin };
+		tsp::RebalancePolicy policy;
+		policy.mode = tsp::Rebalance::relayout;
+		policy.max_ratio = 1.2;
+		replay.set_rebalance_policy(policy);
+		REQUIRE(loaded.load_initial_state(replay));
+		replay.apply_log(loaded.log());
+		REQUIRE(replay.n_relayouts() > 0);
+		tsp::TwoLevelTree expected{ n_cities, origin };
+		trace.load_initial_state(expected);
+		expected.apply_log(trace.log());
+		REQUIRE(replay.get_raw_tour(origin) == expected.get_raw_tour(origin));
+	}
+
+	SECTION("Invalid traces")
+	{
+		tsp::TwoLevelTree other{ n_cities + 1, origin };
+		REQUIRE(!loaded.load_initial_state(other));
+		auto bytes = ss.str();
+		std::stringstream truncated{ bytes.substr(0, bytes.size() - 4) };
+		REQUIRE(!loaded.load(truncated));
+		REQUIRE(loaded.log().data() == trace.log().data());
+		std::stringstream garbage{ "not a trace" };
+		REQUIRE(!loaded.load(garbage));
+	}
+}
@@ -3,6 +3,13 @@
 #include <vector>
 #include <cmath>
 #include <random>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <thread>
+#include <atomic>
 #include "two_level_tree.h"
 
 // whether a and b are neighbors and a is before b on a forward tour
@@ -617,17 +624,14 @@ TEST_CASE("Double bridge move", "[two level tree]")
 
 	tree.double_bridge_move(12, 5, 11, 8);
 	REQUIRE(tree.get_raw_tour(2) == std::vector<int>{2, 5, 4, 1, 12, 3, 6, 8, 9, 10, 7, 11});
-	// let's traverse via the parents
+	// let's traverse via the parents. Their IDs are cyclic, but not necessarily zero at the head.
 	auto p_parent = tree.head_parent_node();
-	int id = 0;
 	do
 	{
-		REQUIRE(p_parent->id == id);
 		REQUIRE(p_parent->next->prev == p_parent);
 		REQUIRE(p_parent->prev->next == p_parent);
 		REQUIRE((p_parent->id + 1) % tree.n_segments() == p_parent->next->id);
 		p_parent = p_parent->next;
-		id++;
 	} while (p_parent != tree.head_parent_node());
 
 	tree.double_bridge_move(3, 9, 2, 4);
@@ -641,15 +645,12 @@ TEST_CASE("Double bridge move", "[two level tree]")
 	} while (node != tree.origin_city_node());
 
 	p_parent = tree.head_parent_node();
-	id = 0;
 	do
 	{
-		REQUIRE(p_parent->id == id);
 		REQUIRE(p_parent->next->prev == p_parent);
 		REQUIRE(p_parent->prev->next == p_parent);
 		REQUIRE((p_parent->id + 1) % tree.n_segments() == p_parent->next->id);
 		p_parent = p_parent->next;
-		id++;
 	} while (p_parent != tree.head_parent_node());
 
 	tree.double_bridge_move(5, 11, 6, 1);
@@ -672,4 +673,1552 @@ TEST_CASE("Double bridge move", "[two level tree]")
 		p_parent = p_parent->next;
 	} while (p_parent != tree.head_parent_node());
 	assert(size == 12);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Double bridge move in any segments", "[two level tree]")
+{
+	int n_cities = 200, origin = 1;
+	std::vector<int> ref(n_cities);
+	std::iota(ref.begin(), ref.end(), origin);
+	std::mt19937 rng{ 29 };
+	std::shuffle(ref.begin(), ref.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(ref);
+	auto check_parents = [&tree]() {
+		auto p = tree.head_parent_node();
+		do
+		{
+			REQUIRE(p->next->prev == p);
+			REQUIRE((p->id + 1) % tree.n_segments() == p->next->id);
+			p = p->next;
+		} while (p != tree.head_parent_node());
+	};
+
+	std::uniform_int_distribution<int> pos_dist{ 1, n_cities - 1 };
+	for (int k = 0; k < 500; k++)
+	{
+		// a at position 0, and b, c, d anywhere after it, possibly adjacent or in the same segment
+		std::rotate(ref.begin(), ref.begin() + pos_dist(rng), ref.end());
+		int i[] = { pos_dist(rng), pos_dist(rng), pos_dist(rng) };
+		if (k % 2 == 0)  // local ones
+			i[0] = i[0] % 20 + 1, i[1] = i[1] % 20 + 1, i[2] = i[2] % 20 + 1;
+		std::sort(std::begin(i), std::end(i));
+		if (i[0] == i[1] || i[1] == i[2])
+			continue;
+		tree.double_bridge_move(ref[0], ref[i[0]], ref[i[1]], ref[i[2]]);
+		std::vector<int> expected{ ref[0] };
+		expected.insert(expected.end(), ref.begin() + i[1] + 1, ref.begin() + i[2] + 1);
+		expected.insert(expected.end(), ref.begin() + i[0] + 1, ref.begin() + i[1] + 1);
+		expected.insert(expected.end(), ref.begin() + 1, ref.begin() + i[0] + 1);
+		expected.insert(expected.end(), ref.begin() + i[2] + 1, ref.end());
+		ref = expected;
+		REQUIRE(tree.get_raw_tour(ref[0]) == ref);
+		check_parents();
+	}
+	REQUIRE(get_tour_via_parents(tree, origin) == tree.get_raw_tour(tree.get_parent_node(origin)->forward_begin_node()->city));
+
+	SECTION("Random kicks")
+	{
+		std::vector<int> cities(n_cities);
+		std::iota(cities.begin(), cities.end(), origin);
+		for (int window : { 0, 10 })
+		{
+			auto before = tree.get_raw_tour();
+			std::vector<int> endpoints;
+			tree.random_double_bridges(50, rng, window, &endpoints);
+			REQUIRE(endpoints.size() == 400);
+			REQUIRE(tree.get_raw_tour() != before);
+			auto tour = tree.get_raw_tour();
+			std::sort(tour.begin(), tour.end());
+			REQUIRE(tour == cities);
+			check_parents();
+		}
+		tsp::TwoLevelTree copied{ tree };
+		std::mt19937 rng1{ 3 }, rng2{ 3 };
+		tree.random_double_bridges(20, rng1, 8);
+		copied.random_double_bridges(20, rng2, 8);
+		REQUIRE(tree.get_raw_tour() == copied.get_raw_tour());
+	}
+}
+// reverse the forward path a --> b in a plain vector tour
+static void reverse_in_vector(std::vector<int>& tour, int a, int b)
+{
+	int n = static_cast<int>(tour.size());
+	int i = static_cast<int>(std::find(tour.begin(), tour.end(), a) - tour.begin());
+	int j = static_cast<int>(std::find(tour.begin(), tour.end(), b) - tour.begin());
+	int length = (j - i + n) % n + 1;
+	if (length == n)  // the tree leaves the tour unchanged in this case
+		return;
+	for (int k = 0; k < length / 2; k++)
+		std::swap(tour[(i + k) % n], tour[(j - k + n) % n]);
+}
+
+// whether two tours are the same cycle in the same (forward) orientation
+static bool is_same_tour(const std::vector<int>& tour1, const std::vector<int>& tour2)
+{
+	if (tour1.size() != tour2.size())
+		return false;
+	auto it = std::find(tour2.begin(), tour2.end(), tour1.front());
+	if (it == tour2.end())
+		return false;
+	std::vector<int> rotated(it, tour2.end());
+	rotated.insert(rotated.end(), tour2.begin(), it);
+	return rotated == tour1;
+}
+
+TEST_CASE("Explicit rebalancing policy", "[two level tree]")
+{
+	int n_cities = 400, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 42 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	for (auto mode : { tsp::Rebalance::local, tsp::Rebalance::relayout })
+	{
+		tsp::TwoLevelTree tree{ n_cities, origin };
+		tsp::RebalancePolicy policy;
+		policy.mode = mode;
+		policy.max_ratio = 2;
+		tree.set_rebalance_policy(policy);
+		tree.set_raw_tour(order);
+		auto expected = order;
+		for (int i = 0; i < 2000; i++)
+		{
+			int a = city_dist(rng), b = city_dist(rng);
+			tree.reverse(tree.get_node(a), tree.get_node(b));
+			reverse_in_vector(expected, a, b);
+		}
+		REQUIRE(is_same_tour(tree.get_raw_tour(), expected));
+		REQUIRE(get_tour_via_parents(tree, 1) == tree.get_raw_tour(tree.get_parent_node(1)->forward_begin_node()->city));
+		auto sizes = tree.actual_segment_sizes();
+		REQUIRE(std::accumulate(sizes.begin(), sizes.end(), 0) == n_cities);
+		if (mode == tsp::Rebalance::local)
+		{
+			REQUIRE(tree.n_local_rebalances() > 0);
+			REQUIRE(*std::max_element(sizes.begin(), sizes.end()) <= 2 * n_cities / tree.n_segments());
+		}
+		else
+		{
+			REQUIRE(tree.n_relayouts() > 0);
+		}
+	}
+
+	// an explicit relayout restores the initial segment sizes
+	tsp::TwoLevelTree tree{ 23, 1 };
+	tree.set_raw_tour({ 11, 13, 6, 8, 4, 1, 2, 5, 9, 10, 7, 12, 14, 3, 15, 16, 17, 18, 20, 19, 23, 22, 21 });
+	tree.reverse(tree.get_node(18), tree.get_node(23));
+	REQUIRE(tree.actual_segment_sizes() == std::vector<int>{6, 4, 4, 5, 4});
+	auto tour = tree.get_raw_tour();
+	tree.rebalance();
+	REQUIRE(tree.get_raw_tour() == tour);
+	REQUIRE(tree.actual_segment_sizes() == std::vector<int>{4, 4, 4, 4, 7});
+	REQUIRE(tree.n_relayouts() == 1);
+}
+
+TEST_CASE("Export the raw tour from the segment cache", "[two level tree]")
+{
+	int n_cities = 400, origin = 2;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 3 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+
+	// walk the tree node by node
+	auto walk = [&tree, n_cities](int start, tsp::Direction direction) {
+		std::vector<int> tour;
+		for (int i = 0, c = start; i < n_cities; i++)
+		{
+			tour.push_back(c);
+			c = direction == tsp::Direction::forward ? tree.get_next(c) : tree.get_prev(c);
+		}
+		return tour;
+	};
+	std::vector<int> exported;
+	for (int i = 0; i < 1000; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		if (i % 2 == 0)
+		{
+			// short paths are reversed inside a segment, which patches the cache
+			int b = a;
+			for (int k = city_dist(rng) % 8; k > 0; k--)
+				b = tree.get_next(b);
+			tree.reverse(a, b);
+		}
+		else
+		{
+			tree.reverse(a, c);
+		}
+		// export only sometimes, such that several changes accumulate in between, with a cache that is
+		// complete, partial or empty
+		if (i % 7 == 0)
+		{
+			if (i % 21 == 0)
+				tree.update_segment_cache();
+			for (auto direction : { tsp::Direction::forward, tsp::Direction::backward })
+			{
+				int start = city_dist(rng);
+				tree.to_raw_tour(exported, start, direction);
+				REQUIRE(exported == walk(start, direction));
+			}
+			REQUIRE(tree.get_raw_tour() == walk(origin, tsp::Direction::forward));
+		}
+	}
+	tsp::TwoLevelTree copied{ tree };
+	REQUIRE(copied.get_raw_tour() == tree.get_raw_tour());
+}
+
+TEST_CASE("Snapshot and restore", "[two level tree]")
+{
+	int n_cities = 200, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 9 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	auto random_reversals = [&]() {
+		for (int i = 0; i < 50; i++)
+			tree.reverse(city_dist(rng), city_dist(rng));
+	};
+
+	random_reversals();
+	auto best = tree.snapshot();
+	auto best_tour = tree.get_raw_tour();
+	auto best_sizes = tree.actual_segment_sizes(origin);
+	tsp::TwoLevelTree::Snapshot s;
+	for (int k = 0; k < 5; k++)
+	{
+		random_reversals();
+		tree.snapshot(s);  // reuse the storage
+		REQUIRE(s.nodes.size() == best.nodes.size());
+		tree.restore(best);
+		REQUIRE(tree.get_raw_tour() == best_tour);
+		REQUIRE(tree.actual_segment_sizes(origin) == best_sizes);
+		REQUIRE(get_tour_via_parents(tree, origin) == tree.get_raw_tour(tree.get_parent_node(origin)->forward_begin_node()->city));
+	}
+
+	SECTION("Restore into another tree")
+	{
+		tsp::TwoLevelTree other{ n_cities, origin };
+		other.set_raw_tour(order);
+		other.restore(best);
+		REQUIRE(other.get_raw_tour() == best_tour);
+		other.reverse(order[0], order[n_cities / 2]);
+		REQUIRE(tree.get_raw_tour() == best_tour);
+	}
+
+	SECTION("Copy keeps the segments and assignment reuses the storage")
+	{
+		tsp::TwoLevelTree copied{ tree };
+		REQUIRE(copied.get_raw_tour() == best_tour);
+		REQUIRE(copied.actual_segment_sizes(origin) == best_sizes);
+		random_reversals();
+		auto tour = tree.get_raw_tour();
+		auto address = copied.get_node(origin);
+		copied = tree;
+		REQUIRE(copied.get_node(origin) == address);
+		REQUIRE(copied.get_raw_tour() == tour);
+		copied.reverse(order[0], order[n_cities / 2]);
+		REQUIRE(tree.get_raw_tour() == tour);
+		REQUIRE(get_tour_via_parents(copied, origin) == copied.get_raw_tour(copied.get_parent_node(origin)->forward_begin_node()->city));
+	}
+}
+
+TEST_CASE("Transactions", "[two level tree]")
+{
+	int n_cities = 300, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 13 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	auto mode = GENERATE(tsp::Rebalance::implicit, tsp::Rebalance::local);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tsp::RebalancePolicy policy;
+	policy.mode = mode;
+	tree.set_rebalance_policy(policy);
+	tree.set_raw_tour(order);
+
+	// a tentative move of a few random flips
+	auto random_flips = [&](int n_flips) {
+		for (int i = 0; i < n_flips; i++)
+		{
+			int a = city_dist(rng), c = city_dist(rng);
+			int b = tree.get_next(a), d = tree.get_next(c);
+			if (a == c || b == c || d == a)
+				continue;
+			tree.flip(a, b, c, d);
+		}
+	};
+	auto check_structure = [&tree, origin]() {
+		auto start = tree.get_parent_node(origin)->forward_begin_node()->city;
+		REQUIRE(get_tour_via_parents(tree, origin) == tree.get_raw_tour(start));
+		auto p = tree.head_parent_node();
+		do
+		{
+			REQUIRE((p->id + 1) % tree.n_segments() == p->next->id);
+			p = p->next;
+		} while (p != tree.head_parent_node());
+	};
+
+	for (int k = 0; k < 50; k++)
+	{
+		auto tour = tree.get_raw_tour();
+		auto sizes = tree.actual_segment_sizes(origin);
+		tree.begin_transaction();
+		REQUIRE(tree.in_transaction());
+		random_flips(5);
+		if (k % 10 == 0)
+		{
+			auto cities = tree.get_raw_tour();
+			auto s = static_cast<int>(cities.size());
+			int a = cities[0], b = cities[s / 4], c = cities[s / 2], d = cities[3 * s / 4];
+			std::vector<const tsp::ParentNode*> parents{ tree.get_parent_node(a), tree.get_parent_node(b),
+				tree.get_parent_node(c), tree.get_parent_node(d) };
+			std::sort(parents.begin(), parents.end());
+			if (std::unique(parents.begin(), parents.end()) == parents.end())
+				tree.double_bridge_move(a, b, c, d);
+		}
+		REQUIRE(tree.n_journaled() > 0);
+		if (k % 3 == 0)
+		{
+			auto changed = tree.get_raw_tour();
+			tree.commit();
+			REQUIRE(tree.get_raw_tour() == changed);
+		}
+		else
+		{
+			tree.rollback();
+			REQUIRE(tree.get_raw_tour() == tour);
+			REQUIRE(tree.actual_segment_sizes(origin) == sizes);
+		}
+		REQUIRE_FALSE(tree.in_transaction());
+		check_structure();
+	}
+
+	// the journal only grows with the touched nodes
+	tree.begin_transaction();
+	int a = tree.get_next(origin), b = tree.get_next(a);
+	tree.reverse(a, b);
+	REQUIRE(tree.n_journaled() <= 2 * n_cities / tree.n_segments() + 8);
+	tree.rollback();
+}
+
+TEST_CASE("Operation statistics", "[two level tree]")
+{
+	REQUIRE(tsp::TwoLevelTree::stats_enabled());
+	int n_cities = 23, origin = 1;
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour({ 11, 13, 6, 8, 4, 1, 2, 5, 9, 10, 7, 12, 14, 3, 15, 16, 17, 18, 20, 19, 23, 22, 21 });
+	// segments: [11 13 6 8] [4 1 2 5] [9 10 7 12] [14 3 15 16] [17 18 20 19 23 22 21]
+	REQUIRE(tree.stats().n_split_and_merges == 0);
+
+	tree.reverse(13, 6);  // partial
+	REQUIRE(tree.stats().n_partial_segment_reversals == 1);
+	REQUIRE(tree.stats().n_nodes_relabeled == 2);
+	tree.reverse(4, 5);  // complete
+	REQUIRE(tree.stats().n_complete_segment_reversals == 1);
+	tree.reverse(9, 16);  // two complete segments
+	REQUIRE(tree.stats().n_multi_segment_reversals == 1);
+	REQUIRE(tree.stats().n_parents_relinked == 3);
+	tree.reverse(10, 18);  // split and merge at both ends
+	REQUIRE(tree.stats().n_split_and_merges == 2);
+	REQUIRE(tree.stats().n_nodes_moved > 0);
+
+	auto histogram = tree.segment_size_histogram(2);
+	REQUIRE(std::accumulate(histogram.begin(), histogram.end(), 0) == tree.n_segments());
+	auto sizes = tree.actual_segment_sizes();
+	REQUIRE(histogram.size() == static_cast<std::size_t>(*std::max_element(sizes.begin(), sizes.end()) / 2 + 1));
+
+	std::ostringstream os;
+	tree.write_stats(os);
+	REQUIRE(os.str().find("\"n_split_and_merges\": 2") != std::string::npos);
+	REQUIRE(os.str().find("\"segment_size_histogram\": [") != std::string::npos);
+
+	tree.reset_stats();
+	REQUIRE(tree.stats().n_nodes_moved == 0);
+}
+
+TEST_CASE("Segment policy", "[two level tree]")
+{
+	int n_cities = 100, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+
+	REQUIRE(tsp::TwoLevelTree{ n_cities, origin }.n_segments() == 11);
+	tsp::SegmentPolicy policy;
+	policy.n_segments = 4;
+	REQUIRE(tsp::TwoLevelTree{ n_cities, origin, policy }.n_segments() == 4);
+	policy.n_segments = 0;
+	policy.nominal_length = 20;
+	tsp::TwoLevelTree tree{ n_cities, origin, policy };
+	REQUIRE(tree.n_segments() == 5);
+	REQUIRE(tree.nominal_segment_length() == 20);
+	tree.set_raw_tour(order);
+	REQUIRE(tree.actual_segment_sizes() == std::vector<int>{ 20, 20, 20, 20, 20 });
+
+	// the threshold for reversing a path in place inside a segment
+	tree.reverse(3, 12);  // 10 <= 0.75 * 20
+	REQUIRE(tree.stats().n_partial_segment_reversals == 1);
+	REQUIRE(tree.stats().n_split_and_merges == 0);
+	policy.partial_reverse_ratio = 0.25;
+	tsp::TwoLevelTree tree2{ n_cities, origin, policy };
+	tree2.set_raw_tour(order);
+	tree2.reverse(3, 12);
+	REQUIRE(tree2.stats().n_partial_segment_reversals == 0);
+	REQUIRE(tree2.stats().n_split_and_merges == 2);
+	REQUIRE(tree2.get_raw_tour() == tree.get_raw_tour());
+	tsp::TwoLevelTree copied{ tree2 };
+	REQUIRE(copied.segment_policy().partial_reverse_ratio == 0.25);
+
+	SECTION("Auto-tune the nominal segment length")
+	{
+		std::mt19937 rng{ 17 };
+		std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+		std::vector<std::pair<int, int>> moves;
+		for (int i = 0; i < 200; i++)
+			moves.emplace_back(city_dist(rng), city_dist(rng));
+		auto tuned = tsp::TwoLevelTree::tune_segment_policy(order, moves, { 5, 10, 25 });
+		REQUIRE((tuned.nominal_length == 5 || tuned.nominal_length == 10 || tuned.nominal_length == 25));
+		tuned = tsp::TwoLevelTree::tune_segment_policy(order, moves);
+		REQUIRE(tuned.nominal_length > 0);
+		tsp::TwoLevelTree tuned_tree{ n_cities, origin, tuned };
+		tuned_tree.set_raw_tour(order);
+		REQUIRE(tuned_tree.get_raw_tour() == order);
+	}
+}
+
+TEST_CASE("Or-opt move", "[two level tree]")
+{
+	int n_cities = 23, origin = 1;
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	std::vector<int> order{ 11, 13, 6, 8, 4, 1, 2, 5, 9, 10, 7, 12, 14, 3, 15, 16, 17, 18, 20, 19, 23, 22, 21 };
+	tree.set_raw_tour(order);
+	// segments: [11 13 6 8] [4 1 2 5] [9 10 7 12] [14 3 15 16] [17 18 20 19 23 22 21]
+	tree.or_move(1, 2, 10);  // from the middle of a segment to the middle of another one
+	REQUIRE(tree.get_raw_tour(11) == std::vector<int>{ 11, 13, 6, 8, 4, 5, 9, 10, 1, 2, 7, 12, 14, 3, 15, 16,
+		17, 18, 20, 19, 23, 22, 21 });
+	REQUIRE(tree.actual_segment_sizes(11) == std::vector<int>{ 4, 2, 6, 4, 7 });
+	tree.or_move(8, 4, 21, true);  // across two segments, reversed, appended to the end of a segment
+	REQUIRE(tree.get_raw_tour(11) == std::vector<int>{ 11, 13, 6, 5, 9, 10, 1, 2, 7, 12, 14, 3, 15, 16,
+		17, 18, 20, 19, 23, 22, 21, 4, 8 });
+	REQUIRE(tree.stats().n_or_moves == 2);
+	REQUIRE(tree.stats().n_split_and_merges == 0);
+	tree.or_move(5, 5, 6, true);  // already in place
+	REQUIRE(tree.get_next(6) == 5);
+	tree.or_move(5, 5, 9);  // the segment of 5 would become empty
+	REQUIRE(tree.get_raw_tour(11) == std::vector<int>{ 11, 13, 6, 9, 5, 10, 1, 2, 7, 12, 14, 3, 15, 16,
+		17, 18, 20, 19, 23, 22, 21, 4, 8 });
+	REQUIRE(tree.stats().n_or_moves == 2);
+	REQUIRE(get_tour_via_parents(tree, 1) == tree.get_raw_tour(tree.get_parent_node(1)->forward_begin_node()->city));
+
+	SECTION("Random moves against a vector")
+	{
+		n_cities = 200;
+		for (auto mode : { tsp::Rebalance::implicit, tsp::Rebalance::local })
+		{
+			tsp::RebalancePolicy policy;
+			policy.mode = mode;
+			policy.max_ratio = 2.0;
+			policy.min_ratio = 0.5;
+			std::vector<int> ref(n_cities);
+			std::iota(ref.begin(), ref.end(), origin);
+			std::mt19937 rng{ 23 };
+			std::shuffle(ref.begin(), ref.end(), rng);
+			tsp::TwoLevelTree t{ n_cities, origin };
+			t.set_rebalance_policy(policy);
+			t.set_raw_tour(ref);
+			std::uniform_int_distribution<int> pos_dist{ 0, n_cities - 1 }, len_dist{ 1, 3 };
+			for (int i = 0; i < 2000; i++)
+			{
+				if (i % 7 == 0)  // mix in reversals to get reversed segments
+				{
+					int a = ref[pos_dist(rng)];
+					t.reverse(a, t.get_next(t.get_next(t.get_next(a))));
+					ref = t.get_raw_tour(ref[0]);
+					continue;
+				}
+				// rotate the reference such that the chain comes first
+				std::rotate(ref.begin(), ref.begin() + pos_dist(rng), ref.end());
+				int k = len_dist(rng);
+				std::uniform_int_distribution<int> insert_dist{ k, n_cities - 1 };
+				int j = insert_dist(rng);
+				bool reversed = rng() % 2 == 1;
+				t.or_move(ref[0], ref[k - 1], ref[j], reversed);
+				std::vector<int> chain(ref.begin(), ref.begin() + k);
+				if (reversed)
+					std::reverse(chain.begin(), chain.end());
+				ref.insert(ref.begin() + j + 1, chain.begin(), chain.end());
+				ref.erase(ref.begin(), ref.begin() + k);
+				REQUIRE(t.get_raw_tour(ref[0]) == ref);
+				REQUIRE(t.get_prev(ref[0]) == ref.back());
+			}
+			REQUIRE(get_tour_via_parents(t, origin) == t.get_raw_tour(t.get_parent_node(origin)->forward_begin_node()->city));
+			for (int city = origin; city < origin + n_cities; city++)
+			{
+				auto node = t.get_node(city);
+				if (node != node->parent->segment_end_node)
+					REQUIRE(node->next->id == node->id + 1);
+			}
+		}
+	}
+
+	SECTION("Rollback")
+	{
+		tree.begin_transaction();
+		tree.or_move(13, 6, 16);
+		tree.or_move(23, 22, 1, true);
+		tree.rollback();
+		REQUIRE(tree.get_raw_tour(11) == std::vector<int>{ 11, 13, 6, 9, 5, 10, 1, 2, 7, 12, 14, 3, 15, 16,
+			17, 18, 20, 19, 23, 22, 21, 4, 8 });
+	}
+}
+
+TEST_CASE("Tour positions", "[two level tree]")
+{
+	int n_cities = 300, origin = 2;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 31 };
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::RebalancePolicy policy;
+	policy.mode = tsp::Rebalance::local;
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_rebalance_policy(policy);
+	tree.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	auto check_positions = [&]() {
+		auto tour = tree.get_raw_tour();
+		for (int i = 0; i < n_cities; i++)
+			REQUIRE(tree.position(tour[i]) == i);
+		for (int k = 0; k < 20; k++)
+		{
+			int a = city_dist(rng), b = city_dist(rng);
+			int length = 1;
+			for (auto p = tree.get_node(a); p != tree.get_node(b); p = tree.get_next(p))
+				length++;
+			REQUIRE(tree.path_length(a, b) == length);
+		}
+	};
+	check_positions();
+
+	for (int i = 0; i < 300; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		switch (i % 5)
+		{
+		case 0:
+		case 1:
+			tree.reverse(a, c);
+			break;
+		case 2:
+			if (a != c && tree.get_next(c) != a && tree.get_next(a) != c)
+				tree.flip(a, tree.get_next(a), c, tree.get_next(c));
+			break;
+		case 3:
+			if (tree.path_length(a, c) > 4)
+			{
+				tree.or_move(tree.get_next(a), tree.get_next(tree.get_next(a)), c, i % 2 == 0);
+				tree.update_positions();
+				REQUIRE(tree.positions_valid());
+			}
+			break;
+		default:
+			tree.random_double_bridges(1, rng, i % 2 == 0 ? 30 : 0);
+		}
+		if (i % 10 == 0)
+			check_positions();
+	}
+	check_positions();
+
+	tree.begin_transaction();
+	int length = tree.path_length(order[10], order[200]);
+	tree.reverse(order[10], order[200]);
+	REQUIRE(tree.path_length(order[200], order[10]) == length);
+	tree.rollback();
+	check_positions();
+
+	tree.set_raw_tour(order);
+	auto i_origin = std::find(order.begin(), order.end(), origin) - order.begin();
+	for (int i = 0; i < n_cities; i++)
+		REQUIRE(tree.position(order[i]) == (i - i_origin + n_cities) % n_cities);
+}
+
+TEST_CASE("Tour iterators and segment runs", "[two level tree]")
+{
+	int n_cities = 23, origin = 1;
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour({ 11, 13, 6, 8, 4, 1, 2, 5, 9, 10, 7, 12, 14, 3, 15, 16, 17, 18, 20, 19, 23, 22, 21 });
+	tree.reverse(13, 6);
+	tree.reverse(9, 16);
+	tree.reverse(10, 18);
+
+	for (int start : { -1, 1, 7, 21 })
+	{
+		std::vector<int> forward(tree.begin(start), tree.end());
+		REQUIRE(forward == tree.get_raw_tour(start));
+		std::vector<int> backward;
+		for (int city : tree.cities(start, tsp::Direction::backward))
+			backward.push_back(city);
+		REQUIRE(backward == tree.get_raw_tour(start, tsp::Direction::backward));
+	}
+	REQUIRE(std::accumulate(tree.begin(), tree.end(), 0) == n_cities * (n_cities + 1) / 2);
+	REQUIRE(tree.begin().node() == tree.origin_city_node());
+
+	std::vector<int> via_runs;
+	int n_runs = 0;
+	for (auto run : tree.segment_runs(12))
+	{
+		int size = 1;
+		auto node = run.reverse ? run.segment_end_node : run.segment_begin_node;
+		auto last = run.reverse ? run.segment_begin_node : run.segment_end_node;
+		for (; node != last; node = run.reverse ? node->prev : node->next, size++)
+			via_runs.push_back(node->city);
+		via_runs.push_back(last->city);
+		REQUIRE(size == run.size);
+		n_runs++;
+	}
+	REQUIRE(n_runs == tree.n_segments());
+	REQUIRE(via_runs == tree.get_raw_tour(tree.get_parent_node(12)->forward_begin_node()->city));
+}
+
+TEST_CASE("Batched queries", "[two level tree]")
+{
+	int n_cities = 500, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 37 };
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	for (int i = 0; i < 100; i++)
+		tree.reverse(city_dist(rng), city_dist(rng));
+
+	// not a multiple of the block size
+	int n_queries = 1000 + 7;
+	std::vector<int> cities(n_queries), next(n_queries), prev(n_queries), triples;
+	for (auto& city : cities)
+		city = city_dist(rng);
+	tree.get_next_batch(cities.data(), n_queries, next.data());
+	tree.get_prev_batch(cities.data(), n_queries, prev.data());
+	for (int i = 0; i < n_queries; i++)
+	{
+		REQUIRE(next[i] == tree.get_next(cities[i]));
+		REQUIRE(prev[i] == tree.get_prev(cities[i]));
+	}
+
+	while (triples.size() < 3 * static_cast<std::size_t>(n_queries))
+	{
+		int a = city_dist(rng), b = city_dist(rng), c = city_dist(rng);
+		if (a != b && b != c && a != c)
+			triples.insert(triples.end(), { a, b, c });
+	}
+	std::unique_ptr<bool[]> result{ new bool[n_queries] };
+	tree.is_between_batch(triples.data(), n_queries, result.get());
+	for (int i = 0; i < n_queries; i++)
+		REQUIRE(result[i] == tree.is_between(triples[3 * i], triples[3 * i + 1], triples[3 * i + 2]));
+	tree.get_next_batch(cities.data(), 0, next.data());
+}
+
+TEST_CASE("Save and load the tree state", "[two level tree]")
+{
+	int n_cities = 200, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 41 };
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	for (int i = 0; i < 100; i++)
+		tree.reverse(city_dist(rng), city_dist(rng));
+	std::stringstream ss;
+	REQUIRE(tree.save(ss));
+	auto state = ss.str();
+
+	// the segment layout is restored as well, even if the target tree is built with another one
+	tsp::SegmentPolicy policy;
+	policy.n_segments = 5;
+	tsp::TwoLevelTree loaded{ n_cities, origin, policy };
+	std::istringstream is{ state };
+	REQUIRE(loaded.load(is));
+	REQUIRE(loaded.n_segments() == tree.n_segments());
+	REQUIRE(loaded.get_raw_tour() == tree.get_raw_tour());
+	REQUIRE(loaded.actual_segment_sizes(origin) == tree.actual_segment_sizes(origin));
+	REQUIRE(get_tour_via_parents(loaded, origin) == get_tour_via_parents(tree, origin));
+	for (int i = 0; i < 100; i++)
+	{
+		int a = city_dist(rng), b = city_dist(rng);
+		tree.reverse(a, b);
+		loaded.reverse(a, b);
+	}
+	REQUIRE(loaded.get_raw_tour() == tree.get_raw_tour());
+	REQUIRE(loaded.actual_segment_sizes(origin) == tree.actual_segment_sizes(origin));
+
+	SECTION("Invalid states")
+	{
+		auto before = loaded.get_raw_tour();
+		auto rejects = [&loaded, &before](const std::string& s) {
+			std::istringstream is{ s };
+			REQUIRE_FALSE(loaded.load(is));
+			REQUIRE(loaded.get_raw_tour() == before);
+		};
+		rejects("");
+		rejects(state.substr(0, state.size() / 2));  // truncated
+		auto bad_magic = state;
+		bad_magic[0] = 'X';
+		rejects(bad_magic);
+		auto bad_link = state;
+		bad_link[bad_link.size() - 1] = '\x7f';  // the parent index of the last node
+		rejects(bad_link);
+
+		// links within the ranges that do not make up a tour: the state is the magic, a header of 4 words,
+		// 7 words (id, size, reverse, prev, next, begin, end) per segment and then 4 words (id, prev, next,
+		// parent) per city
+		int n_segments = tree.n_segments();
+		auto word = [&state](int i) {
+			std::int32_t value;
+			std::memcpy(&value, &state[4 + 4 * static_cast<std::size_t>(i)], sizeof(value));
+			return value;
+		};
+		auto corrupted = [&state](int i, std::int32_t value) {
+			auto s = state;
+			std::memcpy(&s[4 + 4 * static_cast<std::size_t>(i)], &value, sizeof(value));
+			return s;
+		};
+		auto parent_word = [](int i, int field) { return 4 + 7 * i + field; };
+		auto node_word = [&](int city, int field) { return 4 + 7 * n_segments + 4 * (city - origin) + field; };
+		rejects(corrupted(node_word(1, 2), 1));  // a self loop
+		rejects(corrupted(node_word(1, 1), word(node_word(1, 2))));
+		rejects(corrupted(node_word(1, 2), word(node_word(word(node_word(1, 2)), 2))));  // a skipped city
+		rejects(corrupted(node_word(1, 3), (word(node_word(1, 3)) + 1) % n_segments));  // in another segment
+		rejects(corrupted(node_word(1, 0), word(node_word(1, 0)) + 1));  // a gap in the ids
+		rejects(corrupted(parent_word(0, 1), word(parent_word(0, 1)) + 1));  // the sizes do not add up
+		rejects(corrupted(parent_word(0, 4), 0));  // the parents are not a single cycle
+		rejects(corrupted(parent_word(0, 0), (word(parent_word(0, 0)) + 1) % n_segments));
+		rejects(corrupted(parent_word(0, 2), word(parent_word(0, 2)) == 0));  // the other direction
+		rejects(corrupted(parent_word(0, 5), word(parent_word(0, 6))));
+
+		tsp::TwoLevelTree other{ n_cities + 1, origin };
+		std::istringstream is{ state };
+		REQUIRE_FALSE(other.load(is));
+	}
+}
+
+TEST_CASE("Storage order", "[two level tree]")
+{
+	// on a 4 x 4 grid, the Hilbert curve only moves to a neighbor cell
+	std::vector<double> x, y;
+	for (int i = 0; i < 16; i++)
+	{
+		x.push_back(i % 4);
+		y.push_back(i / 4);
+	}
+	auto hilbert = tsp::TwoLevelTree::hilbert_order(x, y, 1);
+	REQUIRE(hilbert.size() == 16);
+	for (std::size_t i = 1; i < hilbert.size(); i++)
+	{
+		int u = hilbert[i - 1] - 1, v = hilbert[i] - 1;
+		REQUIRE(std::abs(x[u] - x[v]) + std::abs(y[u] - y[v]) == 1.0);
+	}
+
+	int n_cities = 300, origin = 1;
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::mt19937 rng{ 43 };
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_real_distribution<double> coordinate_dist{ 0, 1000 };
+	x.resize(n_cities);
+	y.resize(n_cities);
+	for (int i = 0; i < n_cities; i++)
+		x[i] = coordinate_dist(rng), y[i] = coordinate_dist(rng);
+
+	tsp::TwoLevelTree plain{ n_cities, origin }, permuted{ n_cities, origin };
+	permuted.set_storage_order(tsp::TwoLevelTree::hilbert_order(x, y, origin));  // before the tour
+	plain.set_raw_tour(order);
+	permuted.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+	auto same_as_plain = [&]() {
+		REQUIRE(permuted.get_raw_tour() == plain.get_raw_tour());
+		REQUIRE(permuted.actual_segment_sizes(origin) == plain.actual_segment_sizes(origin));
+		REQUIRE(get_tour_via_parents(permuted, origin) == get_tour_via_parents(plain, origin));
+		for (int k = 0; k < 20; k++)
+		{
+			int a = city_dist(rng), b = city_dist(rng), c = city_dist(rng);
+			REQUIRE(permuted.get_node(a)->city == a);
+			if (a != b && b != c && a != c)
+				REQUIRE(permuted.is_between(a, b, c) == plain.is_between(a, b, c));
+		}
+	};
+	for (int i = 0; i < 200; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		plain.reverse(a, c);
+		permuted.reverse(a, c);
+		if (i % 50 == 0)
+		{
+			same_as_plain();
+			permuted.compact();
+			same_as_plain();
+		}
+	}
+
+	// after compacting, the nodes are stored along the tour
+	permuted.compact();
+	auto tour = permuted.get_raw_tour();
+	for (int i = 0; i + 1 < n_cities; i++)
+		REQUIRE(permuted.get_node(tour[i + 1]) == permuted.get_node(tour[i]) + 1);
+
+	// the other state operations keep the permutation
+	auto snapshot = permuted.snapshot();
+	tsp::TwoLevelTree copied{ permuted };
+	std::stringstream ss;
+	REQUIRE(permuted.save(ss));
+	for (int i = 0; i < 20; i++)
+		permuted.reverse(city_dist(rng), city_dist(rng));
+	permuted.restore(snapshot);
+	REQUIRE(permuted.get_raw_tour() == tour);
+	REQUIRE(copied.get_raw_tour() == tour);
+	REQUIRE(copied.get_node(tour[1]) == copied.get_node(tour[0]) + 1);
+	REQUIRE(plain.load(ss));
+	REQUIRE(plain.get_raw_tour() == tour);
+	std::vector<int> endpoints;
+	permuted.random_double_bridges(10, rng, 0, &endpoints);
+	REQUIRE(std::find(endpoints.begin(), endpoints.end(), 0) == endpoints.end());
+
+	// a rollback undoes the storage order of a restored snapshot
+	tour = permuted.get_raw_tour();
+	std::vector<int> storage_order(tour);
+	std::shuffle(storage_order.begin(), storage_order.end(), rng);
+	permuted.set_storage_order(storage_order);
+	permuted.track_changes();
+	permuted.begin_transaction();
+	permuted.restore(snapshot);
+	permuted.restore(snapshot);
+	permuted.rollback();
+	REQUIRE(permuted.get_raw_tour() == tour);
+	REQUIRE(permuted.get_node(storage_order[1]) == permuted.get_node(storage_order[0]) + 1);
+	REQUIRE(permuted.changed_cities().size() == n_cities);
+	permuted.clear_changed_cities();
+	permuted.reverse(tour[10], tour[20]);
+	REQUIRE(permuted.changed_cities().size() == 4);
+	permuted.track_changes(false);
+
+	// back to the identity
+	std::vector<int> identity(n_cities);
+	std::iota(identity.begin(), identity.end(), origin);
+	tour = permuted.get_raw_tour();
+	permuted.set_storage_order(identity);
+	REQUIRE(permuted.get_raw_tour() == tour);
+	REQUIRE(permuted.get_node(origin + 1) == permuted.get_node(origin) + 1);
+}
+
+TEST_CASE("Change tracking", "[two level tree]")
+{
+	int n_cities = 300, origin = 1;
+	std::mt19937 rng{ 18 };
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tree.set_raw_tour(order);
+	REQUIRE(!tree.change_tracking_enabled());
+	tree.flip(order[0], order[1], order[10], order[11]);
+	REQUIRE(tree.changed_cities().empty());
+
+	tree.track_changes();
+	REQUIRE(tree.change_tracking_enabled());
+	REQUIRE(tree.changed_cities().empty());
+	auto changed = [&tree]() { 
+		return std::set<int>(tree.changed_cities().begin(), tree.changed_cities().end()); 
+	};
+
+	SECTION("Moves record the endpoints of the changed arcs")
+	{
+		int a = order[20], b = tree.get_next(a), c = b, d;
+		for (int k = 0; k < 30; k++)
+			c = tree.get_next(c);
+		d = tree.get_next(c);
+		tree.flip(a, b, c, d);
+		REQUIRE(changed() == std::set<int>({ a, b, c, d }));
+		REQUIRE(tree.changed_cities().size() == 4);
+		tree.clear_changed_cities();
+		REQUIRE(tree.changed_cities().empty());
+
+		// reversing the whole tour or a single city changes no neighbors
+		tree.reverse(a, a);
+		tree.reverse(a, tree.get_prev(a));
+		REQUIRE(tree.changed_cities().empty());
+
+		auto raw_tour = tree.get_raw_tour();
+		int s1 = raw_tour[50], s2 = raw_tour[52], p = raw_tour[200];
+		std::set<int> expected{ raw_tour[49], s1, s2, raw_tour[53], p, raw_tour[201] };
+		tree.or_move(s1, s2, p, true);
+		REQUIRE(changed() == expected);
+		tree.clear_changed_cities();
+
+		raw_tour = tree.get_raw_tour();
+		expected.clear();
+		for (int i : { 10, 11, 100, 101, 150, 151, 250, 251 })
+			expected.insert(raw_tour[i]);
+		tree.double_bridge_move(raw_tour[10], raw_tour[100], raw_tour[150], raw_tour[250]);
+		REQUIRE(changed() == expected);
+		tree.clear_changed_cities();
+
+		// a rebalance keeps the tour and so does not record anything
+		tree.rebalance();
+		REQUIRE(tree.changed_cities().empty());
+		tree.set_raw_tour(order);
+		REQUIRE(tree.changed_cities().size() == n_cities);
+	}
+
+	SECTION("All the cities with new neighbors are recorded")
+	{
+		std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+		for (int i = 0; i < 300; i++)
+		{
+			auto neighbors = [&tree](int c) { 
+				return std::make_pair(std::min(tree.get_prev(c), tree.get_next(c)), std::max(tree.get_prev(c), tree.get_next(c)));
+			};
+			std::vector<std::pair<int, int>> before(origin + n_cities);
+			for (int c = origin; c < origin + n_cities; c++)
+				before[c] = neighbors(c);
+			if (i % 3 == 0)
+			{
+				tree.reverse(city_dist(rng), city_dist(rng));
+			}
+			else if (i % 3 == 1)
+			{
+				auto raw_tour = tree.get_raw_tour();
+				int k = std::uniform_int_distribution<int>{ 0, n_cities - 10 }(rng);
+				int len = std::uniform_int_distribution<int>{ 0, 3 }(rng);
+				int p = std::uniform_int_distribution<int>{ k + len + 1, n_cities - 1 }(rng);
+				tree.or_move(raw_tour[k], raw_tour[k + len], raw_tour[p], i % 2 == 0);
+			}
+			else
+			{
+				tree.random_double_bridges(1, rng, i % 2 == 0 ? 30 : 0);
+			}
+			auto recorded = changed();
+			for (int c = origin; c < origin + n_cities; c++)
+			{
+				if (before[c] != neighbors(c))
+					REQUIRE(recorded.count(c) == 1);
+			}
+			// each city is queued once
+			REQUIRE(recorded.size() == tree.changed_cities().size());
+			if (i % 10 == 0)
+				tree.clear_changed_cities();
+		}
+	}
+
+	SECTION("Rollback records the restored cities")
+	{
+		auto raw_tour = tree.get_raw_tour();
+		tree.begin_transaction();
+		tree.flip(raw_tour[5], raw_tour[6], raw_tour[80], raw_tour[81]);
+		tree.clear_changed_cities();
+		tree.rollback();
+		REQUIRE(tree.get_raw_tour() == raw_tour);
+		for (int i : { 5, 6, 80, 81 })
+			REQUIRE(changed().count(raw_tour[i]) == 1);
+	}
+
+	SECTION("Reordering the storage keeps the queue")
+	{
+		auto raw_tour = tree.get_raw_tour();
+		tree.flip(raw_tour[5], raw_tour[6], raw_tour[80], raw_tour[81]);
+		auto queued = changed();
+		tree.compact();
+		REQUIRE(changed() == queued);
+		tree.clear_changed_cities();
+		REQUIRE(tree.changed_cities().empty());
+
+		// the flags of the queue follow the nodes, so every city is recorded again by the next moves
+		auto require_all_recorded = [&]() {
+			for (int c = origin; c < origin + n_cities; c++)
+			{
+				int b = tree.get_prev(c), d = tree.get_next(tree.get_next(c)), e = tree.get_next(d);
+				tree.reverse(c, d);
+				REQUIRE(changed() == std::set<int>({ b, c, d, e }));
+				tree.clear_changed_cities();
+			}
+		};
+		require_all_recorded();
+
+		tree.reverse(raw_tour[20], raw_tour[60]);
+		tree.set_storage_order(std::vector<int>(order.rbegin(), order.rend()));
+		tree.clear_changed_cities();
+		require_all_recorded();
+	}
+
+	tree.track_changes(false);
+	tree.flip(order[0], order[1], order[10], order[11]);
+	REQUIRE(tree.changed_cities().empty());
+}
+
+TEST_CASE("Edge differences of two tours", "[two level tree]")
+{
+	int n_cities = 400, origin = 1;
+	std::mt19937 rng{ 20 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree first{ n_cities, origin };
+	first.set_raw_tour(order);
+	tsp::TwoLevelTree second{ first };
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	auto edges_of = [](const tsp::TwoLevelTree& tree) {
+		std::set<std::pair<int, int>> edges;
+		auto tour = tree.get_raw_tour();
+		for (std::size_t i = 0; i < tour.size(); i++)
+		{
+			int a = tour[i], b = tour[(i + 1) % tour.size()];
+			edges.emplace(std::min(a, b), std::max(a, b));
+		}
+		return edges;
+	};
+	auto check = [&]() {
+		auto edges1 = edges_of(first), edges2 = edges_of(second);
+		std::set<std::pair<int, int>> expected_common, expected_differing;
+		for (auto& e : edges1)
+			(edges2.count(e) ? expected_common : expected_differing).insert(e);
+		std::vector<std::pair<int, int>> differing, common;
+		first.diff_edges(second, differing, &common);
+		REQUIRE(std::set<std::pair<int, int>>(differing.begin(), differing.end()) == expected_differing);
+		REQUIRE(std::set<std::pair<int, int>>(common.begin(), common.end()) == expected_common);
+		REQUIRE(differing.size() + common.size() == n_cities);
+		REQUIRE(first.count_common_edges(second) == (int)expected_common.size());
+		REQUIRE(second.count_common_edges(first) == (int)expected_common.size());
+		// without the common edges
+		second.diff_edges(first, differing);
+		REQUIRE(differing.size() == n_cities - expected_common.size());
+	};
+
+	REQUIRE(first.count_common_edges(second) == n_cities);
+	for (int i = 0; i < 100; i++)
+	{
+		second.reverse(city_dist(rng), city_dist(rng));
+		if (i % 10 == 0)
+			check();
+	}
+	// a tour in another orientation, storage order and segment layout
+	std::reverse(order.begin(), order.end());
+	first = tsp::TwoLevelTree{ n_cities, origin, tsp::SegmentPolicy{ 7, 0, 0.75 } };
+	first.set_raw_tour(order);
+	check();
+	std::vector<int> identity(n_cities);
+	std::iota(identity.begin(), identity.end(), origin);
+	std::shuffle(identity.begin(), identity.end(), rng);
+	first.set_storage_order(identity);
+	check();
+	second = first;
+	REQUIRE(second.count_common_edges(first) == n_cities);
+}
+
+TEST_CASE("Concurrent readers", "[two level tree]")
+{
+	int n_cities = 2000, origin = 1;
+	std::mt19937 rng{ 22 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	tree.enable_concurrent_reads();
+	REQUIRE(tree.concurrent_reads_enabled());
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	SECTION("The same results as the plain queries")
+	{
+		for (int i = 0; i < 200; i++)
+		{
+			tree.reverse(city_dist(rng), city_dist(rng));
+			int a = city_dist(rng), b = city_dist(rng), c = city_dist(rng);
+			REQUIRE(tree.concurrent_get_next(a) == tree.get_next(a));
+			REQUIRE(tree.concurrent_get_prev(a) == tree.get_prev(a));
+			if (a != b && b != c && a != c)
+				REQUIRE(tree.concurrent_is_between(a, b, c) == tree.is_between(a, b, c));
+		}
+		// the other moves and a complete rebuild publish their writes as well
+		tree.random_double_bridges(20, rng);
+		auto raw_tour = tree.get_raw_tour();
+		tree.or_move(raw_tour[10], raw_tour[12], raw_tour[1500], true);
+		tree.begin_transaction();
+		tree.reverse(raw_tour[100], raw_tour[900]);
+		tree.rollback();
+		tree.rebalance();
+		tree.split_and_merge(tree.get_node(raw_tour[5]), false, tsp::Direction::forward);
+		tree.split_and_merge(tree.get_node(raw_tour[700]), true, tsp::Direction::backward);
+		tsp::TwoLevelTree copy{ tree };
+		REQUIRE(copy.concurrent_reads_enabled());
+		// an assignment takes the mode of its source like a copy
+		tsp::TwoLevelTree assigned{ n_cities, origin };
+		assigned = tree;
+		REQUIRE(assigned.concurrent_reads_enabled());
+		for (int city = origin; city < origin + n_cities; city++)
+		{
+			REQUIRE(tree.concurrent_get_next(city) == tree.get_next(city));
+			REQUIRE(copy.concurrent_get_next(city) == tree.get_next(city));
+			REQUIRE(assigned.concurrent_get_next(city) == tree.get_next(city));
+		}
+		tree.enable_concurrent_reads(false);
+		REQUIRE(!tree.concurrent_reads_enabled());
+		assigned = tree;
+		REQUIRE(!assigned.concurrent_reads_enabled());
+	}
+
+	SECTION("Readers never see a torn state")
+	{
+		// the writer reverses short disjoint paths in place, each of them back and forth, so each 
+		// neighbor read must be from one of the two states of its path
+		auto tour0 = tree.get_raw_tour();
+		const int n_paths = 40, path_length = 8, stride = n_cities / n_paths;
+		std::vector<std::vector<int>> allowed(origin + n_cities);
+		for (int i = 0; i < n_cities; i++)
+		{
+			allowed[tour0[i]] = { tour0[(i + n_cities - 1) % n_cities], tour0[(i + 1) % n_cities] };
+		}
+		for (int k = 0; k < n_paths; k++)
+		{
+			auto tour1 = tour0;
+			int i1 = k * stride + 1, i2 = i1 + path_length - 1;
+			std::reverse(tour1.begin() + i1, tour1.begin() + i2 + 1);
+			for (int i = i1 - 1; i <= i2 + 1; i++)
+			{
+				allowed[tour1[i]].insert(allowed[tour1[i]].end(), 
+					{ tour1[(i + n_cities - 1) % n_cities], tour1[(i + 1) % n_cities] });
+			}
+		}
+		std::atomic<bool> done{ false };
+		std::atomic<int> n_failures{ 0 };
+		std::vector<std::thread> readers;
+		for (int t = 0; t < 3; t++)
+		{
+			readers.emplace_back([&, t]() {
+				std::mt19937 reader_rng(100 + t);
+				std::uniform_int_distribution<int> dist{ 0, n_paths * (path_length + 2) - 1 };
+				while (!done.load())
+				{
+					int r = dist(reader_rng);
+					int city = tour0[(r / (path_length + 2)) * stride + r % (path_length + 2)];
+					int next = tree.concurrent_get_next(city), prev = tree.concurrent_get_prev(city);
+					auto& ok = allowed[city];
+					// the two queries may see different states
+					if (std::find(ok.begin(), ok.end(), next) == ok.end() || std::find(ok.begin(), ok.end(), prev) == ok.end()
+						|| next == city || prev == city)
+						n_failures++;
+				}
+			});
+		}
+		for (int i = 0; i < 20000; i++)
+		{
+			int k = i % n_paths, i1 = k * stride + 1, i2 = i1 + path_length - 1;
+			// the path is reversed back by the same call, since it is always given in the current forward order
+			if ((i / n_paths) % 2 == 0)
+				tree.reverse(tour0[i1], tour0[i2]);
+			else
+				tree.reverse(tour0[i2], tour0[i1]);
+		}
+		done = true;
+		for (auto& reader : readers)
+			reader.join();
+		REQUIRE(n_failures == 0);
+		// an even number of reversals
+		REQUIRE(tree.get_raw_tour() == tour0);
+	}
+}
+
+TEST_CASE("Parallel bulk operations", "[two level tree]")
+{
+	int n_cities = 5000, origin = 3;
+	std::mt19937 rng{ 23 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree serial{ n_cities, origin }, parallel{ n_cities, origin };
+	tsp::ParallelPolicy policy;
+	policy.n_threads = 4;
+	policy.min_cities = 1000;
+	parallel.set_parallel_policy(policy);
+	REQUIRE(parallel.parallel_policy().n_threads == 4);
+	serial.set_raw_tour(order);
+	parallel.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	auto check = [&]() {
+		REQUIRE(parallel.get_raw_tour() == serial.get_raw_tour());
+		REQUIRE(get_tour_via_parents(parallel, origin) == get_tour_via_parents(serial, origin));
+		std::vector<int> a, b;
+		for (int k = 0; k < 5; k++)
+		{
+			int start = city_dist(rng);
+			auto direction = k % 2 ? tsp::Direction::forward : tsp::Direction::backward;
+			parallel.to_raw_tour(a, start, direction);
+			serial.to_raw_tour(b, start, direction);
+			REQUIRE(a == b);
+		}
+	};
+	check();
+	for (int i = 0; i < 300; i++)
+	{
+		int a = city_dist(rng), c = city_dist(rng);
+		serial.reverse(a, c);
+		parallel.reverse(a, c);
+		if (i % 50 == 0)
+			check();
+	}
+	// a rebuild from the current tour and a copy keep the policy
+	parallel.rebalance();
+	serial.rebalance();
+	check();
+	tsp::TwoLevelTree copy{ parallel };
+	REQUIRE(copy.parallel_policy().n_threads == 4);
+	REQUIRE(copy.get_raw_tour() == serial.get_raw_tour());
+
+	// below the threshold, the serial path is taken
+	policy.min_cities = n_cities + 1;
+	parallel.set_parallel_policy(policy);
+	check();
+}
+
+TEST_CASE("Tour length from segment costs", "[two level tree]")
+{
+	int n_cities = 500, origin = 2;
+	std::mt19937 rng{ 25 };
+	// integral lengths, which are summed exactly
+	std::vector<int> x(origin + n_cities), y(origin + n_cities);
+	std::uniform_int_distribution<int> coordinate_dist{ 0, 1000 };
+	for (int city = origin; city < origin + n_cities; city++)
+	{
+		x[city] = coordinate_dist(rng);
+		y[city] = coordinate_dist(rng);
+	}
+	auto distance = [&x, &y](int a, int b) { return std::round(std::hypot(x[a] - x[b], y[a] - y[b])); };
+	auto length_of = [&distance](const std::vector<int>& tour) {
+		double length = 0;
+		for (std::size_t i = 0; i < tour.size(); i++)
+			length += distance(tour[i], tour[(i + 1) % tour.size()]);
+		return length;
+	};
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	auto check = [&](const tsp::TwoLevelTree& tree) {
+		REQUIRE(tree.tour_length() == length_of(tree.get_raw_tour()));
+		for (int k = 0; k < 20; k++)
+		{
+			int a = city_dist(rng), b = city_dist(rng);
+			double expected = 0;
+			for (int c = a; c != b; c = tree.get_next(c))
+				expected += distance(c, tree.get_next(c));
+			REQUIRE(tree.path_cost(a, b) == expected);
+		}
+		REQUIRE(tree.path_cost(order[7], order[7]) == 0);
+	};
+
+	SECTION("Setting the distance before or after the tour")
+	{
+		tsp::TwoLevelTree tree{ n_cities, origin };
+		REQUIRE(!tree.has_distance());
+		REQUIRE(tree.tour_length() == 0);
+		tree.set_distance(distance);
+		REQUIRE(tree.has_distance());
+		tree.set_raw_tour(order);
+		check(tree);
+		tsp::TwoLevelTree other{ n_cities, origin };
+		other.set_raw_tour(order);
+		other.set_distance(distance);
+		check(other);
+		other.set_distance(nullptr);
+		REQUIRE(!other.has_distance());
+		REQUIRE(other.tour_length() == 0);
+	}
+
+	SECTION("Random moves")
+	{
+		for (auto mode : { tsp::Rebalance::implicit, tsp::Rebalance::local, tsp::Rebalance::relayout })
+		{
+			tsp::TwoLevelTree tree{ n_cities, origin };
+			tsp::RebalancePolicy policy;
+			policy.mode = mode;
+			policy.max_ratio = 2.0;
+			policy.min_ratio = 0.5;
+			tree.set_rebalance_policy(policy);
+			tree.set_raw_tour(order);
+			tree.set_distance(distance);
+			for (int i = 0; i < 1500; i++)
+			{
+				int a = city_dist(rng), c = city_dist(rng);
+				switch (i % 4)
+				{
+				case 0:
+					tree.reverse(a, c);
+					break;
+				case 1:
+					if (a != c && tree.get_next(a) != c && tree.get_next(c) != a)
+						tree.flip(a, tree.get_next(a), c, tree.get_next(c));
+					break;
+				case 2:
+					tree.random_double_bridges(1, rng, i % 8 == 2 ? 50 : 0);
+					break;
+				default:
+				{
+					int s2 = tree.get_next(tree.get_next(a));
+					if (c != a && c != s2 && c != tree.get_next(a))
+						tree.or_move(a, s2, c, i % 8 == 3);
+				}
+				}
+				if (i % 100 == 0)
+					check(tree);
+			}
+			check(tree);
+		}
+	}
+
+	SECTION("Rollback, restore, load and copies")
+	{
+		tsp::TwoLevelTree tree{ n_cities, origin };
+		tree.set_raw_tour(order);
+		tree.set_distance(distance);
+		double initial = tree.tour_length();
+		auto snapshot = tree.snapshot();
+		tree.begin_transaction();
+		for (int i = 0; i < 50; i++)
+			tree.reverse(city_dist(rng), city_dist(rng));
+		tree.or_move(order[0], order[2], order[100]);
+		tree.rollback();
+		REQUIRE(tree.tour_length() == initial);
+		check(tree);
+
+		tree.random_double_bridges(20, rng);
+		std::stringstream state;
+		REQUIRE(tree.save(state));
+		tsp::TwoLevelTree copy{ tree };
+		check(copy);
+		tree.restore(snapshot);
+		REQUIRE(tree.tour_length() == initial);
+		check(tree);
+		REQUIRE(tree.load(state));
+		REQUIRE(tree.tour_length() == copy.tour_length());
+		check(tree);
+		copy = tree;
+		tree.rebalance();
+		check(tree);
+		check(copy);
+	}
+}
+
+TEST_CASE("Sequences of cities in tour order", "[two level tree]")
+{
+	int n_cities = 300, origin = 1;
+	std::mt19937 rng{ 28 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin(), order.end(), rng);
+	tsp::TwoLevelTree tree{ n_cities, origin };
+	tree.set_raw_tour(order);
+	std::uniform_int_distribution<int> city_dist{ origin, origin + n_cities - 1 };
+
+	// k distinct cities, a few of them in one segment
+	auto random_cities = [&](int k) {
+		std::vector<int> cities;
+		while (static_cast<int>(cities.size()) < k)
+		{
+			int city = cities.empty() || city_dist(rng) % 2 ? city_dist(rng) : tree.get_next(cities.back());
+			if (std::find(cities.begin(), cities.end(), city) == cities.end())
+				cities.push_back(city);
+		}
+		return cities;
+	};
+	auto check = [&]() {
+		for (int i = 0; i < 50; i++)
+		{
+			// once with more cities than sort_by_tour_order sorts on the stack
+			auto cities = random_cities(i == 0 ? 40 : 2 + i % 7);
+			int k = static_cast<int>(cities.size());
+			bool expected = true;
+			for (int j = 1; j + 1 < k; j++)
+				expected = expected && is_between(tree, cities[0], cities[j], cities[j + 1]);
+			REQUIRE(tree.is_sequence(cities.data(), k) == expected);
+
+			auto tour = tree.get_raw_tour(cities[0]);
+			std::vector<int> position(origin + n_cities);
+			for (int j = 0; j < n_cities; j++)
+				position[tour[j]] = j;
+			auto sorted = cities;
+			std::sort(sorted.begin(), sorted.end(), [&position](int a, int b) { return position[a] < position[b]; });
+			tree.sort_by_tour_order(cities.data(), k);
+			REQUIRE(cities == sorted);
+			REQUIRE(tree.is_sequence(cities.data(), k));
+			if (k >= 3)
+			{
+				std::swap(cities[1], cities[2]);
+				REQUIRE(!tree.is_sequence(cities.data(), k));
+			}
+		}
+	};
+
+	check();
+	for (int i = 0; i < 300; i++)
+	{
+		int a = city_dist(rng), b = city_dist(rng);
+		if (i % 3 == 2)
+			tree.random_double_bridges(1, rng);
+		else
+			tree.reverse(a, b);
+		if (i % 30 == 0)
+			check();
+	}
+	check();
+}
+
+TEST_CASE("Sparse city ids", "[two level tree]")
+{
+	SECTION("Only the cities from the origin are stored")
+	{
+		int n_cities = 1000, origin = 1000000;
+		tsp::TwoLevelTree tree{ n_cities, origin };
+		std::vector<int> order(n_cities);
+		std::iota(order.begin(), order.end(), origin);
+		tree.set_raw_tour(order);
+		REQUIRE(tree.snapshot().nodes.size() == n_cities);
+		REQUIRE(tree.get_next(origin + n_cities - 1) == origin);
+		REQUIRE(tree.contains(origin));
+		REQUIRE(!tree.contains(origin - 1));
+		REQUIRE(!tree.contains(origin + n_cities));
+		REQUIRE(!tree.has_city_ids());
+	}
+
+	SECTION("The same moves as on consecutive cities")
+	{
+		int n_cities = 400;
+		std::mt19937 rng{ 30 };
+		// random distinct ids up to 1e8, where ids[i] plays the role of city i of a reference tree
+		std::set<int> id_set;
+		std::uniform_int_distribution<int> id_dist{ 0, 100000000 };
+		while (static_cast<int>(id_set.size()) < n_cities)
+			id_set.insert(id_dist(rng));
+		std::vector<int> ids(id_set.begin(), id_set.end());
+		std::shuffle(ids.begin(), ids.end(), rng);
+		auto to_ids = [&ids](std::vector<int> cities) {
+			for (auto& city : cities)
+				city = ids[city];
+			return cities;
+		};
+
+		std::vector<int> order(n_cities);
+		std::iota(order.begin(), order.end(), 0);
+		std::shuffle(order.begin(), order.end(), rng);
+		tsp::TwoLevelTree reference{ n_cities };
+		reference.set_raw_tour(order);
+		tsp::TwoLevelTree tree{ ids };
+		tree.set_raw_tour(to_ids(order));
+		REQUIRE(tree.has_city_ids());
+		REQUIRE(tree.n_cities() == n_cities);
+		REQUIRE(tree.origin_city() == ids[0]);
+		REQUIRE(tree.snapshot().nodes.size() == n_cities);
+		for (int id : ids)
+			REQUIRE(tree.contains(id));
+		REQUIRE(!tree.contains(-1));
+		REQUIRE(!tree.contains(100000001));
+
+		auto check = [&]() {
+			REQUIRE(tree.get_raw_tour() == to_ids(reference.get_raw_tour()));
+			REQUIRE(tree.actual_segment_sizes() == reference.actual_segment_sizes());
+			for (int i = 0; i < 20; i++)
+			{
+				int a = i * 17 % n_cities, b = i * 31 % n_cities, c = i * 43 % n_cities;
+				REQUIRE(tree.get_next(ids[a]) == ids[reference.get_next(a)]);
+				REQUIRE(tree.get_prev(ids[a]) == ids[reference.get_prev(a)]);
+				if (a != b && b != c && a != c)
+					REQUIRE(tree.is_between(ids[a], ids[b], ids[c]) == reference.is_between(a, b, c));
+			}
+		};
+
+		tree.track_changes(true);
+		std::uniform_int_distribution<int> city_dist{ 0, n_cities - 1 };
+		for (int i = 0; i < 200; i++)
+		{
+			int a = city_dist(rng), c = city_dist(rng);
+			switch (i % 4)
+			{
+			case 0:
+				reference.reverse(a, c);
+				tree.reverse(ids[a], ids[c]);
+				break;
+			case 1:
+				if (a != c && reference.get_next(a) != c && reference.get_next(c) != a)
+				{
+					reference.flip(a, reference.get_next(a), c, reference.get_next(c));
+					tree.flip(ids[a], tree.get_next(ids[a]), ids[c], tree.get_next(ids[c]));
+				}
+				break;
+			case 2:
+			{
+				// the same random cities by their indices
+				std::mt19937 kick_rng{ static_cast<unsigned>(i) };
+				reference.random_double_bridges(1, kick_rng, i % 8 == 2 ? 40 : 0);
+				kick_rng.seed(static_cast<unsigned>(i));
+				tree.random_double_bridges(1, kick_rng, i % 8 == 2 ? 40 : 0);
+				break;
+			}
+			default:
+			{
+				int s2 = reference.get_next(reference.get_next(a));
+				if (c != a && c != s2 && c != reference.get_next(a))
+				{
+					reference.or_move(a, s2, c, i % 8 == 3);
+					tree.or_move(ids[a], ids[s2], ids[c], i % 8 == 3);
+				}
+			}
+			}
+			if (i % 20 == 0)
+				check();
+		}
+		check();
+		auto changed = tree.changed_cities();
+		REQUIRE(!changed.empty());
+		for (int city : changed)
+			REQUIRE(tree.contains(city));
+		tree.clear_changed_cities();
+		REQUIRE(tree.changed_cities().empty());
+
+		// the storage order, snapshots, checkpoints and copies keep the ids
+		auto snapshot = tree.snapshot();
+		tree.compact();
+		reference.compact();
+		check();
+		tree.begin_transaction();
+		tree.reverse(ids[3], ids[200]);
+		tree.rollback();
+		check();
+		std::stringstream state;
+		REQUIRE(tree.save(state));
+		tree.reverse(ids[3], ids[200]);
+		tsp::TwoLevelTree loaded{ ids };
+		REQUIRE(loaded.load(state));
+		tree.restore(snapshot);
+		check();
+		REQUIRE(loaded.get_raw_tour(ids[0]) == tree.get_raw_tour(ids[0]));
+		tsp::TwoLevelTree copy{ tree };
+		REQUIRE(copy.get_raw_tour() == tree.get_raw_tour());
+		REQUIRE(copy.count_common_edges(tree) == n_cities);
+		copy.reverse(ids[3], ids[200]);
+		REQUIRE(copy.count_common_edges(tree) == n_cities - 2);
+
+		auto policy = tsp::TwoLevelTree::tune_segment_policy(tree.get_raw_tour(), { { ids[1], ids[100] } }, { 10, 20 });
+		REQUIRE((policy.nominal_length == 10 || policy.nominal_length == 20));
+	}
+}
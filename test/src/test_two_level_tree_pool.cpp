@@ -0,0 +1,85 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include "two_level_tree_pool.h"
+#include "move_log.h"
+
+TEST_CASE("Tree pool", "[two level tree pool]")
+{
+	int n_cities = 500, origin = 2;
+	std::mt19937 rng{ 19 };
+	std::vector<int> order(n_cities);
+	std::iota(order.begin(), order.end(), origin);
+	std::shuffle(order.begin() + 1, order.end(), rng);  // the raw tour starts from the origin city
+	tsp::TwoLevelTreePool pool{ n_cities, origin };
+	REQUIRE(pool.size() == 0);
+
+	SECTION("A new tree is built if none is idle")
+	{
+		auto tree = pool.acquire(order);
+		REQUIRE(tree.n_cities() == n_cities);
+		REQUIRE(tree.origin_city() == origin);
+		REQUIRE(tree.get_raw_tour() == order);
+		tsp::TwoLevelTree expected{ n_cities, origin };
+		REQUIRE(tree.n_segments() == expected.n_segments());
+	}
+
+	SECTION("Released trees are recycled")
+	{
+		pool.reserve(3);
+		REQUIRE(pool.size() == 3);
+		auto parent = pool.acquire(order);
+		REQUIRE(pool.size() == 2);
+		const tsp::Node* storage = parent.get_node(origin);
+		parent.flip(order[0], order[1], order[100], order[101]);
+		auto tour = parent.get_raw_tour();
+		pool.release(std::move(parent));
+		REQUIRE(pool.size() == 3);
+
+		// the same storage comes back, with all the links in place
+		auto tree = pool.acquire();
+		REQUIRE(pool.size() == 2);
+		REQUIRE(tree.get_node(origin) == storage);
+		REQUIRE(tree.get_raw_tour() == tour);
+
+		// an offspring is a copy into the recycled storage of another tree
+		auto child = pool.acquire(tree);
+		REQUIRE(child.get_raw_tour() == tour);
+		REQUIRE(child.get_node(origin) != storage);
+		child.flip(tour[10], tour[11], tour[300], tour[301]);
+		REQUIRE(tree.get_raw_tour() == tour);
+		REQUIRE(child.get_raw_tour() != tour);
+
+		pool.release(std::move(child));
+		pool.release(std::move(tree));
+		REQUIRE(pool.size() == 3);
+		for (int i = 0; i < 3; i++)
+		{
+			auto t = pool.acquire(order);
+			REQUIRE(t.get_raw_tour() == order);
+		}
+		REQUIRE(pool.size() == 0);
+		pool.release(pool.acquire());
+		pool.clear();
+		REQUIRE(pool.size() == 0);
+	}
+
+	SECTION("Released trees drop the hooks of their last user")
+	{
+		auto tree = pool.acquire(order);
+		tsp::MoveLog log;
+		tree.set_move_log(&log);
+		tree.set_distance([](int a, int b) { return std::abs(a - b); });
+		REQUIRE(tree.has_distance());
+		pool.release(std::move(tree));
+
+		auto recycled = pool.acquire();
+		REQUIRE(recycled.move_log() == nullptr);
+		REQUIRE(!recycled.has_distance());
+		recycled.flip(order[0], order[1], order[100], order[101]);
+		REQUIRE(log.size() == 0);
+	}
+}